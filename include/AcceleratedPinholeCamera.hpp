@@ -1,21 +1,38 @@
-
 #ifndef __ACCELERATED_PINHOLE_CAMERA_HPP
 #define __ACCELERATED_PINHOLE_CAMERA_HPP
 
 #include <iostream>
-#include <OpenCL/cl.h>
 
 #include "Camera.hpp"
+#include "ComputeManager.hpp"
+#include "Scene.hpp"
+#include "PNGImage.hpp"
 
+/* Notes: The AcceleratedPinholeCamera renders whole frames on an OpenCL device. The scene grid is uploaded once
+ * (and again whenever it changes), after which only the finished RGB frame is read back. Both live in pooled,
+ * pinned device buffers, so rendering further frames allocates nothing. The kernel computes the directions of the
+ * default (spherical) lens model itself, so other lens models are ignored. */
 class AcceleratedPinholeCamera : public Camera {
     public:
         AcceleratedPinholeCamera(Point centre,Orientation orientation,Velocity velocity);
-        std::vector<Point> Trace(Distance distance);
+        ~AcceleratedPinholeCamera();
+        int RenderFrame(const Scene& scene,Distance distance,Bitmap& img);
+        int EnqueueFrame(const Scene& scene,Distance distance,DeviceBuffer& frame,Bitmap& img,cl_event *done);
     private:
-        cl_Point *_h_out;
+        AcceleratedPinholeCamera(const AcceleratedPinholeCamera&) = delete;
+        AcceleratedPinholeCamera& operator= (const AcceleratedPinholeCamera&) = delete;
+    
+        int UploadScene(const Scene& scene);
+        int AcquireFrameBuffer(DeviceBuffer& frame);
+        int EnqueueKernel(const Scene& scene,Distance distance,const DeviceBuffer& frame,cl_event *done);
+    
         cl_kernel _kernel;
-        cl_mem _d_out;
-        
+        DeviceBuffer _sceneBuffer;
+        DeviceBuffer _frameBuffer;
+    
+        //Scene currently held in _sceneBuffer
+        const Scene *_uploadedScene;
+        unsigned long _uploadedRevision;
 };
 
 #endif /* defined(__RayTracer__CameraKernelWrapper__) */
@@ -0,0 +1,74 @@
+#ifndef __BLOCKING_QUEUE_HPP
+#define __BLOCKING_QUEUE_HPP
+/**
+ * Filename:	BlockingQueue.hpp
+ * Purpose:		A bounded, thread-safe FIFO queue, used to hand work between pipeline stages.
+ * Author:		Erik E. Beerepoot
+ */
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/* Notes: Push blocks while the queue holds "capacity" items, which gives backpressure: a fast stage can never run
+ * more than "capacity" items ahead of the stage after it. After Close(), Pop drains the remaining items and then
+ * returns false. */
+template<typename T>
+class BlockingQueue {
+	public:
+		BlockingQueue(size_t capacity) : _capacity(capacity), _closed(false) {};
+		
+		void Push(const T& item);
+		bool Pop(T& item);
+		void Close();
+	private:
+		BlockingQueue(const BlockingQueue&) = delete;
+		BlockingQueue& operator= (const BlockingQueue&) = delete;
+		
+		std::mutex _lock;
+		std::condition_variable _notFull;
+		std::condition_variable _notEmpty;
+		std::deque<T> _items;
+		size_t _capacity;
+		bool _closed;
+};
+
+/**
+ * /name Push
+ * /brief Appends an item, waiting for space if the queue is full.
+ */
+template<typename T>
+void BlockingQueue<T>::Push(const T& item){
+	std::unique_lock<std::mutex> guard(_lock);
+	_notFull.wait(guard,[this]{ return _items.size() < _capacity; });
+	_items.push_back(item);
+	_notEmpty.notify_one();
+}
+
+/**
+ * /name Pop
+ * /brief Takes the oldest item, waiting for one if the queue is empty. Returns false once the queue is closed and
+ * empty.
+ */
+template<typename T>
+bool BlockingQueue<T>::Pop(T& item){
+	std::unique_lock<std::mutex> guard(_lock);
+	_notEmpty.wait(guard,[this]{ return !_items.empty() || _closed; });
+	if(_items.empty()) return false;
+	item = _items.front();
+	_items.pop_front();
+	_notFull.notify_one();
+	return true;
+}
+
+/**
+ * /name Close
+ * /brief Marks the end of the input, waking all waiting consumers.
+ */
+template<typename T>
+void BlockingQueue<T>::Close(){
+	std::lock_guard<std::mutex> guard(_lock);
+	_closed = true;
+	_notEmpty.notify_all();
+}
+
+#endif
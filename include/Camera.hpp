@@ -6,7 +6,10 @@
  * Author:		Erik E. Beerepoot
  */
 #include "GeometricTypes.hpp"
+#include "RayPacket.hpp"
+#include "CameraModel.hpp"
  
+#include <memory>
 #include <vector>
  
 struct FOV {
@@ -50,22 +53,42 @@ class Camera {
 		int			framerate;
 
 		Camera(Point centre,Orientation orientation,Velocity velocity);
-		//virtual std::vector<Point> TraceRay(int u,int v,Distance distance) const = 0;
+		virtual ~Camera() {};
+		
+		//Rolling shutter: pixels are exposed one by one, in row-major order, during a frame
+		Time PixelTime(long pixelIndex) const;
+		Pose PoseAt(Time t) const;
+		Pose PixelPose(int u,int v) const;
+		Time FrameDuration() const;
+		void AdvanceFrame();
+		void SetMotion(const Pose& pose,const Velocity& velocity);
+		
+		//Lens model: ray directions, in the camera frame, come from a table, which UpdateDirections rebuilds when the
+		//model or the intrinsics change (until then, directions are computed by the model itself). The pose turns 
+		//them into the scene frame per ray
+		void SetModel(std::shared_ptr<const CameraModel> model);
+		const CameraModel& Model() const { return *_model; };
+		CameraIntrinsics Intrinsics() const;
+		void UpdateDirections();
+		void PixelDirection(int u,int v,double direction[3]) const;
 	protected:
 		//Euclidian params
 		Point 		_centre;
 		Orientation _orientation;
 		Velocity 	_velocity;
         Time        _samplingTime;
+        
+        const DirectionTable* Directions() const;
+        std::shared_ptr<const CameraModel> _model;
+        std::shared_ptr<const DirectionTable> _directions;
+        const DirectionTable* _validDirections;
 };
 
 class PinholeCamera : public Camera {
 	public:
 		PinholeCamera(Point centre,Orientation orientation,Velocity velocity);
-		std::vector<Point> TraceRay(int u,int v,Distance distance) const;
-    
-        void TraceRay(int& u,int& v,Distance& distance,std::vector<Point> &points) const;
-        void UpdatePosition();
+		Ray CastRay(int u,int v,Distance distance) const;
+		void CastPacket(int u,int v,int count,Distance distance,RayPacket& packet) const;
 };
 
  #endif
\ No newline at end of file
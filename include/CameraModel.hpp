@@ -0,0 +1,151 @@
+#ifndef __CAMERA_MODEL_HPP
+#define __CAMERA_MODEL_HPP
+/**
+ * Filename:	CameraModel.hpp
+ * Purpose:		Interface for the camera (lens) models, which map pixels to ray directions, and the direction
+ *				tables cameras keep so the models are only evaluated when the intrinsics change.
+ * Author:		Erik E. Beerepoot
+ */
+#include "GeometricTypes.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Notes: The intrinsics a model needs: the resolution, and the field of view across it. */
+struct CameraIntrinsics {
+	int width;
+	int height;
+	Angle horizontalFOV;
+	Angle verticalFOV;
+	CameraIntrinsics(int w,int h,Angle hFOV,Angle vFOV) : width(w), height(h), horizontalFOV(hFOV), verticalFOV(vFOV) {};
+	
+	bool operator== (const CameraIntrinsics& other) const {
+		return width==other.width && height==other.height && horizontalFOV==other.horizontalFOV && verticalFOV==other.verticalFOV;
+	};
+};
+
+/* Notes: A CameraModel maps a (possibly fractional) pixel position to a unit ray direction in the camera frame:
+ * x is the optical axis, columns run towards -y and rows towards -z. Separable models map columns to azimuths 
+ * and rows to inclinations (from +z) independently, which lets the direction table store one entry per column 
+ * and row instead of one per pixel. Models are immutable, so they can be shared between cameras. */
+class CameraModel {
+	public:
+		virtual ~CameraModel() {};
+		virtual void Direction(double u,double v,const CameraIntrinsics& intrinsics,double direction[3]) const = 0;
+		virtual bool Separable() const { return false; };
+		virtual Angle Azimuth(double,const CameraIntrinsics&) const { return Angle(0.0); };
+		virtual Angle Inclination(double,const CameraIntrinsics&) const { return Angle(0.0); };
+};
+
+/* Notes: Equiangular rows and columns (every pixel spans the same angle), which covers a full panorama with a 
+ * field of view of 2 pi x pi. The cameras use this model unless told otherwise. */
+class SphericalModel : public CameraModel {
+	public:
+		void Direction(double u,double v,const CameraIntrinsics& intrinsics,double direction[3]) const;
+		bool Separable() const { return true; };
+		Angle Azimuth(double u,const CameraIntrinsics& intrinsics) const;
+		Angle Inclination(double v,const CameraIntrinsics& intrinsics) const;
+};
+
+/* Notes: A rectilinear (perspective) projection onto a flat image plane; straight lines stay straight. The field
+ * of view must be below pi. */
+class PinholeModel : public CameraModel {
+	public:
+		void Direction(double u,double v,const CameraIntrinsics& intrinsics,double direction[3]) const;
+};
+
+/* Notes: An equidistant fisheye: the angle from the optical axis grows linearly with the distance from the 
+ * image centre. The field of view may exceed pi. */
+class FisheyeModel : public CameraModel {
+	public:
+		void Direction(double u,double v,const CameraIntrinsics& intrinsics,double direction[3]) const;
+};
+
+/* Notes: A calibrated lens: a lookup table holds, for every pixel, the (fractional) pixel position an ideal 
+ * "base" camera would see the same ray at. Pixels outside the table go straight to the base model. */
+class DistortionLUTModel : public CameraModel {
+	public:
+		DistortionLUTModel(std::shared_ptr<const CameraModel> base,int width,int height,const std::vector<float>& table);
+		static std::shared_ptr<DistortionLUTModel> Load(std::shared_ptr<const CameraModel> base,const std::string& path);
+		void Direction(double u,double v,const CameraIntrinsics& intrinsics,double direction[3]) const;
+	private:
+		std::shared_ptr<const CameraModel> _base;
+		int _width;
+		int _height;
+		std::vector<float> _table;
+};
+
+/* Notes: The beam pattern of a spinning LiDAR. Column u is azimuth step u of a full revolution, counter-clockwise
+ * from +x, so the width of the intrinsics is the number of steps per revolution. Row v is beam v, at its elevation
+ * above the horizon; rows between beams are interpolated. The field of view is ignored. */
+class LidarBeamModel : public CameraModel {
+	public:
+		LidarBeamModel(const std::vector<Angle>& elevations);
+		static std::shared_ptr<LidarBeamModel> Uniform(int numBeams,Angle upper,Angle lower);
+		void Direction(double u,double v,const CameraIntrinsics& intrinsics,double direction[3]) const;
+		bool Separable() const { return true; };
+		Angle Azimuth(double u,const CameraIntrinsics& intrinsics) const;
+		Angle Inclination(double v,const CameraIntrinsics& intrinsics) const;
+		
+		int NumBeams() const { return static_cast<int>(_elevations.size()); };
+	private:
+		std::vector<Angle> _elevations;
+};
+
+/* Notes: A DirectionTable holds the ray direction of every pixel for one model and set of intrinsics. Separable
+ * models store the sine and cosine of the azimuth of every column and of the inclination of every row (in double
+ * precision, so rays match the model exactly); other models store a single precision direction per pixel. */
+class DirectionTable {
+	public:
+		DirectionTable(const CameraModel* model,const CameraIntrinsics& intrinsics);
+		
+		bool Matches(const CameraModel* model,const CameraIntrinsics& intrinsics) const {
+			return model==_model && intrinsics==_intrinsics;
+		};
+		int Width() const { return _intrinsics.width; };
+		int Height() const { return _intrinsics.height; };
+		void Direction(int u,int v,double direction[3]) const {
+			if(_separable){
+				direction[0] = _inclinationSin[v] * _azimuthCos[u];
+				direction[1] = _inclinationSin[v] * _azimuthSin[u];
+				direction[2] = _inclinationCos[v];
+				return;
+			}
+			const PointF& d = _directions[static_cast<size_t>(v) * _intrinsics.width + u];
+			direction[0] = d.x.get();
+			direction[1] = d.y.get();
+			direction[2] = d.z.get();
+		};
+		void Row(int u,int v,int count,double* x,double* y,double* z) const {
+			if(_separable){
+				const double inclinationSin = _inclinationSin[v];
+				const double inclinationCos = _inclinationCos[v];
+				const double* azimuthCos = &_azimuthCos[u];
+				const double* azimuthSin = &_azimuthSin[u];
+				for(int i=0;i<count;++i){
+					x[i] = inclinationSin * azimuthCos[i];
+					y[i] = inclinationSin * azimuthSin[i];
+					z[i] = inclinationCos;
+				}
+				return;
+			}
+			const PointF* d = &_directions[static_cast<size_t>(v) * _intrinsics.width + u];
+			for(int i=0;i<count;++i){
+				x[i] = d[i].x.get();
+				y[i] = d[i].y.get();
+				z[i] = d[i].z.get();
+			}
+		};
+	private:
+		const CameraModel* _model;
+		CameraIntrinsics _intrinsics;
+		bool _separable;
+		std::vector<double> _azimuthCos;
+		std::vector<double> _azimuthSin;
+		std::vector<double> _inclinationSin;
+		std::vector<double> _inclinationCos;
+		std::vector<PointF> _directions;
+};
+
+#endif
@@ -11,21 +11,142 @@
 
 #include <string>
 #include <cstring>
+#include <mutex>
+#include <vector>
+
+#ifdef __APPLE__
 #include <OpenCL/cl.h>
+#else
+#ifndef CL_TARGET_OPENCL_VERSION
+#define CL_TARGET_OPENCL_VERSION 120
+#endif
+#include <CL/cl.h>
+#endif
+
+//Selects the default context in the calls below
+const int kDefaultContext = -1;
+
+/* Notes: A ComputeDevice describes one OpenCL device, on any platform (ICD) installed on the system. */
+struct ComputeDevice {
+    cl_platform_id platform;
+    cl_device_id device;
+    cl_device_type type;
+    cl_uint computeUnits;
+    std::string name;
+    std::string platformName;
+    std::string version;
+    bool hostUnifiedMemory;
+};
+
+/* Notes: A ComputeContext is an opened device, with its own context and two command queues: one for kernels, and
+ * one for transfers, so reading back one frame can overlap computing the next. */
+struct ComputeContext {
+    size_t device;
+    cl_context context;
+    cl_command_queue queue;
+    cl_command_queue transferQueue;
+};
+
+class ComputeManager;
+
+/* Notes: A DeviceBuffer is a handle to a buffer from the ComputeManager's pool. It returns the buffer to the pool
+ * when it is destroyed or released, so the next request of the same size class reuses it. Handles can be moved,
+ * but not copied. */
+class DeviceBuffer {
+    public:
+        DeviceBuffer() : _manager(NULL), _mem(NULL), _size(0), _capacity(0), _mode(0), _context(kDefaultContext) {};
+        DeviceBuffer(DeviceBuffer&& other);
+        DeviceBuffer& operator= (DeviceBuffer&& other);
+        ~DeviceBuffer() { Release(); };
+    
+        void Release();
+        bool IsValid() const { return _mem!=NULL; };
+        cl_mem Mem() const { return _mem; };
+        size_t Size() const { return _size; };
+    private:
+        friend class ComputeManager;
+        DeviceBuffer(const DeviceBuffer&) = delete;
+        DeviceBuffer& operator= (const DeviceBuffer&) = delete;
+    
+        ComputeManager *_manager;
+        cl_mem _mem;
+        size_t _size;
+        size_t _capacity;
+        int _mode;
+        int _context;
+};
 
+/* Notes: The ComputeManager enumerates the devices of every platform, and opens a context on one or more of
+ * them. The default device is the first GPU, then accelerator, then CPU device found (e.g. PoCL on headless
+ * nodes). It can be overridden with the RAYTRACER_CL_DEVICE environment variable, which is either a device type
+ * ("gpu", "cpu", "accelerator") or part of a device or platform name. Failures are reported through the return
+ * values, with the OpenCL error code in LastError().
+ * Built programs are cached on disk, keyed by a hash of the kernel source, build options and device (including its
+ * driver version), so later processes load the binary instead of compiling. The cache lives in RAYTRACER_CL_CACHE,
+ * or $HOME/.cache/raytracer; stale or unreadable binaries fall back to a source build.
+ * Device buffers come from a pool, in size classes, so frames and cameras reuse them rather than allocating. 
+ * AcquireBuffer(..., CL_MEM_ALLOC_HOST_PTR) gives pinned buffers, which MapBuffer maps without a copy. */
 class ComputeManager {
     public:
         static ComputeManager* SharedComputeManager();
+        ~ComputeManager();
+    
+        const std::vector<ComputeDevice>& Devices() const { return _devices; };
+        bool IsAvailable() const { return _defaultContext >= 0; };
+        cl_int LastError() const { return _lastError; };
+    
+        bool FindDevice(cl_device_type type,const std::string& name,size_t *device) const;
+        bool OpenDevice(size_t device,int *context);
+        bool SelectDevice(cl_device_type type,const std::string& name = "");
     
-        bool BuildKernelFromFile(std::string sourceFilePath,std::string kernelName,cl_kernel *kernel);
-        void AllocateBufferOfSize(size_t size,cl_mem *deviceMem,void *hostMem, int mode);
-        cl_command_queue            CommandQueue();
+        bool BuildKernelFromFile(std::string sourceFilePath,std::string kernelName,cl_kernel *kernel,int context = kDefaultContext,std::string options = "");
+        bool AllocateBufferOfSize(size_t size,cl_mem *deviceMem,void *hostMem,int mode,int context = kDefaultContext);
+        bool AcquireBuffer(size_t size,int mode,DeviceBuffer *buffer,int context = kDefaultContext);
+        void* MapBuffer(const DeviceBuffer& buffer,cl_map_flags flags);
+        bool UnmapBuffer(const DeviceBuffer& buffer,void *host);
+        bool HostUnifiedMemory(int context = kDefaultContext);
+        cl_command_queue            CommandQueue(int context = kDefaultContext);
+        cl_command_queue            TransferQueue(int context = kDefaultContext);
+        cl_context                  Context(int context = kDefaultContext);
+        cl_device_id                Device(int context = kDefaultContext);
+    
+        void SetCacheDirectory(const std::string& directory) { _cacheDirectory = directory; };
+        unsigned int CacheHits() const { return _cacheHits; };
+        unsigned int CacheMisses() const { return _cacheMisses; };
     private:
         ComputeManager();
+        ComputeManager(const ComputeManager&) = delete;
+        ComputeManager& operator= (const ComputeManager&) = delete;
     	static ComputeManager 		*sharedComputeManager;
 
         bool ConfigureComputationFramework();
-       
+        const ComputeContext* ContextAt(int context);
+        std::string CachePath(const std::vector<char>& source,const std::string& options,const ComputeDevice& device) const;
+        cl_program LoadCachedProgram(const std::string& path,cl_context context,cl_device_id device,const std::string& options);
+        void StoreCachedProgram(const std::string& path,cl_program program);
+    
+        friend class DeviceBuffer;
+        static size_t SizeClass(size_t size);
+        void ReturnBuffer(DeviceBuffer& buffer);
+    
+        std::vector<ComputeDevice> _devices;
+        std::vector<ComputeContext> _contexts;
+        int _defaultContext;
+        cl_int _lastError;
+    
+        std::string _cacheDirectory;
+        unsigned int _cacheHits;
+        unsigned int _cacheMisses;
+    
+        //Buffers returned to the pool, waiting to be reused
+        struct PooledBuffer {
+            cl_mem mem;
+            size_t capacity;
+            int mode;
+            int context;
+        };
+        std::mutex _poolLock;
+        std::vector<PooledBuffer> _freeBuffers;
 };
 
 #endif
@@ -7,6 +7,8 @@
  */
 #include <stdint.h>
 #include <math.h>
+#include <limits>
+#include <type_traits>
 /*********************************
  ******    Unit Templates    *****
  *********************************/
@@ -14,13 +16,41 @@ template<int M, int R, int K,int S> struct Unit {
 	enum { m = M, rad = R, kg = K, s = S };
 };
 
-template <typename Unit>
+/* Notes: True if every From is exactly representable as a To (e.g. float to double, or int16_t to float). Only
+ * such conversions between Values happen implicitly. */
+template <typename From,typename To>
+struct IsLossless {
+	enum { value = std::is_same<From,To>::value ||
+		(std::is_floating_point<From>::value && std::is_floating_point<To>::value && 
+			std::numeric_limits<To>::digits >= std::numeric_limits<From>::digits && 
+			std::numeric_limits<To>::max_exponent >= std::numeric_limits<From>::max_exponent) ||
+		(std::is_integral<From>::value && std::is_floating_point<To>::value && 
+			std::numeric_limits<To>::digits >= std::numeric_limits<From>::digits) ||
+		(std::is_integral<From>::value && std::is_integral<To>::value && std::is_signed<From>::value==std::is_signed<To>::value && 
+			std::numeric_limits<To>::digits >= std::numeric_limits<From>::digits) };
+};
+
+//Keeps T out of template argument deduction, so scalars convert to the storage type of the Value
+template <typename T> struct NonDeduced { typedef T type; };
+
+/* Notes: A Value is a quantity in "Unit", stored as a "Storage" (double unless stated otherwise). The unit only 
+ * exists at compile time, so a Value is exactly as large and as fast as its storage. Operands of an operator must
+ * have the same storage: widen implicitly (e.g. float to double), or narrow with ValueCast. */
+template <typename Unit,typename Storage = double>
 struct Value {
-	double val;
-	double get() { return val; };
-	explicit constexpr Value(double d) : val(d){}
+	Storage val;
+	constexpr Storage get() const noexcept { return val; };
+	explicit constexpr Value(Storage d) noexcept : val(d){}
+	
+	template <typename Other,typename std::enable_if<IsLossless<Other,Storage>::value && !std::is_same<Other,Storage>::value,int>::type = 0>
+	constexpr Value(Value<Unit,Other> other) noexcept : val(other.get()){}
 };
 
+template <typename To,typename U,typename From>
+constexpr Value<U,To> ValueCast(Value<U,From> value) noexcept {
+	return Value<U,To>(static_cast<To>(value.get()));
+}
+
 using NoUnit = Unit<0,0,0,0>;
 using Second = Unit<0,0,0,1>;
 using Second2 = Unit<0,0,0,2>;
@@ -29,6 +59,8 @@ using Rad = Unit<0,1,0,0>;
 using MeterSecond = Unit<1,0,0,-1>;
 using RadSecond = Unit<0,1,0,-1>;
 
+static_assert(sizeof(Value<Metre,float>)==sizeof(float),"Values must not be larger than their storage");
+
 //second
 constexpr Value<Second> operator"" _s(long double d)
 {
@@ -52,60 +84,60 @@ constexpr Value<Rad> operator "" _rad(long double d)
 {
 	return Value<Rad>(d);
 }
-template <int M1, int R1, int K1, int S1,int M2, int R2, int K2, int S2>
-Value<Unit<M1-M2,R1-R2,K1-K2,S1-S2>> operator/ (Value<Unit<M1,R1,K1,S1>> lhs,Value<Unit<M2,R2,K2,S2>> rhs) {
-	 return Value<Unit<M1-M2,R1-R2,K1-K2,S1-S2>>(lhs.get()/rhs.get());
+template <int M1, int R1, int K1, int S1,int M2, int R2, int K2, int S2,typename T>
+constexpr Value<Unit<M1-M2,R1-R2,K1-K2,S1-S2>,T> operator/ (Value<Unit<M1,R1,K1,S1>,T> lhs,Value<Unit<M2,R2,K2,S2>,T> rhs) noexcept {
+	 return Value<Unit<M1-M2,R1-R2,K1-K2,S1-S2>,T>(lhs.get()/rhs.get());
 }
 
-template <int M1, int R1, int K1, int S1>
-Value<Unit<M1,R1,K1,S1>> operator/ (Value<Unit<M1,R1,K1,S1>> lhs,double val) {
-	 return Value<Unit<M1,R1,K1,S1>>(lhs.get()/val);
+template <int M1, int R1, int K1, int S1,typename T>
+constexpr Value<Unit<M1,R1,K1,S1>,T> operator/ (Value<Unit<M1,R1,K1,S1>,T> lhs,typename NonDeduced<T>::type val) noexcept {
+	 return Value<Unit<M1,R1,K1,S1>,T>(lhs.get()/val);
 }
 
-template <int M1, int R1, int K1, int S1,int M2, int R2, int K2, int S2>
-Value<Unit<M1+M2,R1+R2,K1+K2,S1+S2>> operator* (Value<Unit<M1,R1,K1,S1>> lhs,Value<Unit<M2,R2,K2,S2>> rhs) {
-	 return Value<Unit<M1+M2,R1+R2,K1+K2,S1+S2>>(lhs.get()*rhs.get());
+template <int M1, int R1, int K1, int S1,int M2, int R2, int K2, int S2,typename T>
+constexpr Value<Unit<M1+M2,R1+R2,K1+K2,S1+S2>,T> operator* (Value<Unit<M1,R1,K1,S1>,T> lhs,Value<Unit<M2,R2,K2,S2>,T> rhs) noexcept {
+	 return Value<Unit<M1+M2,R1+R2,K1+K2,S1+S2>,T>(lhs.get()*rhs.get());
 }
 
-template <int M1, int R1, int K1, int S1>
-Value<Unit<M1,R1,K1,S1>> operator* (Value<Unit<M1,R1,K1,S1>> lhs,double val) {
-	 return Value<Unit<M1,R1,K1,S1>>(lhs.get()*val);
+template <int M1, int R1, int K1, int S1,typename T>
+constexpr Value<Unit<M1,R1,K1,S1>,T> operator* (Value<Unit<M1,R1,K1,S1>,T> lhs,typename NonDeduced<T>::type val) noexcept {
+	 return Value<Unit<M1,R1,K1,S1>,T>(lhs.get()*val);
 }
 
-template <int M, int R, int K, int S>
-bool operator < (Value<Unit<M,R,K,S>> lhs, Value<Unit<M,R,K,S>> rhs){
+template <int M, int R, int K, int S,typename T>
+constexpr bool operator < (Value<Unit<M,R,K,S>,T> lhs, Value<Unit<M,R,K,S>,T> rhs) noexcept {
 	return lhs.get()<rhs.get();
 }
 
-template <int M, int R, int K, int S>
-bool operator > (Value<Unit<M,R,K,S>> lhs, Value<Unit<M,R,K,S>> rhs){
+template <int M, int R, int K, int S,typename T>
+constexpr bool operator > (Value<Unit<M,R,K,S>,T> lhs, Value<Unit<M,R,K,S>,T> rhs) noexcept {
 	return lhs.get()>rhs.get();
 }
 
-template <int M, int R, int K, int S>
-bool operator == (Value<Unit<M,R,K,S>> lhs, Value<Unit<M,R,K,S>> rhs){
+template <int M, int R, int K, int S,typename T>
+constexpr bool operator == (Value<Unit<M,R,K,S>,T> lhs, Value<Unit<M,R,K,S>,T> rhs) noexcept {
 	return lhs.get()==rhs.get();
 }
 
 
-template <int M, int R, int K, int S>
-bool operator <= (Value<Unit<M,R,K,S>> lhs, Value<Unit<M,R,K,S>> rhs){
+template <int M, int R, int K, int S,typename T>
+constexpr bool operator <= (Value<Unit<M,R,K,S>,T> lhs, Value<Unit<M,R,K,S>,T> rhs) noexcept {
 	return lhs.get()<=rhs.get();
 }
 
-template <int M, int R, int K, int S>
-bool operator >= (Value<Unit<M,R,K,S>> lhs, Value<Unit<M,R,K,S>> rhs){
+template <int M, int R, int K, int S,typename T>
+constexpr bool operator >= (Value<Unit<M,R,K,S>,T> lhs, Value<Unit<M,R,K,S>,T> rhs) noexcept {
 	return lhs.get()>=rhs.get();
 }
 
-template <int M, int R, int K, int S>
-Value<Unit<M,R,K,S>> operator- (Value<Unit<M,R,K,S>> lhs, Value<Unit<M,R,K,S>>&rhs){
-	return Value<Unit<M,R,K,S>>(lhs.get()-rhs.get());
+template <int M, int R, int K, int S,typename T>
+constexpr Value<Unit<M,R,K,S>,T> operator- (Value<Unit<M,R,K,S>,T> lhs, Value<Unit<M,R,K,S>,T> rhs) noexcept {
+	return Value<Unit<M,R,K,S>,T>(lhs.get()-rhs.get());
 }
 
-template <int M, int R, int K, int S>
-Value<Unit<M,R,K,S>> operator+ (Value<Unit<M,R,K,S>> lhs, Value<Unit<M,R,K,S>> rhs){
-	return Value<Unit<M,R,K,S>>(lhs.get()+rhs.get());
+template <int M, int R, int K, int S,typename T>
+constexpr Value<Unit<M,R,K,S>,T> operator+ (Value<Unit<M,R,K,S>,T> lhs, Value<Unit<M,R,K,S>,T> rhs) noexcept {
+	return Value<Unit<M,R,K,S>,T>(lhs.get()+rhs.get());
 }
 
 /*********************************
@@ -118,29 +150,46 @@ typedef Value<Second> Time;
 typedef Value<MeterSecond> LinearVelocity;
 typedef Value<RadSecond> AngularVelocity;
 
-struct Point {
-	Distance x;
-	Distance y;
-	Distance z;
-	Point(Distance xx,Distance yy, Distance zz) : x(xx),y(yy),z(zz) {};
+const Angle kPi = Angle(M_PI);
+
+//Single precision variants, for hot loops and device data
+typedef Value<Metre,float> DistanceF;
+typedef Value<Rad,float> AngleF;
+
+/* Notes: Points are stored in double precision (Point) by default; PointF is the single precision variant, made
+ * with PointCast. */
+template <typename Storage>
+struct BasicPoint {
+	Value<Metre,Storage> x;
+	Value<Metre,Storage> y;
+	Value<Metre,Storage> z;
+	constexpr BasicPoint(Value<Metre,Storage> xx,Value<Metre,Storage> yy, Value<Metre,Storage> zz) noexcept : x(xx),y(yy),z(zz) {};
 	
-	friend Point operator+ (Point& lhs,Point& rhs){
-		return Point(lhs.x+rhs.x,lhs.y+rhs.y,lhs.z+rhs.z);
+	friend constexpr BasicPoint operator+ (const BasicPoint& lhs,const BasicPoint& rhs) noexcept {
+		return BasicPoint(lhs.x+rhs.x,lhs.y+rhs.y,lhs.z+rhs.z);
 	}
 	
-	friend bool operator<= (Point& lhs,Point& rhs){
+	friend constexpr bool operator<= (const BasicPoint& lhs,const BasicPoint& rhs) noexcept {
 		return ((lhs.x<=rhs.x)&&(lhs.y<=rhs.y)&&(lhs.z<=rhs.z));
 	}
 	
-	friend bool operator>= (Point& lhs,Point& rhs){
+	friend constexpr bool operator>= (const BasicPoint& lhs,const BasicPoint& rhs) noexcept {
 		return ((lhs.x>=rhs.x)&&(lhs.y>=rhs.y)&&(lhs.z>=rhs.z));
 	}
 	
-	friend bool operator== (Point& lhs,Point& rhs){
+	friend constexpr bool operator== (const BasicPoint& lhs,const BasicPoint& rhs) noexcept {
 		return ((lhs.x==rhs.x)&&(lhs.y==rhs.y)&&(lhs.z==rhs.z));
 	}
 };
 
+typedef BasicPoint<double> Point;
+typedef BasicPoint<float> PointF;
+
+template <typename To,typename From>
+constexpr BasicPoint<To> PointCast(const BasicPoint<From>& point) noexcept {
+	return BasicPoint<To>(ValueCast<To>(point.x),ValueCast<To>(point.y),ValueCast<To>(point.z));
+}
+
 struct Orientation {
 	Angle roll;
 	Angle pitch;
@@ -165,6 +214,25 @@ struct Velocity {
 	Velocity(LinearVelocity x,LinearVelocity y,LinearVelocity z,AngularVelocity wx, AngularVelocity wy, AngularVelocity wz) : V_x(x),V_y(y), V_z(z), w_x(wx),w_y(wy),w_z(wz) {};
 };
 
+struct Pose {
+	Point centre;
+	Orientation orientation;
+	Pose(Point c,Orientation o) : centre(c),orientation(o) {};
+};
+
+/*********************************
+ ******** Ray primitives *********
+ *********************************/
+
+/* Notes: A Ray is a half-line starting at "origin", limited to "length" metres. "direction" is a unit vector,
+ * stored as a Point of length 1 m. */
+struct Ray {
+	Point origin;
+	Point direction;
+	Distance length;
+	Ray(Point o,Point d,Distance l) : origin(o),direction(d),length(l) {};
+};
+
 /*********************************
  ******** OpenCL types   *********
  *********************************/
@@ -184,7 +252,21 @@ typedef struct {
 	uint8_t blue;
 } pixel_t;
 
+/* Notes: A HitRecord describes where a ray stopped: the colour and index of the first non-empty voxel along it, 
+ * the distance along the ray at which it entered that voxel, that point, and the outward normal of the voxel face
+ * it entered through (zero if the ray starts inside the voxel). "hit" is false if the ray hits nothing. */
+struct HitRecord {
+	bool hit;
+	pixel_t color;
+	Distance distance;
+	Point position;
+	long long voxel[3];
+	int normal[3];
+	HitRecord() : hit(false),color(),distance(0.0_m),position(0.0_m,0.0_m,0.0_m),voxel{0,0,0},normal{0,0,0} {};
+};
+
 Point AzInclRangeToXYZ(Angle az, Angle incl, Distance r);
 Point RotateXYZ(Point p,Angle pitch, Angle roll, Angle yaw);
+void RotationMatrix(const Orientation& orientation,double rotation[3][3]);
 
 #endif
\ No newline at end of file
@@ -9,6 +9,10 @@
 #include "AcceleratedPinholeCamera.hpp"
 #include "Scene.hpp"
 #include "PNGImage.hpp"
+#include "RawImage.hpp"
+#include "LidarSensor.hpp"
+#include "ThreadPool.hpp"
+#include "Trajectory.hpp"
 
 #include <vector>
 #include <string>
@@ -24,14 +28,28 @@
   * using an OpenCL based renderer / ray-tracer, or outputting to the screen, as opposed to an image */
  class ImageRenderer : public Renderer {
 	public:
-			ImageRenderer(std::string destImgPath);
+			ImageRenderer(std::string destImgPath,unsigned int numThreads = 0);
            
 			int RenderScene(const Scene& scene, PinholeCamera* camera);
             int RenderScene(const Scene& scene,AcceleratedPinholeCamera* camera);
-			int RenderScene(const Scene& scene,const std::vector<Camera*> cameras);
+            int RenderSequence(const Scene& scene,AcceleratedPinholeCamera* camera,int numFrames,int framesInFlight = 3);
+            int RenderTrajectory(const Scene& scene,const PinholeCamera& camera,const Trajectory& trajectory);
+			int RenderScene(const Scene& scene,const std::vector<Camera*>& cameras);
+			int RenderScan(const Scene& scene,LidarSensor* lidar,LidarSink& sink,int numScans = 1);
 			int CancelRendering();
+			
+			void SetOutputFormat(ImageFormat format) { _format = format; };
+			void SetOutputChannels(unsigned int channels) { _channels = channels; };
 	private:
+			void RenderTiles(const Scene& scene,const PinholeCamera& camera,Bitmap& img,ChannelImage* channels = NULL);
+			void RenderTile(const Scene& scene,const PinholeCamera& camera,Bitmap& img,int x0,int y0,ChannelImage* channels = NULL);
+			Bitmap* CreateImage(long frameNumber,int height,int width,int framerate,unsigned int encodeThreads = 1,const std::string& name = "render");
+			ChannelImage* CreateChannels(long frameNumber,int height,int width,const std::string& name = "render");
+			
 			std::string _outputPath;
+			ImageFormat _format;
+			unsigned int _channels;
+			ThreadPool _threadPool;
 			
  };
  #endif
\ No newline at end of file
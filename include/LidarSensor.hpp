@@ -0,0 +1,106 @@
+#ifndef __LIDAR_SENSOR_HPP
+#define __LIDAR_SENSOR_HPP
+/**
+ * Filename:	LidarSensor.hpp
+ * Purpose:		Interface for LidarSensor class. A spinning multi-beam LiDAR, and the sinks its returns are streamed
+ *				into (a ring buffer in memory, or a binary file).
+ * Author:		Erik E. Beerepoot
+ */
+#include "Camera.hpp"
+#include "Scene.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* Notes: One return of a LiDAR beam. "time" is the firing time in seconds, relative to the start of the scan, and
+ * "beam" and "step" say which beam of which firing it is. Ranges and points are in metres. A beam that hits
+ * nothing has range, intensity and point 0. The layout is fixed (32 bytes, host byte order), as it is also the
+ * record of the binary output file. */
+struct LidarReturn {
+	double time;
+	float range;
+	float intensity;
+	float x;
+	float y;
+	float z;
+	uint16_t beam;
+	uint16_t step;
+};
+static_assert(sizeof(LidarReturn)==32,"LidarReturn is written to scan files as is, and must stay 32 bytes");
+
+/* Notes: Where the returns of a scan go. Write() gets runs of consecutive returns of one or more firings;
+ * "index" is the number of the first one, counting over all scans (scan * points per scan + step * beams + beam).
+ * Runs arrive from several threads at once, in no particular order. */
+class LidarSink {
+	public:
+		virtual ~LidarSink() {};
+		virtual int Write(uint64_t index,const LidarReturn* returns,size_t count) = 0;
+};
+
+/* Notes: A LidarRingBuffer holds up to "capacity" returns in a buffer allocated up front. Write blocks while the
+ * buffer is full, so a consumer thread calling Read sets the pace of the scan. After Close(), Read drains the
+ * remaining returns and then returns 0. Returns come out in the order their runs were written. */
+class LidarRingBuffer : public LidarSink {
+	public:
+		LidarRingBuffer(size_t capacity);
+		int Write(uint64_t index,const LidarReturn* returns,size_t count);
+		size_t Read(LidarReturn* returns,size_t maxCount);
+		void Close();
+	private:
+		LidarRingBuffer(const LidarRingBuffer&) = delete;
+		LidarRingBuffer& operator= (const LidarRingBuffer&) = delete;
+
+		std::mutex _lock;
+		std::condition_variable _notFull;
+		std::condition_variable _notEmpty;
+		std::vector<LidarReturn> _buffer;
+		size_t _head;
+		size_t _size;
+		bool _closed;
+};
+
+/* Notes: A LidarFile writes every return to its own place in a binary file of LidarReturn records (return
+ * "index" at byte index * 32), so runs may be written in any order and from several threads. */
+class LidarFile : public LidarSink {
+	public:
+		LidarFile(std::string filePath);
+		~LidarFile();
+		int Write(uint64_t index,const LidarReturn* returns,size_t count);
+		bool IsOpen() const { return _fd >= 0; };
+	private:
+		LidarFile(const LidarFile&) = delete;
+		LidarFile& operator= (const LidarFile&) = delete;
+
+		int _fd;
+};
+
+/* Notes: A LidarSensor spins its beams through "AzimuthSteps" firings per revolution, one revolution per frame
+ * ("framerate" is the rotation rate in Hz). All beams of a firing fire at once, and every firing is cast from the
+ * pose of the sensor at its own time, so the scan is distorted by the motion of the sensor like a real one. The
+ * sensor frame is rotated by roll about x, pitch about y and yaw about z. Points are reported in the scene frame
+ * if "compensateMotion" is set (the default), otherwise in the sensor frame at the time of their firing. The beam
+ * pattern is the direction table of its LidarBeamModel: column "step", row "beam". */
+class LidarSensor : public Camera {
+	public:
+		//LiDAR parameters
+		Distance	maxRange;
+		bool		compensateMotion;
+
+		LidarSensor(Point centre,Orientation orientation,Velocity velocity,int numBeams = 64,int azimuthSteps = 2048,int rotationRate = 20);
+
+		void SetBeams(std::shared_ptr<const LidarBeamModel> beams,int azimuthSteps,int rotationRate);
+		int NumBeams() const { return sensor.resolution.vertical; };
+		int AzimuthSteps() const { return sensor.resolution.horizontal; };
+		size_t PointsPerScan() const { return static_cast<size_t>(NumBeams()) * AzimuthSteps(); };
+		Time FiringTime(int step) const;
+		Pose FiringPose(int step) const;
+
+		void CastFiring(int step,int firstBeam,int count,RayPacket& packet) const;
+		void ScanFirings(const Scene& scene,int firstStep,int numSteps,LidarReturn* returns) const;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __MESH_HPP
+#define __MESH_HPP
+/**
+ * Filename:	Mesh.hpp
+ * Purpose:		Interface for Mesh class. A triangle mesh with optional face or vertex colours, loaded from OBJ or
+ *				PLY files, to be voxelized into a scene.
+ * Author:		Erik E. Beerepoot
+ */
+#include "GeometricTypes.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Notes: Vertices are in metres. Polygons are split into triangle fans when loading. A mesh has per-face colours
+ * (OBJ materials, PLY face colours), per-vertex colours (OBJ "v x y z r g b", PLY vertex colours), or none. In OBJ
+ * files with materials, faces without one get the OBJ default diffuse colour. */
+class Mesh {
+	public:
+		Mesh() {};
+
+		int Load(const std::string& path);
+		int LoadOBJ(const std::string& path);
+		int LoadPLY(const std::string& path);
+
+		size_t NumVertices() const { return _vertices.size() / 3; };
+		size_t NumTriangles() const { return _indices.size() / 3; };
+		void Triangle(size_t idx,double vertices[3][3]) const;
+		bool TriangleColor(size_t idx,pixel_t& color) const;
+	private:
+		void Clear();
+		bool AddPolygon(const std::vector<long long>& polygon);
+		bool ValidIndices() const;
+
+		std::vector<double> _vertices;
+		std::vector<pixel_t> _vertexColors;
+		std::vector<uint32_t> _indices;
+		std::vector<pixel_t> _faceColors;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef __MODEL_FILE_HPP
+#define __MODEL_FILE_HPP
+/**
+ * Filename:	ModelFile.hpp
+ * Purpose:		Parsing helpers shared by the mesh and point cloud loaders: PLY headers and values, numbers in text
+ *				and colour channels.
+ * Author:		Erik E. Beerepoot
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Notes: PLY scalar types, and the properties and elements of a PLY header. A list property has a count type
+ * as well as its (item) type. */
+enum PLYType {
+	PLY_INT8 = 0,
+	PLY_UINT8 = 1,
+	PLY_INT16 = 2,
+	PLY_UINT16 = 3,
+	PLY_INT32 = 4,
+	PLY_UINT32 = 5,
+	PLY_FLOAT32 = 6,
+	PLY_FLOAT64 = 7,
+	PLY_INVALID = 8,
+};
+
+struct PLYProperty {
+	std::string name;
+	PLYType type;
+	PLYType countType;
+	bool isList;
+};
+
+struct PLYElement {
+	std::string name;
+	size_t count;
+	std::vector<PLYProperty> properties;
+};
+
+/* Notes: The header of a PLY file. The elements follow each other from byte "body" on. Binary data in the
+ * other byte order than this machine's needs "swap"ping. */
+struct PLYHeader {
+	std::vector<PLYElement> elements;
+	bool ascii;
+	bool swap;
+	size_t body;
+};
+
+int ParsePLYHeader(const char *data,size_t length,PLYHeader& header);
+size_t PLYTypeSize(PLYType type);
+int PLYPropertyIndex(const PLYElement& element,const char *names[],int numNames);
+bool ParseNumber(const char *&text,const char *end,double& value);
+uint8_t ToColorChannel(double value,bool fraction);
+
+/* Notes: Reads the values in (part of) the body of a PLY file, which is ASCII, or binary in either byte order.
+ * The data need not be zero terminated, so it may be a file mapping. */
+class PLYReader {
+	public:
+		PLYReader(const char *data,size_t length,bool ascii,bool swap) : _data(data), _length(length), _position(0), _ascii(ascii), _swap(swap) {};
+		bool Read(PLYType type,double& value);
+		size_t Position() const { return _position; };
+	private:
+		const char *_data;
+		size_t _length;
+		size_t _position;
+		bool _ascii;
+		bool _swap;
+};
+
+#endif
@@ -12,7 +12,7 @@
  class Bitmap {
 	public:	
 		Bitmap(std::string filePath,int imgHeight,int imgWidth);
-		~Bitmap();
+		virtual ~Bitmap();
 		
 		pixel_t * GetImageData();
 		void SetImageData(pixel_t *data);
@@ -23,6 +23,8 @@
 		virtual int Read() = 0;
 		
 	protected:
+		Bitmap(std::string filePath,int imgHeight,int imgWidth,pixel_t *imageData);
+		
 		typedef struct {
 			int width;
 			int height;
@@ -35,6 +37,20 @@
 		
 		bitmap_t _bitmap;
 		std::string _filePath;
+		bool _ownsImageData;
+ };
+ 
+ /* Notes: Settings for the PNG encoder. "level" is the zlib compression level (0-9), "filters" a mask of libpng 
+  * PNG_FILTER_* flags (several flags: the best one is picked per row), and "strategy" a zlib strategy (Z_FILTERED, 
+  * Z_RLE, ...); -1 keeps the libpng default. With numThreads > 1, horizontal strips are deflated in parallel and 
+  * joined into a single zlib stream (as pigz does), at the cost of a slightly larger file. */
+ struct PNGSettings {
+	int level;
+	int filters;
+	int strategy;
+	unsigned int numThreads;
+	
+	PNGSettings() : level(-1), filters(-1), strategy(-1), numThreads(1) {};
  };
  
  class PNGImage : public Bitmap {
@@ -42,5 +58,11 @@
 		PNGImage(std::string filePath,int imgHeight,int imgWidth) : Bitmap(filePath,imgHeight,imgWidth) {};
 		int Write();
 		int Read();	
+		
+		void SetSettings(const PNGSettings& settings) { _settings = settings; };
+	private:
+		int WriteParallel();
+		
+		PNGSettings _settings;
  };
 #endif
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifndef __POINT_CLOUD_HPP
+#define __POINT_CLOUD_HPP
+/**
+ * Filename:	PointCloud.hpp
+ * Purpose:		Interface for PointCloud class. A (coloured) point cloud streamed from a memory mapped PLY or XYZ
+ *				file, to be binned into a scene.
+ * Author:		Erik E. Beerepoot
+ */
+#include "GeometricTypes.hpp"
+#include "ModelFile.hpp"
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/* Notes: How the colour of a voxel holding several points is chosen: the colour of the last point in the file, 
+ * the average colour, or the most common colour (ties going to the colour seen last). */
+enum PointColorPolicy {
+	LAST_POINT_COLOR = 0,
+	AVERAGE_POINT_COLOR = 1,
+	MAJORITY_POINT_COLOR = 2,
+};
+
+/* Notes: A point in metres, with its colour if the cloud has colours. */
+struct CloudPoint {
+	double x;
+	double y;
+	double z;
+	pixel_t color;
+};
+
+/* Notes: A PointCloud maps its file read-only, and reads the points in chunks of about kCloudChunkBytes of the 
+ * file, which may be read concurrently. So a cloud of any size costs no more memory than the chunks being read.
+ * Supported are the vertex element of PLY files (ASCII or binary, colours in red/green/blue properties) and XYZ
+ * files: "x y z [r g b]" lines with colours in 0-255, and '#' comments. */
+class PointCloud {
+	public:
+		PointCloud();
+		~PointCloud();
+		int Load(const std::string& path);
+		
+		bool HasColors() const { return _hasColors; };
+		size_t NumChunks() const { return _chunks.size(); };
+		int ReadChunk(size_t chunk,std::vector<CloudPoint>& points) const;
+	private:
+		PointCloud(const PointCloud&) = delete;
+		PointCloud& operator= (const PointCloud&) = delete;
+		
+		//Byte range [begin,end) of a chunk in the file, holding "numPoints" points (PLY only)
+		struct Chunk {
+			size_t begin;
+			size_t end;
+			size_t numPoints;
+		};
+		
+		void Unmap();
+		int IndexPLY();
+		int IndexXYZ();
+		void SplitLines(size_t begin,size_t end);
+		
+		const char *_data;
+		size_t _length;
+		std::vector<Chunk> _chunks;
+		bool _hasColors;
+		
+		//PLY files: the vertex element and where its coordinates and colours are
+		bool _isPLY;
+		PLYHeader _header;
+		PLYElement _vertex;
+		int _position[3];
+		int _color[3];
+};
+
+#endif
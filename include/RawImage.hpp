@@ -0,0 +1,114 @@
+#ifndef __RAW_IMAGE_HPP
+#define __RAW_IMAGE_HPP
+/**
+ * Filename:	RawImage.hpp
+ * Purpose:		Interface for the uncompressed image writers (PPM, PFM, raw RGB and Y4M video). The renderer writes
+ *				straight into a memory mapped output file, so there is no encode step. Also holds the float
+ *				output channels (depth, position, voxel index, normal) written next to an image.
+ * Author:		Erik E. Beerepoot
+ */
+#include "PNGImage.hpp"
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/* Notes: The output formats of the renderer. PPM_FORMAT (binary P6) and RAW_FORMAT (packed RGB triplets, no
+ * header) are rendered into the mapped file directly. PFM_FORMAT (RGB floats in [0,1], bottom row first) and
+ * Y4M_FORMAT (a YUV 4:4:4 video stream, all frames in one file) are converted into the mapped file on Write(). */
+enum ImageFormat {
+	PNG_FORMAT = 0,
+	PPM_FORMAT = 1,
+	PFM_FORMAT = 2,
+	RAW_FORMAT = 3,
+	Y4M_FORMAT = 4,
+};
+
+int ParseImageFormat(const std::string& name,ImageFormat& format);
+std::string ImageExtension(ImageFormat format);
+
+/* Notes: The extra per-pixel outputs (AOVs) of the renderer, as bits of a mask. DEPTH_CHANNEL is the distance 
+ * along the ray to the hit, POSITION_CHANNEL the hit point in metres, VOXEL_CHANNEL the index of the voxel hit, 
+ * and NORMAL_CHANNEL the normal of the voxel face hit. */
+enum OutputChannel {
+	DEPTH_CHANNEL = 1,
+	POSITION_CHANNEL = 2,
+	VOXEL_CHANNEL = 4,
+	NORMAL_CHANNEL = 8,
+};
+
+int ParseOutputChannels(const std::string& list,unsigned int& channels);
+
+/* Notes: A MappedImage keeps its pixels in a shared memory mapping of the output file, behind "header", so every
+ * pixel the renderer sets lands in the page cache, and Write() has nothing left to do. If the file can't be
+ * mapped, the image falls back to heap memory and Write() writes the file the ordinary way. */
+class MappedImage : public Bitmap {
+	public:
+		MappedImage(std::string filePath,int imgHeight,int imgWidth,std::string header);
+		~MappedImage();
+		int Write();
+		int Read();
+
+		bool IsMapped() const { return _mapping!=NULL; };
+	private:
+		MappedImage(const MappedImage&) = delete;
+		MappedImage& operator= (const MappedImage&) = delete;
+
+		std::string _header;
+		void *_mapping;
+		size_t _mappingSize;
+};
+
+class PPMImage : public MappedImage {
+	public:
+		PPMImage(std::string filePath,int imgHeight,int imgWidth);
+};
+
+class RawImage : public MappedImage {
+	public:
+		RawImage(std::string filePath,int imgHeight,int imgWidth) : MappedImage(filePath,imgHeight,imgWidth,"") {};
+};
+
+class PFMImage : public Bitmap {
+	public:
+		PFMImage(std::string filePath,int imgHeight,int imgWidth) : Bitmap(filePath,imgHeight,imgWidth) {};
+		int Write();
+		int Read();
+};
+
+/* Notes: A ChannelImage holds the selected output channels of one frame, as float buffers filled from the hit 
+ * records of its pixels. Write() writes each channel to its own PFM file, <prefix>-<channel><suffix>: depth as a 
+ * greyscale PFM, the others as 3 component PFMs. Pixels whose ray hit nothing are 0, except in the voxel channel, 
+ * where they are -1. Pixels are independent, so tiles may be filled from several threads. */
+class ChannelImage {
+	public:
+		ChannelImage(std::string prefix,std::string suffix,int imgHeight,int imgWidth,unsigned int channels);
+		void SetHit(int x,int y,const HitRecord& hit);
+		int Write();
+	private:
+		std::string _prefix;
+		std::string _suffix;
+		int _height;
+		int _width;
+		unsigned int _channels;
+		std::vector<float> _depth;
+		std::vector<float> _position;
+		std::vector<float> _voxel;
+		std::vector<float> _normal;
+};
+
+/* Notes: A Y4MImage is one frame of a YUV4MPEG2 stream. Frame "frameNumber" (counting from 0) is written at its
+ * own offset, so frames may be written out of order and from several threads; a negative frame number appends
+ * to the end of the stream. The stream header is written with the first frame, and frames are only added to an
+ * existing stream when its header matches. */
+class Y4MImage : public Bitmap {
+	public:
+		Y4MImage(std::string filePath,int imgHeight,int imgWidth,long frameNumber = -1,int framerate = 25);
+		int Write();
+		int Read();
+	private:
+		long _frameNumber;
+		int _framerate;
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __RAY_PACKET_HPP
+#define __RAY_PACKET_HPP
+/**
+ * Filename:	RayPacket.hpp
+ * Purpose:		Define the structure-of-arrays ray packet, and the instruction sets packets are traced with.
+ * Author:		Erik E. Beerepoot
+ */
+#include "GeometricTypes.hpp"
+
+//x86 builds with GCC or Clang carry the SSE2, AVX2 and AVX-512 packet kernels
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RT_PACKET_X86 1
+#endif
+
+const int kMaxPacketSize = 16;
+
+/* Notes: A RayPacket holds up to kMaxPacketSize rays (usually neighbouring pixels), one array per component, so
+ * the tracer can work on all rays at once in SIMD lanes. Only the first "size" lanes are valid. Components are
+ * plain doubles in metres, matching Ray. */
+struct RayPacket {
+	int size;
+	double originX[kMaxPacketSize];
+	double originY[kMaxPacketSize];
+	double originZ[kMaxPacketSize];
+	double directionX[kMaxPacketSize];
+	double directionY[kMaxPacketSize];
+	double directionZ[kMaxPacketSize];
+	double length[kMaxPacketSize];
+
+	RayPacket() : size(0) {};
+
+	void Set(int lane,const Ray& ray){
+		originX[lane] = ray.origin.x.get();
+		originY[lane] = ray.origin.y.get();
+		originZ[lane] = ray.origin.z.get();
+		directionX[lane] = ray.direction.x.get();
+		directionY[lane] = ray.direction.y.get();
+		directionZ[lane] = ray.direction.z.get();
+		length[lane] = ray.length.get();
+	}
+};
+
+/* Notes: The packet tracer is compiled once per instruction set, and the best one supported by the CPU is
+ * picked at runtime. The packet size follows the vector width: 4 rays for SSE2 (and the scalar fallback),
+ * 8 for AVX2 and 16 for AVX-512. */
+enum PacketISA {
+	SCALAR_ISA = 0,
+	SSE2_ISA = 1,
+	AVX2_ISA = 2,
+	AVX512_ISA = 3,
+};
+
+PacketISA SupportedPacketISA();
+PacketISA SelectedPacketISA();
+void SelectPacketISA(PacketISA isa);
+int PacketWidth(PacketISA isa);
+
+#endif
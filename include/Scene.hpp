@@ -6,36 +6,70 @@
  * Author:		Erik E. Beerepoot
  */
  #include "GeometricTypes.hpp"
+ #include "GenericTypes.hpp"
+ #include "VoxelGrid.hpp"
+ #include "RayPacket.hpp"
+ #include "Mesh.hpp"
+ #include "PointCloud.hpp"
  
  #include <vector>
+ #include <string>
+ #include <stdint.h>
  
  class Scene {
 	public:
 		Scene();
-		Scene(Size size);
+		Scene(Size size,VoxelLayout layout = LINEAR_LAYOUT);
 		~Scene();
 		
-		pixel_t CheckPoints(std::vector<Point>& points) const;
+		pixel_t CheckRay(const Ray& ray,HitRecord* hit = NULL) const;
+		void CheckPacket(const RayPacket& packet,pixel_t* hits,HitRecord* records = NULL) const;
 		void AddPlane(Point upperLeft,Point lowerRight,pixel_t color);
-		void AddRightCuboid(Point centroid, Size size);
+		void AddRightCuboid(Point centroid,Size size,pixel_t color,bool solid = true);
+		void AddSphere(Point centre,Distance radius,pixel_t color,bool solid = true);
+		void AddCylinder(Point base,Distance radius,Distance height,pixel_t color,bool solid = true);
+		void AddMesh(const Mesh& mesh,Point origin,pixel_t color);
+		int AddPointCloud(const PointCloud& cloud,Point origin,pixel_t color,PointColorPolicy policy = LAST_POINT_COLOR);
+		int BuildDistanceField();
+		int Save(const std::string& path) const;
+		int Load(const std::string& path);
+		
+		//Read-only access, used to upload the scene to OpenCL devices
+		Size SceneSize() const { return _sceneSize; };
+		Size VoxelSize() const { return _gridDim; };
+		long long GridDimension(int axis) const { return _sceneData->Dimension(axis); };
+		unsigned long Revision() const { return _revision; };
+		void ExportVoxels(pixel_t* voxels) const;
 	private:
 		void AllocScene();
 		void DeallocScene();
 		
-		bool ClipPoint(Point& point) const;
-		void ClipRightCuboid(Point& centroid, Size& size);
+		bool ClipRay(const Ray& ray,double& tEnter,double& tExit) const;
+		void AddBox(Point p1,Point p2,pixel_t color,bool solid);
+		template<typename Span> void AddShape(const long long lo[3],const long long hi[3],const Span& span,pixel_t color,bool solid);
+		long long CellIndex(double coordinate,int axis) const;
 		pixel_t* At(Point pix);
+		const pixel_t* At(Point pix) const;
+		void VoxelIndex(Point pix,long long index[3]) const;
+		void UpdateDistanceField(const long long lo[3],const long long hi[3]);
+		size_t FieldIndex(long long x,long long y,long long z) const {
+			return static_cast<size_t>((x*_sceneData->Dimension(1) + y)*_sceneData->Dimension(2) + z);
+		};
 		
-		pixel_t*** _sceneData;
+		VoxelGrid* _sceneData;
+		VoxelLayout _layout;
 		Size _sceneSize;
 		Size _gridDim;
+		uint16_t* _distanceField;
+		unsigned long _revision;
+		
+		//Scene file mapping (see Load), holding the voxels and possibly the distance field
+		void* _mapping;
+		size_t _mappingSize;
+		bool _fieldMapped;
 		
 		pixel_t operator() (Point pix) { 
-			int idx,idy,idz;
-			idx = (pix.x / _gridDim.length).get();
-			idy = (pix.y / _gridDim.width).get();
-			idz = (pix.z / _gridDim.height).get();
-			return _sceneData[idx][idy][idz];
+			return *At(pix);
 		};
  };
  #endif
\ No newline at end of file
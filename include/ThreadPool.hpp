@@ -0,0 +1,52 @@
+#ifndef __THREAD_POOL_HPP
+#define __THREAD_POOL_HPP
+/**
+ * Filename:	ThreadPool.hpp
+ * Purpose:		Interface for ThreadPool class. A persistent pool of worker threads that runs batches of indexed
+ *				tasks, balancing the load by work stealing.
+ * Author:		Erik E. Beerepoot
+ */
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Notes: Every worker owns a queue of task indices. A batch is split into contiguous ranges, one per worker.
+ * Workers take tasks from the front of their own queue, and when it runs dry, steal from the back of the
+ * other queues. This keeps neighbouring tasks (e.g. tiles) on the same core, while no core sits idle. */
+class ThreadPool {
+	public:
+		ThreadPool(unsigned int numThreads = 0);
+		~ThreadPool();
+
+		void Run(size_t numTasks,const std::function<void(size_t)>& task);
+		static void RunOnce(size_t numTasks,unsigned int numThreads,const std::function<void(size_t)>& task);
+		unsigned int NumThreads() const { return static_cast<unsigned int>(_threads.size()); };
+	private:
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator= (const ThreadPool&) = delete;
+
+		struct WorkQueue {
+			std::mutex lock;
+			std::deque<size_t> tasks;
+		};
+
+		void WorkerLoop(unsigned int id);
+		bool PopTask(unsigned int id,size_t& task);
+
+		std::vector<std::thread> _threads;
+		std::vector<WorkQueue*> _queues;
+
+		std::mutex _lock;
+		std::condition_variable _wake;
+		std::condition_variable _done;
+		std::atomic<const std::function<void(size_t)>*> _task;
+		std::atomic<size_t> _remaining;
+		unsigned long _generation;
+		bool _stopping;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __TRAJECTORY_HPP
+#define __TRAJECTORY_HPP
+/**
+ * Filename:	Trajectory.hpp
+ * Purpose:		Interface for Trajectory class. A timestamped sequence of camera poses, interpolated in between.
+ * Author:		Erik E. Beerepoot
+ */
+#include "GeometricTypes.hpp"
+
+#include <string>
+#include <vector>
+
+/* Notes: Poses are kept sorted by time. In between two poses, the position is interpolated linearly and the 
+ * orientation by SLERP (spherical linear interpolation of unit quaternions), which takes the shortest rotation at 
+ * constant angular speed. Before the first and after the last pose, the trajectory holds still.
+ *
+ * Trajectory files are text, one pose per line, with '#' starting a comment. Either:
+ *   time x y z roll pitch yaw        (seconds, metres, radians)
+ *   time x y z qx qy qz qw           (TUM format, unit quaternion) */
+class Trajectory {
+	public:
+		Trajectory() {};
+		
+		int Load(const std::string& filePath);
+		void AddPose(Time time,const Pose& pose);
+		
+		Pose PoseAt(Time t) const;
+		Velocity VelocityAt(Time t,Time interval) const;
+		Time StartTime() const;
+		Time EndTime() const;
+		size_t Size() const { return _poses.size(); };
+	private:
+		struct Quaternion {
+			double w,x,y,z;
+		};
+		struct TimedPose {
+			double time;
+			double position[3];
+			Quaternion rotation;
+		};
+		
+		static Quaternion ToQuaternion(const Orientation& orientation);
+		static Orientation ToOrientation(const Quaternion& q);
+		static Quaternion Slerp(Quaternion a,Quaternion b,double s);
+		
+		std::vector<TimedPose> _poses;
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef __VOXEL_GRID_HPP
+#define __VOXEL_GRID_HPP
+/**
+ * Filename:	VoxelGrid.hpp
+ * Purpose:		Interface for VoxelGrid class. Stores the voxels of a scene in a single contiguous buffer, using a
+ *				selectable memory layout.
+ * Author:		Erik E. Beerepoot
+ */
+#include "GeometricTypes.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* Notes: LINEAR_LAYOUT stores the voxels in [x][y][z] order. MORTON_LAYOUT stores the grid as 16x16x16 tiles, 
+ * and interleaves the bits of the voxel indices within every tile (Z-order), so voxels that are close in space are
+ * close in memory along every axis. Tiles pad each axis by at most 15 voxels, instead of the power of two cube a
+ * single Morton code would need (twice the memory of a 400x400x200 grid, 46 times that of a thin slab). BRICK_LAYOUT
+ * stores the grid as 4x4x4 bricks, each brick being one contiguous 192 byte block.
+ * SPARSE_LAYOUT is a two-level brick map: a coarse map of 8x8x8 bricks, in which only bricks holding at least one
+ * non-empty voxel are allocated. Its memory scales with the occupied surface rather than the scene volume. */
+enum VoxelLayout {
+	LINEAR_LAYOUT = 0,
+	MORTON_LAYOUT = 1,
+	BRICK_LAYOUT = 2,
+	SPARSE_LAYOUT = 3,
+};
+
+class VoxelGrid {
+	public:
+		VoxelGrid(long long sizeX,long long sizeY,long long sizeZ,VoxelLayout layout);
+		VoxelGrid(long long sizeX,long long sizeY,long long sizeZ,VoxelLayout layout,pixel_t *voxels,size_t numVoxels,uint32_t *brickMap);
+		~VoxelGrid();
+
+		pixel_t& operator() (long long x,long long y,long long z);
+		const pixel_t& operator() (long long x,long long y,long long z) const;
+
+		size_t Index(long long x,long long y,long long z) const;
+		void FillSpan(long long x,long long y,long long z0,long long z1,pixel_t color);
+		bool IsEmptyBrick(long long x,long long y,long long z) const;
+		long long Dimension(int axis) const { return _dimension[axis]; };
+		long long BrickDimension() const { return 1LL << kSparseBrickShift; };
+		VoxelLayout Layout() const { return _layout; };
+		size_t MemoryUsage() const;
+		
+		//Raw storage, used to save the grid: the voxel buffer (the brick pool for the sparse layout) and brick map
+		const pixel_t* Voxels() const;
+		size_t NumVoxels() const;
+		const uint32_t* BrickMap() const { return _brickMap; };
+		size_t BrickMapSize() const { return (_layout==SPARSE_LAYOUT) ? static_cast<size_t>(_bricks[0]*_bricks[1]*_bricks[2]) : 0; };
+	private:
+		VoxelGrid(const VoxelGrid&) = delete;
+		VoxelGrid& operator= (const VoxelGrid&) = delete;
+
+		void SetDimensions(long long sizeX,long long sizeY,long long sizeZ);
+		static uint64_t SpreadBits(uint64_t v);
+		size_t BrickIndex(long long x,long long y,long long z) const;
+		pixel_t& AllocateVoxel(long long x,long long y,long long z);
+
+		static const int kMortonTileShift = 4;
+		static const int kSparseBrickShift = 3;
+		static const int kSparseBrickVoxels = 1 << (3*kSparseBrickShift);
+
+		pixel_t *_voxels;
+		size_t _numVoxels;
+		long long _dimension[3];
+		long long _bricks[3];
+		VoxelLayout _layout;
+
+		//Sparse layout only: brick map (0 = empty, otherwise brick number + 1) and brick storage
+		uint32_t *_brickMap;
+		std::vector<pixel_t> _brickPool;
+		pixel_t _emptyVoxel;
+		
+		//False when the voxels (or brick map) belong to someone else, e.g. a mapped scene file
+		bool _ownsStorage;
+};
+
+/**
+ * /name SpreadBits
+ * /brief Spreads the lower 21 bits of v, so that there are two zero bits between every bit (used for Morton codes).
+ */
+inline uint64_t VoxelGrid::SpreadBits(uint64_t v){
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffULL;
+	v = (v | v << 16) & 0x1f0000ff0000ffULL;
+	v = (v | v << 8) & 0x100f00f00f00f00fULL;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+	v = (v | v << 2) & 0x1249249249249249ULL;
+	return v;
+}
+
+/**
+ * /name Index
+ * /brief Returns the offset of voxel (x,y,z) in the voxel buffer, for the layout of this grid. For the sparse layout
+ * this is the offset within the voxel's brick.
+ */
+inline size_t VoxelGrid::Index(long long x,long long y,long long z) const {
+	const long long mask = (1LL << kSparseBrickShift) - 1;
+	const long long tileMask = (1LL << kMortonTileShift) - 1;
+	switch(_layout){
+		case MORTON_LAYOUT:
+			return ((((z >> kMortonTileShift)*_bricks[1] + (y >> kMortonTileShift))*_bricks[0] + (x >> kMortonTileShift)) << (3*kMortonTileShift))
+				| SpreadBits(x & tileMask) | (SpreadBits(y & tileMask) << 1) | (SpreadBits(z & tileMask) << 2);
+		case BRICK_LAYOUT:
+			return ((((z >> 2)*_bricks[1] + (y >> 2))*_bricks[0] + (x >> 2)) << 6) | ((z & 3) << 4) | ((y & 3) << 2) | (x & 3);
+		case SPARSE_LAYOUT:
+			return ((z & mask) << (2*kSparseBrickShift)) | ((y & mask) << kSparseBrickShift) | (x & mask);
+		default:
+			return (x*_dimension[1] + y)*_dimension[2] + z;
+	}
+}
+
+/**
+ * /name BrickIndex
+ * /brief Returns the offset in the brick map of the sparse brick holding voxel (x,y,z).
+ */
+inline size_t VoxelGrid::BrickIndex(long long x,long long y,long long z) const {
+	return ((z >> kSparseBrickShift)*_bricks[1] + (y >> kSparseBrickShift))*_bricks[0] + (x >> kSparseBrickShift);
+}
+
+/**
+ * /name IsEmptyBrick
+ * /brief Returns true if voxel (x,y,z) lies in an unallocated sparse brick, so the whole brick can be skipped.
+ * Always false for the dense layouts.
+ */
+inline bool VoxelGrid::IsEmptyBrick(long long x,long long y,long long z) const {
+	return _layout==SPARSE_LAYOUT && _brickMap[BrickIndex(x,y,z)]==0;
+}
+
+/**
+ * /name operator()
+ * /brief Returns voxel (x,y,z) for writing. For the sparse layout, allocates the voxel's brick if needed.
+ */
+inline pixel_t& VoxelGrid::operator() (long long x,long long y,long long z) {
+	if(_layout==SPARSE_LAYOUT) return AllocateVoxel(x,y,z);
+	return _voxels[Index(x,y,z)];
+}
+
+/**
+ * /name operator() const
+ * /brief Returns voxel (x,y,z). Voxels in unallocated sparse bricks are empty.
+ */
+inline const pixel_t& VoxelGrid::operator() (long long x,long long y,long long z) const {
+	if(_layout==SPARSE_LAYOUT){
+		uint32_t brick = _brickMap[BrickIndex(x,y,z)];
+		if(brick==0) return _emptyVoxel;
+		return _brickPool[static_cast<size_t>(brick-1)*kSparseBrickVoxels + Index(x,y,z)];
+	}
+	return _voxels[Index(x,y,z)];
+}
+
+#endif
@@ -1,4 +1,3 @@
-
 struct cl_Point {
     float x;
     float y;
@@ -6,52 +5,124 @@ struct cl_Point {
 };
 
 
-__constant float kSpatialSamplingDistance = (float)0.05;
 __constant float kPi = (float)(3.14159265358979);
 
-__kernel void traceray(float distance,
-                       const int row,
-                       const int u_c,
-                       const int v_c,
-                       const float diff_u,
-                       const float diff_v,
-                       const float pitch_h,
-                       const float pitch_v,
-                       const struct cl_Point centre,
-                       __global struct cl_Point *out_points){
-    
+/* Notes: Renders a whole frame of the pinhole camera, one work-item per pixel. Every ray is walked through the
+ * voxel grid (3D-DDA, as Scene::CheckRay), so only the final RGB pixels leave the device.
+ * orientation: roll, pitch and yaw at the first pixel, turning by orientationShift per pixel (rolling shutter).
+ * voxels: the scene grid, 3 bytes (RGB) per voxel in [x][y][z] order.
+ * out_pixels: the frame, 3 bytes (RGB) per pixel in row-major order. */
+__kernel void renderframe(const float distance,
+                          const int width,
+                          const int height,
+                          const int u_c,
+                          const int v_c,
+                          const float diff_u,
+                          const float diff_v,
+                          const float pitch_h,
+                          const float pitch_v,
+                          const struct cl_Point centre,
+                          const struct cl_Point pixelShift,
+                          const struct cl_Point orientation,
+                          const struct cl_Point orientationShift,
+                          const struct cl_Point sceneSize,
+                          const struct cl_Point voxelSize,
+                          const int countX,
+                          const int countY,
+                          const int countZ,
+                          __global const uchar *voxels,
+                          __global uchar *out_pixels){
     
     //determine location of this thread
     int u = get_global_id(0);
     int v = get_global_id(1);
-    v = row;
+    if(u >= width || v >= height) return;
+    int pixel = v*width + u;
     
     //Calculate current angle relative to image plane
-	float theta_u = diff_u * (u_c - u); //+ _orientation.yaw;;
-	float theta_v = diff_v * (v - v_c) + (kPi/2); // + _orientation.pitch;
+	float theta_u = diff_u * (u_c - u);
+	float theta_v = diff_v * (v - v_c) + (kPi/2);
 	
-	//Calculate origin of this point relative to image plane
-	float y = pitch_h * (u - u_c);
-	float z = pitch_v * (v - v_c);
+	//Rotation from the camera frame to the scene frame at this pixel: roll about x, then pitch about y, then yaw
+	//about z (as RotationMatrix)
+	float sr, sp, sy;
+	const float cr = sincos(orientation.x + pixel*orientationShift.x,&sr);
+	const float cp = sincos(orientation.y + pixel*orientationShift.y,&sp);
+	const float cy = sincos(orientation.z + pixel*orientationShift.z,&sy);
+	const float rotation[3][3] = {{cy*cp,cy*sp*sr - sy*cr,cy*sp*cr + sy*sr},
+	                              {sy*cp,sy*sp*sr + cy*cr,sy*sp*cr - cy*sr},
+	                              {-sp,cp*sr,cp*cr}};
+	
+	//Calculate origin of this ray: rolling shutter pose, plus the offset on the image plane
+    float origin[3], dir[3];
+    const float offset[2] = {pitch_h * (u - u_c),pitch_v * (v - v_c)};
+    const float local[3] = {sin(theta_v)*cos(theta_u),sin(theta_v)*sin(theta_u),cos(theta_v)};
+    origin[0] = centre.x + pixel*pixelShift.x + rotation[0][1]*offset[0] + rotation[0][2]*offset[1];
+    origin[1] = centre.y + pixel*pixelShift.y + rotation[1][1]*offset[0] + rotation[1][2]*offset[1];
+    origin[2] = centre.z + pixel*pixelShift.z + rotation[2][1]*offset[0] + rotation[2][2]*offset[1];
+    for(int axis=0;axis<3;axis++){
+        dir[axis] = rotation[axis][0]*local[0] + rotation[axis][1]*local[1] + rotation[axis][2]*local[2];
+    }
     
-    //Calculate step parameters
-    struct cl_Point pixelLoc,pixStep;
+    const float size[3] = {sceneSize.x,sceneSize.y,sceneSize.z};
+    const float cell[3] = {voxelSize.x,voxelSize.y,voxelSize.z};
+    const int count[3] = {countX,countY,countZ};
     
-    //calculate starting pixel
-    pixelLoc.x = centre.x;
-    pixelLoc.y = centre.y + y;
-    pixelLoc.z = centre.z + z;
+    __global uchar *out = out_pixels + 3*pixel;
+    out[0] = 0;
+    out[1] = 0;
+    out[2] = 0;
     
-    //calculate pixel step
-    pixStep.x = kSpatialSamplingDistance*sin(theta_v)*cos(theta_u);
-	pixStep.y = kSpatialSamplingDistance*sin(theta_v)*sin(theta_u);
-	pixStep.z = kSpatialSamplingDistance*cos(theta_v);
+    //Clip the ray against the scene (slab test)
+    float tEnter = 0.0f;
+    float tExit = distance;
+    for(int axis=0;axis<3;axis++){
+        if(dir[axis]==0.0f){
+            if(origin[axis] < 0.0f || origin[axis] > size[axis]) return;
+            continue;
+        }
+        float t0 = (0.0f - origin[axis]) / dir[axis];
+        float t1 = (size[axis] - origin[axis]) / dir[axis];
+        tEnter = max(tEnter,min(t0,t1));
+        tExit = min(tExit,max(t0,t1));
+        if(tEnter > tExit) return;
+    }
+    
+    //Set up the walk from the voxel the ray enters
+    int index[3], step[3];
+    float tMax[3], tDelta[3];
+    for(int axis=0;axis<3;axis++){
+        float p = origin[axis] + tEnter*dir[axis];
+        index[axis] = clamp((int)floor(p / cell[axis]),0,count[axis]-1);
+        if(dir[axis] > 0.0f){
+            step[axis] = 1;
+            tDelta[axis] = cell[axis] / dir[axis];
+            tMax[axis] = ((index[axis]+1)*cell[axis] - origin[axis]) / dir[axis];
+        } else if(dir[axis] < 0.0f){
+            step[axis] = -1;
+            tDelta[axis] = -cell[axis] / dir[axis];
+            tMax[axis] = (index[axis]*cell[axis] - origin[axis]) / dir[axis];
+        } else {
+            step[axis] = 0;
+            tDelta[axis] = INFINITY;
+            tMax[axis] = INFINITY;
+        }
+    }
     
-    int index = u*(distance/kSpatialSamplingDistance);
-    for(float d=0.0;d<=distance;d+=kSpatialSamplingDistance){
-        out_points[index].x = centre.x;
-        out_points[index].y = centre.y + y;
-        out_points[index].z = centre.z + z;
-        index++;
+    //Walk the grid until the first non-empty voxel
+    for(;;){
+        __global const uchar *voxel = voxels + 3*(((long)index[0]*count[1] + index[1])*count[2] + index[2]);
+        if(voxel[0]!=0 || voxel[1]!=0 || voxel[2]!=0){
+            out[0] = voxel[0];
+            out[1] = voxel[1];
+            out[2] = voxel[2];
+            return;
+        }
+        
+        int axis = (tMax[0] < tMax[1]) ? ((tMax[0] < tMax[2]) ? 0 : 2) : ((tMax[1] < tMax[2]) ? 1 : 2);
+        if(tMax[axis] > tExit) return;
+        index[axis] += step[axis];
+        if(index[axis] < 0 || index[axis] >= count[axis]) return;
+        tMax[axis] += tDelta[axis];
     }
-}
\ No newline at end of file
+}
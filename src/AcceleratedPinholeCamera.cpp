@@ -19,16 +19,31 @@
  */
 
 #include "AcceleratedPinholeCamera.hpp"
-#include "ComputeManager.hpp"
+#include "GenericTypes.hpp"
+
+#include <string.h>
 
 const std::string kKernelSourceFile = "../kernels/CameraKernels.cl";
-const std::string kKernelName = "traceray";
-const float kSpatialSamplingDistance = (float)0.05;
+const std::string kKernelName = "renderframe";
+
+/**
+ * /name ToDevicePoint
+ * /brief Converts a Point to the (single precision) point type used by the kernels.
+ */
+static cl_Point ToDevicePoint(Point point){
+    PointF p = PointCast<float>(point);
+    cl_Point devicePoint;
+    devicePoint.x = p.x.get();
+    devicePoint.y = p.y.get();
+    devicePoint.z = p.z.get();
+    return devicePoint;
+}
+
 /**
  * /name PinholeCamera
  * /brief Constructor for Camera object. Sets sensible defaults, using common parameters for a CCD image sensor and camera.
  */
-AcceleratedPinholeCamera::AcceleratedPinholeCamera(Point centre,Orientation orientation,Velocity velocity) : Camera(centre,orientation,velocity) {
+AcceleratedPinholeCamera::AcceleratedPinholeCamera(Point centre,Orientation orientation,Velocity velocity) : Camera(centre,orientation,velocity), _kernel(NULL), _uploadedScene(NULL), _uploadedRevision(0) {
 	//default camera is DSLR like (4mmx3mm sensor, 640x480)
 	sensor.pitch.vertical = 0.000004_m;
 	sensor.pitch.horizontal = 0.000003_m;
@@ -43,124 +58,224 @@ AcceleratedPinholeCamera::AcceleratedPinholeCamera(Point centre,Orientation orie
 	framerate = 30;
     
     ComputeManager *mgr = ComputeManager::SharedComputeManager();
+    if(!mgr->IsAvailable()) return;
     
-    //Build kernel
+    //Build kernel, RenderFrame() fails if this fails
     if(mgr->BuildKernelFromFile(kKernelSourceFile,kKernelName,&_kernel)==false){
-        std::cout << "Failed to build kernel. Exiting..." << std::endl;
-        exit(1);
+        std::cout << "Failed to build kernel (error " << mgr->LastError() << ")" << std::endl;
+        _kernel = NULL;
     }
 }
 
-std::vector<Point> AcceleratedPinholeCamera::Trace(Distance distance) {
-    std::vector<Point> points;
+/**
+ * /name ~AcceleratedPinholeCamera
+ * /brief Releases the kernel. The device buffers go back to the pool, for the next camera.
+ */
+AcceleratedPinholeCamera::~AcceleratedPinholeCamera(){
+    if(_kernel!=NULL) clReleaseKernel(_kernel);
+}
+
+/**
+ * /name UploadScene
+ * /brief Copies the voxels of the scene to the device, unless the device already holds this version of the scene.
+ * /notes The voxels are exported straight into the mapped (pinned) buffer, without a host side copy.
+ */
+int AcceleratedPinholeCamera::UploadScene(const Scene& scene){
+    if(_sceneBuffer.IsValid() && _uploadedScene==&scene && _uploadedRevision==scene.Revision()) return SUCCESS;
     
     ComputeManager *mgr = ComputeManager::SharedComputeManager();
-    if(mgr==NULL) return points;
-    
-    //Allocate host memory
-    int numPoints = static_cast<int>(distance.get()/kSpatialSamplingDistance);
-    std::cout << "Num points: " << numPoints << std::endl;
-    _h_out = (cl_Point*)malloc(sensor.resolution.horizontal*numPoints*sizeof(cl_Point));
-    if(_h_out==NULL){
-        std::cout << "Failed to allocate host buffer..." << std::endl;
-        return std::vector<Point>();
+    _uploadedScene = NULL;
+    
+    const size_t numVoxels = static_cast<size_t>(scene.GridDimension(0) * scene.GridDimension(1) * scene.GridDimension(2));
+    const size_t size = numVoxels*sizeof(pixel_t);
+    if(!_sceneBuffer.IsValid() || _sceneBuffer.Size()!=size){
+        if(!mgr->AcquireBuffer(size,CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,&_sceneBuffer)){
+            std::cout << "Failed to allocate scene buffer (error " << mgr->LastError() << ")" << std::endl;
+            return ERROR;
+        }
+    }
+    
+    pixel_t *voxels = static_cast<pixel_t*>(mgr->MapBuffer(_sceneBuffer,CL_MAP_WRITE));
+    if(voxels==NULL){
+        std::cout << "Failed to upload scene (error " << mgr->LastError() << ")" << std::endl;
+        return ERROR;
     }
+    scene.ExportVoxels(voxels);
+    if(!mgr->UnmapBuffer(_sceneBuffer,voxels)) return ERROR;
+    
+    _uploadedScene = &scene;
+    _uploadedRevision = scene.Revision();
+    return SUCCESS;
+}
 
-    //Allocate device memory
-    mgr->AllocateBufferOfSize(sensor.resolution.horizontal*numPoints*sizeof(cl_Point),&_d_out,(void*)_h_out,CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR);
-    if(_h_out==NULL){
-        std::cout << "Failed to allocate host buffer..." << std::endl;
-        return points;
+/**
+ * /name AcquireFrameBuffer
+ * /brief Makes sure "frame" holds a pooled device buffer of one frame. Kept buffers are reused.
+ */
+int AcceleratedPinholeCamera::AcquireFrameBuffer(DeviceBuffer& frame){
+    const size_t outSize = static_cast<size_t>(sensor.resolution.horizontal) * sensor.resolution.vertical * sizeof(pixel_t);
+    if(frame.IsValid() && frame.Size()==outSize) return SUCCESS;
+    
+    ComputeManager *mgr = ComputeManager::SharedComputeManager();
+    if(!mgr->AcquireBuffer(outSize,CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,&frame)){
+        std::cout << "Failed to allocate device buffer..." << std::endl;
+        return ERROR;
     }
+    return SUCCESS;
+}
+
+/**
+ * /name EnqueueKernel
+ * /brief Uploads the scene if needed, and queues the render kernel for the current pose, writing to "frame". If
+ * "done" is not NULL, it receives an event that completes with the kernel.
+ * /notes The kernel arguments are captured when it is queued, so the camera may move on straight away.
+ */
+int AcceleratedPinholeCamera::EnqueueKernel(const Scene& scene,Distance distance,const DeviceBuffer& frame,cl_event *done){
+    ComputeManager *mgr = ComputeManager::SharedComputeManager();
+    if(mgr==NULL || _kernel==NULL) return ERROR;
+    if(UploadScene(scene)!=SUCCESS) return ERROR;
+    
+    const int width = sensor.resolution.horizontal;
+    const int height = sensor.resolution.vertical;
     
     //Centre pixel
-	static int u_c = sensor.resolution.horizontal / 2;
-	static int v_c = sensor.resolution.vertical / 2;
+	int u_c = width / 2;
+	int v_c = height / 2;
 	
 	//Angular difference / ray
-	static Angle diff_u = ((fieldOfView.horizontal / 2) / u_c);
-	static Angle diff_v = ((fieldOfView.vertical / 2) / v_c);
-    
-    //get centre
-    cl_Point centre;
-    Distance t =  (_centre.x);
-    centre.x = t.get();
-    t =  (_centre.y);
-    centre.y = t.get();
-    t =  (_centre.z);
-    centre.z = t.get();
-    
-    //Save sensor pitch
-    t = sensor.pitch.horizontal;
-    float p_hor = t.get();
-    t = sensor.pitch.vertical;
-    float p_vert = t.get();
-    
-    //Save other vars
-    float dist = (float)distance.get();
-    float f_diff_u = (float)diff_u.get();
-    float f_diff_v = (float)diff_v.get();
-    int row = 1;
-    cl_int err = 0;
+	float diff_u = ValueCast<float>((fieldOfView.horizontal / 2) / u_c).get();
+	float diff_v = ValueCast<float>((fieldOfView.vertical / 2) / v_c).get();
+    float p_hor = ValueCast<float>(sensor.pitch.horizontal).get();
+    float p_vert = ValueCast<float>(sensor.pitch.vertical).get();
+    float dist = ValueCast<float>(distance).get();
+    
+    //Rolling shutter: the pose at the first pixel, and the shift between consecutive pixels
+    Pose first = PixelPose(0,0);
+    Pose second = PoseAt(PixelTime(1));
+    cl_Point centre = ToDevicePoint(first.centre);
+    cl_Point shift = ToDevicePoint(Point(second.centre.x - first.centre.x,second.centre.y - first.centre.y,second.centre.z - first.centre.z));
+    cl_Point orientation = {static_cast<float>(first.orientation.roll.get()),static_cast<float>(first.orientation.pitch.get()),static_cast<float>(first.orientation.yaw.get())};
+    cl_Point turn = {static_cast<float>((second.orientation.roll - first.orientation.roll).get()),
+                     static_cast<float>((second.orientation.pitch - first.orientation.pitch).get()),
+                     static_cast<float>((second.orientation.yaw - first.orientation.yaw).get())};
+    
+    //Scene geometry
+    Size size = scene.SceneSize();
+    Size voxel = scene.VoxelSize();
+    cl_Point sceneSize = ToDevicePoint(Point(size.length,size.width,size.height));
+    cl_Point voxelSize = ToDevicePoint(Point(voxel.length,voxel.width,voxel.height));
+    int count[3];
+    for(int axis=0;axis<3;axis++) count[axis] = static_cast<int>(scene.GridDimension(axis));
     
     //Set kernel parameters
+    cl_int err = 0;
     err |= clSetKernelArg(_kernel, 0, sizeof(float), &dist);
-    err |= clSetKernelArg(_kernel, 1, sizeof(int), &row);
-    err |= clSetKernelArg(_kernel, 2, sizeof(int), &u_c);
-    err |= clSetKernelArg(_kernel, 3, sizeof(int), &v_c);
-    err |= clSetKernelArg(_kernel, 4, sizeof(float), &f_diff_u);
-    err |= clSetKernelArg(_kernel, 5, sizeof(float), &f_diff_v);
-    err |= clSetKernelArg(_kernel, 6, sizeof(float), &p_hor);
-    err |= clSetKernelArg(_kernel, 7, sizeof(float), &p_vert);
-    err |= clSetKernelArg(_kernel, 8, sizeof(cl_Point), &_centre);
-    err |= clSetKernelArg(_kernel, 9, sizeof(cl_mem), &_d_out);
+    err |= clSetKernelArg(_kernel, 1, sizeof(int), &width);
+    err |= clSetKernelArg(_kernel, 2, sizeof(int), &height);
+    err |= clSetKernelArg(_kernel, 3, sizeof(int), &u_c);
+    err |= clSetKernelArg(_kernel, 4, sizeof(int), &v_c);
+    err |= clSetKernelArg(_kernel, 5, sizeof(float), &diff_u);
+    err |= clSetKernelArg(_kernel, 6, sizeof(float), &diff_v);
+    err |= clSetKernelArg(_kernel, 7, sizeof(float), &p_hor);
+    err |= clSetKernelArg(_kernel, 8, sizeof(float), &p_vert);
+    err |= clSetKernelArg(_kernel, 9, sizeof(cl_Point), &centre);
+    err |= clSetKernelArg(_kernel, 10, sizeof(cl_Point), &shift);
+    err |= clSetKernelArg(_kernel, 11, sizeof(cl_Point), &orientation);
+    err |= clSetKernelArg(_kernel, 12, sizeof(cl_Point), &turn);
+    err |= clSetKernelArg(_kernel, 13, sizeof(cl_Point), &sceneSize);
+    err |= clSetKernelArg(_kernel, 14, sizeof(cl_Point), &voxelSize);
+    err |= clSetKernelArg(_kernel, 15, sizeof(int), &count[0]);
+    err |= clSetKernelArg(_kernel, 16, sizeof(int), &count[1]);
+    err |= clSetKernelArg(_kernel, 17, sizeof(int), &count[2]);
+    cl_mem sceneMem = _sceneBuffer.Mem();
+    cl_mem frameMem = frame.Mem();
+    err |= clSetKernelArg(_kernel, 18, sizeof(cl_mem), &sceneMem);
+    err |= clSetKernelArg(_kernel, 19, sizeof(cl_mem), &frameMem);
     if (err != CL_SUCCESS)
     {
         printf("Error: Failed to set kernel arguments! %d\n", err);
-        return points;
+        return ERROR;
     }
     
     //Get pointer to queue
     cl_command_queue q = mgr->CommandQueue();
     
-    //Set kernel parameters
-    const size_t width = static_cast<size_t>(sensor.resolution.horizontal);
-    const size_t global[2] = {width,1};
-    const size_t local = 1;
-
+    //One work-item per pixel
+    const size_t global[2] = {static_cast<size_t>(width),static_cast<size_t>(height)};
+    
     //queue kernel for execution
-    err = clEnqueueNDRangeKernel(q,_kernel,2,NULL,&global[0],NULL,0,NULL,NULL);
+    err = clEnqueueNDRangeKernel(q,_kernel,2,NULL,&global[0],NULL,0,NULL,done);
     if (err != CL_SUCCESS)
     {
         printf("Error: Failed to enqueue kernel! %d\n", err);
-        return points;
+        return ERROR;
     }
-    //wait for kernel to finish
-    clFinish(q);
+    return SUCCESS;
+}
+
+/**
+ * /name RenderFrame
+ * /brief Renders the scene to "img" on the device: the kernel traces every pixel through the voxel grid, and only 
+ * the RGB frame is read back. Returns 0 on success.
+ * /notes Rays are traced in single precision, so pixels on voxel edges may differ from PinholeCamera.
+ */
+int AcceleratedPinholeCamera::RenderFrame(const Scene& scene,Distance distance,Bitmap& img){
+    ComputeManager *mgr = ComputeManager::SharedComputeManager();
+    if(AcquireFrameBuffer(_frameBuffer)!=SUCCESS) return ERROR;
+    if(EnqueueKernel(scene,distance,_frameBuffer,NULL)!=SUCCESS) return ERROR;
     
-    //Read back the results from the device to verify the output
-    err = clEnqueueReadBuffer( q, _d_out, CL_TRUE, 0, sensor.resolution.horizontal*numPoints*sizeof(cl_Point),_h_out,0,  NULL, NULL);
+    const size_t outSize = _frameBuffer.Size();
+    cl_mem frameMem = _frameBuffer.Mem();
+    cl_command_queue q = mgr->CommandQueue();
+    cl_int err;
+    
+    //Devices sharing host memory are mapped, others read (DMA) from the pinned buffer. Both block until the
+    //kernel is done.
+    if(mgr->HostUnifiedMemory()){
+        void *frame = mgr->MapBuffer(_frameBuffer,CL_MAP_READ);
+        if(frame==NULL){
+            printf("Error: Failed to map frame buffer! %d\n", mgr->LastError());
+            return ERROR;
+        }
+        memcpy(img.GetImageData(),frame,outSize);
+        if(!mgr->UnmapBuffer(_frameBuffer,frame)) return ERROR;
+        return SUCCESS;
+    }
+    
+    err = clEnqueueReadBuffer(q,frameMem,CL_TRUE,0,outSize,img.GetImageData(),0,NULL,NULL);
     if (err != CL_SUCCESS)
     {
         printf("Error: Failed to enqueue read buffer! %d\n", err);
-        return points;
+        return ERROR;
     }
+    return SUCCESS;
+}
 
-#warning continue here
-    /*
-    Point tmpPoint(0.0_m,0.0_m,0.0_m);
-    for(int index=0;index<width*numPoints;index++){
-        tmpPoint.x = _h_out[index].x;
-        tmpPoint.y = _h_out[index].y;
-        tmpPoint.z = _h_out[index].z;
-        
-        //points.push_back(
-    }
-    */
+/**
+ * /name EnqueueFrame
+ * /brief Queues a frame without waiting for it: the kernel runs on the compute queue, writing to "frame", and the
+ * read back into "img" follows on the transfer queue. "done" receives an event that completes once "img" holds 
+ * the frame; the caller must wait for it, and release it, before touching "img" or "frame" again.
+ * /notes Used to pipeline sequences: while one frame is read back, the next one is already being computed.
+ */
+int AcceleratedPinholeCamera::EnqueueFrame(const Scene& scene,Distance distance,DeviceBuffer& frame,Bitmap& img,cl_event *done){
+    ComputeManager *mgr = ComputeManager::SharedComputeManager();
+    if(AcquireFrameBuffer(frame)!=SUCCESS) return ERROR;
     
-    printf("(%f,%f,%f),",_h_out[1].x,_h_out[1].y,_h_out[1].z);
-    printf("(%f,%f,%f),",_h_out[40000].x,_h_out[40000].y,_h_out[2000].z);
+    cl_event computed;
+    if(EnqueueKernel(scene,distance,frame,&computed)!=SUCCESS) return ERROR;
     
-
-    return points;
-}
\ No newline at end of file
+    //The transfer queue waits for the kernel through its event, not for the whole compute queue
+    cl_int err = clEnqueueReadBuffer(mgr->TransferQueue(),frame.Mem(),CL_FALSE,0,frame.Size(),img.GetImageData(),1,&computed,done);
+    clReleaseEvent(computed);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to enqueue read buffer! %d\n", err);
+        return ERROR;
+    }
+    
+    //Start both queues, so the frame does not sit waiting for the caller to block
+    clFlush(mgr->CommandQueue());
+    clFlush(mgr->TransferQueue());
+    return SUCCESS;
+}
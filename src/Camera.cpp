@@ -21,15 +21,13 @@
 #include "Camera.hpp"
 #include "ComputeManager.hpp"
 #include <iostream>
-
-const Distance kSpatialSamplingDistance = 0.005_m;
-const Angle kPi = 3.14159265358979_rad;
+#include <algorithm>
 
 /**
  * /name Camera
  * /brief Constructor for Camera object. Sets sensible defaults, using common parameters for a CCD image sensor and camera.
  */
-Camera::Camera(Point centre,Orientation orientation,Velocity velocity) : _centre(centre), _orientation(orientation), _velocity(velocity) , _samplingTime(0.0_s) {
+Camera::Camera(Point centre,Orientation orientation,Velocity velocity) : _centre(centre), _orientation(orientation), _velocity(velocity) , _samplingTime(0.0_s), _model(std::make_shared<SphericalModel>()), _validDirections(NULL) {
 	//default camera is DSL like (4mmx3mm sensor, 640x480)
 	sensor.pitch.vertical = 0.004_m;
 	sensor.pitch.horizontal = 0.003_m;
@@ -43,6 +41,123 @@ Camera::Camera(Point centre,Orientation orientation,Velocity velocity) : _centre
 	// Framerate: ~real time
 	framerate = 2;
     _samplingTime = Time(double(1/double(framerate * sensor.resolution.vertical * sensor.resolution.horizontal)));
+    UpdateDirections();
+}
+
+/**
+ * /name    PixelTime
+ * /brief   Returns the time, relative to the start of the frame, at which pixel number "pixelIndex" (row-major) is exposed.
+ */
+Time Camera::PixelTime(long pixelIndex) const {
+    return _samplingTime * static_cast<double>(pixelIndex);
+}
+
+/**
+ * /name    PoseAt
+ * /brief   Returns the pose of the camera at time t, relative to the start of the frame. Does not modify the camera,
+ * so it is safe to call from any thread while rendering.
+ */
+Pose Camera::PoseAt(Time t) const {
+    Point centre(_centre.x + t * _velocity.V_x,
+                 _centre.y + t * _velocity.V_y,
+                 _centre.z + t * _velocity.V_z);
+    Orientation orientation(_orientation.roll + t * _velocity.w_x,
+                            _orientation.pitch + t * _velocity.w_y,
+                            _orientation.yaw + t * _velocity.w_z);
+    return Pose(centre,orientation);
+}
+
+/**
+ * /name    PixelPose
+ * /brief   Returns the pose of the camera while pixel (u,v) is exposed.
+ */
+Pose Camera::PixelPose(int u,int v) const {
+    return PoseAt(PixelTime(static_cast<long>(v) * sensor.resolution.horizontal + u));
+}
+
+/**
+ * /name    FrameDuration
+ * /brief   Returns the time it takes to expose a whole frame, from the first to the last pixel.
+ */
+Time Camera::FrameDuration() const {
+    return PixelTime(static_cast<long>(sensor.resolution.vertical) * sensor.resolution.horizontal);
+}
+
+/**
+ * /name    AdvanceFrame
+ * /brief   Moves the camera to its pose at the end of the current frame, i.e. the start of the next one.
+ * /notes   Must not be called while a frame is being rendered.
+ */
+void Camera::AdvanceFrame(){
+    Pose next = PoseAt(FrameDuration());
+    _centre = next.centre;
+    _orientation = next.orientation;
+}
+
+/**
+ * /name    SetMotion
+ * /brief   Places the camera at "pose" at the start of the frame, moving with "velocity" during it.
+ */
+void Camera::SetMotion(const Pose& pose,const Velocity& velocity){
+    _centre = pose.centre;
+    _orientation = pose.orientation;
+    _velocity = velocity;
+}
+
+/**
+ * /name    SetModel
+ * /brief   Selects the lens model, and builds its direction table.
+ */
+void Camera::SetModel(std::shared_ptr<const CameraModel> model){
+    if(!model) return;
+    _model = model;
+    UpdateDirections();
+}
+
+/**
+ * /name    Intrinsics
+ * /brief   Returns the current resolution and field of view, as used by the lens model.
+ */
+CameraIntrinsics Camera::Intrinsics() const {
+    return CameraIntrinsics(sensor.resolution.horizontal,sensor.resolution.vertical,fieldOfView.horizontal,fieldOfView.vertical);
+}
+
+/**
+ * /name    UpdateDirections
+ * /brief   Rebuilds the direction table if the lens model or the intrinsics changed since it was built.
+ * /notes   Tables hold camera frame directions, so they depend on the model and the intrinsics only, never on the 
+ * pose. Tables are never modified, so copies of the camera share them. Must not be called while the camera is
+ * rendering. The renderers call it before every frame, so the table is checked once per frame, not per ray.
+ */
+void Camera::UpdateDirections(){
+    const DirectionTable* table = _directions.get();
+    if(table==NULL || !table->Matches(_model.get(),Intrinsics())){
+        _directions = std::make_shared<DirectionTable>(_model.get(),Intrinsics());
+    }
+    _validDirections = _directions.get();
+}
+
+/**
+ * /name    Directions
+ * /brief   Returns the direction table as of the last UpdateDirections.
+ * /notes   If the model or the intrinsics changed since, the table is stale until UpdateDirections is called again.
+ * Callers only read the table within its own size, so a stale table gives wrong rays, never a bad read.
+ */
+const DirectionTable* Camera::Directions() const {
+    return _validDirections;
+}
+
+/**
+ * /name    PixelDirection
+ * /brief   Returns the unit direction, in the camera frame, of the ray through pixel (u,v).
+ */
+void Camera::PixelDirection(int u,int v,double direction[3]) const {
+    const DirectionTable* table = Directions();
+    if(table!=NULL && u>=0 && u<table->Width() && v>=0 && v<table->Height()){
+        table->Direction(u,v,direction);
+    } else {
+        _model->Direction(u,v,Intrinsics(),direction);
+    }
 }
 
 /**
@@ -63,85 +178,86 @@ PinholeCamera::PinholeCamera(Point centre,Orientation orientation,Velocity veloc
 	// Framerate: ~real time
 	framerate = 2;
     _samplingTime = Time(double(1/double(framerate * sensor.resolution.vertical * sensor.resolution.horizontal)));
+    UpdateDirections();
 }
 
 /**
- * /name TraceRay
- * /brief Traces a ray from the pixel at (u,v) for "distance" metres. Returning a vector of points the ray "visits"
+ * /name CastRay
+ * /brief Returns the ray leaving the pixel at (u,v), limited to "distance" metres. Used for exact voxel traversal.
+ * /notes Casts a packet of one pixel, so single rays and packets always agree.
  */
-std::vector<Point> PinholeCamera::TraceRay(int u,int v,Distance distance) const {
-	//Centre pixel
-	static int u_c = sensor.resolution.horizontal / 2;
-	static int v_c = sensor.resolution.vertical / 2;
-	
-	//Angular difference / ray
-	static Angle diff_u = ((fieldOfView.horizontal / 2) / u_c);
-	static Angle diff_v = ((fieldOfView.vertical / 2) / v_c);
-	
-	//Calculate current angle relative to image plane	
-	Angle theta_u = diff_u * (u_c - u);
-	Angle theta_v = diff_v * (v - v_c) + (kPi/2);
-	
-	//Calculate origin of this point relative to image plane
-	Distance y = sensor.pitch.horizontal * (u - u_c);
-	Distance z = sensor.pitch.vertical * (v - v_c);
-	
-	Point pixelLocation(_centre.x,_centre.y + y,_centre.z + z);	
-	Point pixelStep = AzInclRangeToXYZ(theta_u,theta_v,kSpatialSamplingDistance);
-	Point nextPixel = pixelLocation;
-	std::vector<Point> points;
-	
-	for(Distance d=0.0_m;d<=distance;d=d+kSpatialSamplingDistance){
-		nextPixel = nextPixel + pixelStep;
-		points.push_back(nextPixel);
-	}
-    return points;
+Ray PinholeCamera::CastRay(int u,int v,Distance distance) const {
+	RayPacket packet;
+	CastPacket(u,v,1,distance,packet);
+	return Ray(Point(Distance(packet.originX[0]),Distance(packet.originY[0]),Distance(packet.originZ[0])),
+	           Point(Distance(packet.directionX[0]),Distance(packet.directionY[0]),Distance(packet.directionZ[0])),
+	           Distance(packet.length[0]));
 }
 
 /**
- * /name TraceRay
- * /brief Traces a ray from the pixel at (u,v) for "distance" metres. Returning a vector of points the ray "visits"
+ * /name CastPacket
+ * /brief Fills "packet" with the rays leaving the "count" pixels (u,v) ... (u+count-1,v). 
+ * /notes Directions come from the table in the camera frame (once per packet), and are then turned into the scene
+ * frame by the pose of each pixel, so a moving or turning camera never rebuilds the table.
  */
-void PinholeCamera::TraceRay(int& u,int& v,Distance& distance,std::vector<Point> &points) const {
+void PinholeCamera::CastPacket(int u,int v,int count,Distance distance,RayPacket& packet) const {
 	//Centre pixel
-	static int u_c = sensor.resolution.horizontal / 2;
-	static int v_c = sensor.resolution.vertical / 2;
+	int u_c = sensor.resolution.horizontal / 2;
+	int v_c = sensor.resolution.vertical / 2;
 	
-	//Angular difference / ray
-	static Angle diff_u = ((fieldOfView.horizontal / 2) / u_c);
-	static Angle diff_v = ((fieldOfView.vertical / 2) / v_c);
+	//Row term: vertical offset
+	const double z = (sensor.pitch.vertical * (v - v_c)).get();
+	packet.size = std::min(count,kMaxPacketSize);
 	
-	//Calculate current angle relative to image plane
-    Angle theta_u = diff_u * (u_c - u) + _orientation.yaw;
-	Angle theta_v = diff_v * (v - v_c) + (kPi/2) + _orientation.pitch;
+	//Orientation of every lane (PixelPose), as the rotation from the camera frame to the scene frame. Without 
+	//angular velocity, all lanes share the rotation of the first one
+	const bool turning = _velocity.w_x.get()!=0.0 || _velocity.w_y.get()!=0.0 || _velocity.w_z.get()!=0.0;
+	double rotation[3][3][kMaxPacketSize];
+	double laneRotation[3][3];
+	for(int lane=0;lane<packet.size;++lane){
+		if(lane==0 || turning) RotationMatrix(PixelPose(u + lane,v).orientation,laneRotation);
+		for(int row=0;row<3;++row){
+			for(int col=0;col<3;++col) rotation[row][col][lane] = laneRotation[row][col];
+		}
+	}
 	
-	//Calculate origin of this point relative to image plane
-	Distance y = sensor.pitch.horizontal * (u - u_c);
-	Distance z = sensor.pitch.vertical * (v - v_c);
+	//Origins, with every lane at its own pose: the position of the camera, plus the pixel's offset on the image 
+	//plane. Pixel numbers and column offsets are whole numbers, so adding the lane in double is exact, and the lanes
+	//are plain arithmetic the compiler runs in SIMD lanes
+	const double firstPixel = static_cast<double>(static_cast<long>(v) * sensor.resolution.horizontal + u);
+	const double firstColumn = static_cast<double>(u - u_c);
+	const double samplingTime = _samplingTime.get();
+	const double pitch = sensor.pitch.horizontal.get();
+	const double centre[3] = {_centre.x.get(),_centre.y.get(),_centre.z.get()};
+	const double velocity[3] = {_velocity.V_x.get(),_velocity.V_y.get(),_velocity.V_z.get()};
+	const double length = distance.get();
+	for(int lane=0;lane<packet.size;++lane){
+		const double t = samplingTime * (firstPixel + lane);
+		const double y = pitch * (firstColumn + lane);
+		packet.originX[lane] = (centre[0] + t * velocity[0]) + (rotation[0][1][lane] * y + rotation[0][2][lane] * z);
+		packet.originY[lane] = (centre[1] + t * velocity[1]) + (rotation[1][1][lane] * y + rotation[1][2][lane] * z);
+		packet.originZ[lane] = (centre[2] + t * velocity[2]) + (rotation[2][1][lane] * y + rotation[2][2][lane] * z);
+		packet.length[lane] = length;
+	}
 	
-	Point pixelLocation(_centre.x,_centre.y + y,_centre.z + z);
-	Point pixelStep = AzInclRangeToXYZ(theta_u,theta_v,kSpatialSamplingDistance);
-	Point nextPixel = pixelLocation;
+	//Directions in the camera frame: one row of the table, and the lens model for pixels outside it
+	const DirectionTable* table = Directions();
+	int tableLanes = 0;
+	if(table!=NULL && u >= 0 && v >= 0 && v < table->Height()) tableLanes = std::max(0,std::min(packet.size,table->Width() - u));
+	if(tableLanes > 0) table->Row(u,v,tableLanes,packet.directionX,packet.directionY,packet.directionZ);
+	for(int lane=tableLanes;lane<packet.size;++lane){
+		double direction[3];
+		PixelDirection(u + lane,v,direction);
+		packet.directionX[lane] = direction[0];
+		packet.directionY[lane] = direction[1];
+		packet.directionZ[lane] = direction[2];
+	}
 	
-	for(Distance d=0.0_m;d<=distance;d=d+kSpatialSamplingDistance){
-		nextPixel = nextPixel + pixelStep;
-		points.push_back(nextPixel);
+	//Turn them into the scene frame
+	for(int lane=0;lane<packet.size;++lane){
+		const double d[3] = {packet.directionX[lane],packet.directionY[lane],packet.directionZ[lane]};
+		packet.directionX[lane] = rotation[0][0][lane] * d[0] + rotation[0][1][lane] * d[1] + rotation[0][2][lane] * d[2];
+		packet.directionY[lane] = rotation[1][0][lane] * d[0] + rotation[1][1][lane] * d[1] + rotation[1][2][lane] * d[2];
+		packet.directionZ[lane] = rotation[2][0][lane] * d[0] + rotation[2][1][lane] * d[1] + rotation[2][2][lane] * d[2];
 	}
 }
-
-/**
- * /name    UpdatePosition
- * /brief   Updates the position of this camera object, assuming a single ray has been shot
- */
-void PinholeCamera::UpdatePosition(){
-    //Update position
-    _centre.x = _centre.x + _samplingTime * _velocity.V_x;
-    _centre.y = _centre.y + _samplingTime * _velocity.V_y;
-    _centre.z = _centre.z + _samplingTime * _velocity.V_z;
-    
-    //Update orientation
-    _orientation.roll = _orientation.roll + _samplingTime * _velocity.w_x;
-    _orientation.pitch = _orientation.pitch + _samplingTime * _velocity.w_y;
-    _orientation.yaw = _orientation.yaw + _samplingTime * _velocity.w_z;
-}
-
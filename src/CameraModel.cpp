@@ -0,0 +1,222 @@
+
+/**
+ *      ___           ___           ___           ___
+ *     /\  \         /\  \         /\  \         /\__\
+ *    /::\  \       /::\  \       /::\  \       /:/  /
+ *   /:/\:\  \     /:/\ \  \     /:/\:\  \     /:/  /
+ *  /::\~\:\  \   _\:\~\ \  \   /::\~\:\  \   /:/  /
+ * /:/\:\ \:\__\ /\ \:\ \ \__\ /:/\:\ \:\__\ /:/__/
+ * \/__\:\/:/  / \:\ \:\ \/__/ \/_|::\/:/  / \:\  \
+ *      \::/  /   \:\ \:\__\      |:|::/  /   \:\  \
+ *      /:/  /     \:\/:/  /      |:|\/__/     \:\  \
+ *     /:/  /       \::/  /       |:|  |        \:\__\
+ *     \/__/         \/__/         \|__|         \/__/
+ * -----------------------------------------------------
+ * /name    CameraModel
+ * /brief   Camera (lens) models and the per-camera ray direction tables.
+ * /author  Erik E. Beerepoot
+ */
+
+#include "GenericTypes.hpp"
+#include "CameraModel.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <math.h>
+
+/**
+ * /name Azimuth
+ * /brief Returns the azimuth of column "u": half the horizontal field of view left of the centre column.
+ */
+Angle SphericalModel::Azimuth(double u,const CameraIntrinsics& intrinsics) const{
+	int u_c = intrinsics.width / 2;
+	Angle diff_u = ((intrinsics.horizontalFOV / 2) / u_c);
+	return diff_u * (u_c - u);
+}
+
+/**
+ * /name Inclination
+ * /brief Returns the inclination of row "v": the horizon at the centre row, half the vertical field of view 
+ * above and below it.
+ */
+Angle SphericalModel::Inclination(double v,const CameraIntrinsics& intrinsics) const{
+	int v_c = intrinsics.height / 2;
+	Angle diff_v = ((intrinsics.verticalFOV / 2) / v_c);
+	return diff_v * (v - v_c) + (kPi/2);
+}
+
+/**
+ * /name Direction
+ * /brief Computes the direction of pixel position (u,v) from its azimuth and inclination.
+ */
+void SphericalModel::Direction(double u,double v,const CameraIntrinsics& intrinsics,double direction[3]) const{
+	const double azimuth = Azimuth(u,intrinsics).get();
+	const double inclination = Inclination(v,intrinsics).get();
+	direction[0] = sin(inclination) * cos(azimuth);
+	direction[1] = sin(inclination) * sin(azimuth);
+	direction[2] = cos(inclination);
+}
+
+/**
+ * /name Direction
+ * /brief Computes the direction through pixel position (u,v) on the image plane, which is scaled so the centre 
+ * of the edge columns and rows lies at half the field of view.
+ */
+void PinholeModel::Direction(double u,double v,const CameraIntrinsics& intrinsics,double direction[3]) const{
+	const int u_c = intrinsics.width / 2;
+	const int v_c = intrinsics.height / 2;
+	const double y = tan(intrinsics.horizontalFOV.get() / 2) * (u_c - u) / u_c;
+	const double z = tan(intrinsics.verticalFOV.get() / 2) * (v_c - v) / v_c;
+	const double norm = sqrt(1.0 + y*y + z*z);
+	direction[0] = 1.0 / norm;
+	direction[1] = y / norm;
+	direction[2] = z / norm;
+}
+
+/**
+ * /name Direction
+ * /brief Computes the direction of pixel position (u,v), whose angle from the optical axis is proportional to 
+ * its distance from the image centre.
+ */
+void FisheyeModel::Direction(double u,double v,const CameraIntrinsics& intrinsics,double direction[3]) const{
+	const int u_c = intrinsics.width / 2;
+	const int v_c = intrinsics.height / 2;
+	const double y = (intrinsics.horizontalFOV.get() / 2) * (u_c - u) / u_c;
+	const double z = (intrinsics.verticalFOV.get() / 2) * (v_c - v) / v_c;
+	const double theta = sqrt(y*y + z*z);
+	const double scale = (theta > 0.0) ? sin(theta) / theta : 1.0;
+	direction[0] = cos(theta);
+	direction[1] = y * scale;
+	direction[2] = z * scale;
+}
+
+/**
+ * /name DistortionLUTModel
+ * /brief Constructor for DistortionLUTModel class. "table" holds width x height (u,v) pairs, row by row.
+ */
+DistortionLUTModel::DistortionLUTModel(std::shared_ptr<const CameraModel> base,int width,int height,const std::vector<float>& table) : _base(base), _width(width), _height(height), _table(table) {
+	if(_table.size()!=2 * static_cast<size_t>(std::max(0,width)) * static_cast<size_t>(std::max(0,height))){
+		_width = _height = 0;
+		_table.clear();
+	}
+}
+
+/**
+ * /name Load
+ * /brief Loads a distortion table from a text file: the width and height, followed by the ideal (u,v) position
+ * of every pixel, row by row. Returns NULL if the file can't be read.
+ */
+std::shared_ptr<DistortionLUTModel> DistortionLUTModel::Load(std::shared_ptr<const CameraModel> base,const std::string& path){
+	std::ifstream file(path.c_str());
+	int width,height;
+	if(!(file >> width >> height) || width <= 0 || height <= 0) return std::shared_ptr<DistortionLUTModel>();
+	
+	std::vector<float> table(2 * static_cast<size_t>(width) * static_cast<size_t>(height));
+	for(size_t idx=0;idx<table.size();++idx){
+		if(!(file >> table[idx])) return std::shared_ptr<DistortionLUTModel>();
+	}
+	return std::make_shared<DistortionLUTModel>(base,width,height,table);
+}
+
+/**
+ * /name Direction
+ * /brief Looks up the ideal position of the pixel nearest to (u,v), and returns the base model's direction there.
+ */
+void DistortionLUTModel::Direction(double u,double v,const CameraIntrinsics& intrinsics,double direction[3]) const{
+	const long column = lround(u);
+	const long row = lround(v);
+	if(column < 0 || column >= _width || row < 0 || row >= _height){
+		_base->Direction(u,v,intrinsics,direction);
+		return;
+	}
+	const float *ideal = &_table[2 * (static_cast<size_t>(row) * _width + column)];
+	_base->Direction(ideal[0],ideal[1],intrinsics,direction);
+}
+
+/**
+ * /name LidarBeamModel
+ * /brief Constructor for LidarBeamModel class. Takes the elevation of every beam, from the top beam down.
+ */
+LidarBeamModel::LidarBeamModel(const std::vector<Angle>& elevations) : _elevations(elevations) {}
+
+/**
+ * /name Uniform
+ * /brief Returns a model of "numBeams" beams, evenly spaced from elevation "upper" down to "lower".
+ */
+std::shared_ptr<LidarBeamModel> LidarBeamModel::Uniform(int numBeams,Angle upper,Angle lower){
+	std::vector<Angle> elevations;
+	for(int beam=0;beam<numBeams;++beam){
+		elevations.push_back((numBeams > 1) ? upper + (lower - upper) * (static_cast<double>(beam) / (numBeams - 1)) : upper);
+	}
+	return std::make_shared<LidarBeamModel>(elevations);
+}
+
+/**
+ * /name Azimuth
+ * /brief Returns the azimuth of azimuth step "u".
+ */
+Angle LidarBeamModel::Azimuth(double u,const CameraIntrinsics& intrinsics) const{
+	return (intrinsics.width > 0) ? (kPi * 2) * (u / intrinsics.width) : Angle(0.0);
+}
+
+/**
+ * /name Inclination
+ * /brief Returns the inclination (from +z) of beam "v", interpolating between beams and clamping at the outer ones.
+ */
+Angle LidarBeamModel::Inclination(double v,const CameraIntrinsics&) const{
+	if(_elevations.empty()) return kPi/2;
+	const double last = static_cast<double>(_elevations.size() - 1);
+	const double row = std::max(0.0,std::min(v,last));
+	const size_t beam = std::min(static_cast<size_t>(row),_elevations.size() - 1);
+	const size_t next = std::min(beam + 1,_elevations.size() - 1);
+	const Angle elevation = _elevations[beam] + (_elevations[next] - _elevations[beam]) * (row - beam);
+	return (kPi/2) - elevation;
+}
+
+/**
+ * /name Direction
+ * /brief Computes the direction of position (u,v) from its azimuth and inclination.
+ */
+void LidarBeamModel::Direction(double u,double v,const CameraIntrinsics& intrinsics,double direction[3]) const{
+	const double azimuth = Azimuth(u,intrinsics).get();
+	const double inclination = Inclination(v,intrinsics).get();
+	direction[0] = sin(inclination) * cos(azimuth);
+	direction[1] = sin(inclination) * sin(azimuth);
+	direction[2] = cos(inclination);
+}
+
+/**
+ * /name DirectionTable
+ * /brief Constructor for DirectionTable class. Evaluates "model" once per column and row (separable models) or
+ * once per pixel.
+ */
+DirectionTable::DirectionTable(const CameraModel* model,const CameraIntrinsics& intrinsics) : _model(model), _intrinsics(intrinsics), _separable(model->Separable()) {
+	const int width = std::max(0,intrinsics.width);
+	const int height = std::max(0,intrinsics.height);
+	if(_separable){
+		_azimuthCos.resize(width);
+		_azimuthSin.resize(width);
+		for(int u=0;u<width;++u){
+			const double azimuth = model->Azimuth(u,intrinsics).get();
+			_azimuthCos[u] = cos(azimuth);
+			_azimuthSin[u] = sin(azimuth);
+		}
+		_inclinationSin.resize(height);
+		_inclinationCos.resize(height);
+		for(int v=0;v<height;++v){
+			const double inclination = model->Inclination(v,intrinsics).get();
+			_inclinationSin[v] = sin(inclination);
+			_inclinationCos[v] = cos(inclination);
+		}
+		return;
+	}
+	
+	_directions.reserve(static_cast<size_t>(width) * height);
+	for(int v=0;v<height;++v){
+		for(int u=0;u<width;++u){
+			double direction[3];
+			model->Direction(u,v,intrinsics,direction);
+			_directions.push_back(PointF(DistanceF(direction[0]),DistanceF(direction[1]),DistanceF(direction[2])));
+		}
+	}
+}
@@ -22,24 +22,78 @@
 #include "ComputeManager.hpp"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <algorithm>
+#include <cctype>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 ComputeManager *ComputeManager::sharedComputeManager = NULL;
 
-const int kMaxNumDevices = 5;
-const int kMaxNumPlatforms = 5;
+const char *kDeviceVariable = "RAYTRACER_CL_DEVICE";
+const char *kCacheVariable = "RAYTRACER_CL_CACHE";
 
-cl_device_id _devices[kMaxNumDevices];
-cl_platform_id _platforms[kMaxNumPlatforms];
-cl_context _context;
-cl_command_queue _queue;
+/**
+ * /name ContainsNoCase
+ * /brief Returns true if "text" contains "part", ignoring case.
+ */
+static bool ContainsNoCase(std::string text,std::string part){
+    std::transform(text.begin(),text.end(),text.begin(),::tolower);
+    std::transform(part.begin(),part.end(),part.begin(),::tolower);
+    return text.find(part)!=std::string::npos;
+}
+
+/**
+ * /name InfoString
+ * /brief Reads a string property of a platform or device.
+ */
+template<typename Object,typename Info,typename Query>
+static std::string InfoString(Query query,Object object,Info info){
+    size_t length = 0;
+    if(query(object,info,0,NULL,&length)!=CL_SUCCESS || length==0) return std::string();
+    std::vector<char> value(length);
+    if(query(object,info,length,&value[0],NULL)!=CL_SUCCESS) return std::string();
+    return std::string(&value[0]);
+}
+
+/**
+ * /name HashBytes
+ * /brief 64-bit FNV-1a hash, continuing from "hash". Used to key the program cache.
+ */
+static uint64_t HashBytes(const char *data,size_t length,uint64_t hash = 0xcbf29ce484222325ULL){
+    for(size_t idx=0;idx<length;idx++){
+        hash ^= static_cast<unsigned char>(data[idx]);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+ComputeManager::ComputeManager() : _defaultContext(-1), _lastError(CL_SUCCESS), _cacheHits(0), _cacheMisses(0) {
+    //default cache location
+    const char *cache = getenv(kCacheVariable);
+    const char *home = getenv("HOME");
+    if(cache!=NULL && cache[0]!='\0') _cacheDirectory = cache;
+    else if(home!=NULL && home[0]!='\0') _cacheDirectory = std::string(home) + "/.cache/raytracer";
+    
 
-ComputeManager::ComputeManager(){
 	if(ConfigureComputationFramework()==false){
-        std::cout << "Failed to configure computation framework! Exiting..." << std::endl;
-        exit(1);
+        std::cout << "No OpenCL device available (error " << _lastError << "), accelerated rendering is disabled." << std::endl;
+    }
+}
+
+ComputeManager::~ComputeManager(){
+    for(size_t idx=0;idx<_freeBuffers.size();idx++){
+        clReleaseMemObject(_freeBuffers[idx].mem);
+    }
+    for(size_t idx=0;idx<_contexts.size();idx++){
+        clReleaseCommandQueue(_contexts[idx].transferQueue);
+        clReleaseCommandQueue(_contexts[idx].queue);
+        clReleaseContext(_contexts[idx].context);
     }
 }
 
@@ -48,108 +102,508 @@ ComputeManager *ComputeManager::SharedComputeManager(){
 	return sharedComputeManager;
 }
 
+/**
+ * /name ConfigureComputationFramework
+ * /brief Enumerates the devices of all platforms, and opens the default device. Returns false if there is none.
+ */
 bool ComputeManager::ConfigureComputationFramework(){
-    cl_int ret;
-        
     //get available platforms
-    cl_uint platformCount;
-    ret = clGetPlatformIDs(kMaxNumPlatforms,_platforms,&platformCount);
-    if(ret!=CL_SUCCESS) return false;
+    cl_uint platformCount = 0;
+    _lastError = clGetPlatformIDs(0,NULL,&platformCount);
+    if(_lastError!=CL_SUCCESS || platformCount==0) return false;
+    std::vector<cl_platform_id> platforms(platformCount);
+    _lastError = clGetPlatformIDs(platformCount,&platforms[0],NULL);
+    if(_lastError!=CL_SUCCESS) return false;
     
     //get all opencl devices on the system
-    cl_device_type deviceType = CL_DEVICE_TYPE_GPU;
-    cl_uint numDevices;
-    
-    ret = clGetDeviceIDs(_platforms[0],deviceType,kMaxNumDevices,_devices,&numDevices);
-    if(ret!=CL_SUCCESS) return false;
+    for(cl_uint p=0;p<platformCount;p++){
+        cl_uint numDevices = 0;
+        if(clGetDeviceIDs(platforms[p],CL_DEVICE_TYPE_ALL,0,NULL,&numDevices)!=CL_SUCCESS || numDevices==0) continue;
+        std::vector<cl_device_id> devices(numDevices);
+        if(clGetDeviceIDs(platforms[p],CL_DEVICE_TYPE_ALL,numDevices,&devices[0],NULL)!=CL_SUCCESS) continue;
+        
+        std::string platformName = InfoString(clGetPlatformInfo,platforms[p],CL_PLATFORM_NAME);
+        for(cl_uint d=0;d<numDevices;d++){
+            ComputeDevice device;
+            device.platform = platforms[p];
+            device.device = devices[d];
+            device.type = 0;
+            device.computeUnits = 0;
+            clGetDeviceInfo(devices[d],CL_DEVICE_TYPE,sizeof(device.type),&device.type,NULL);
+            clGetDeviceInfo(devices[d],CL_DEVICE_MAX_COMPUTE_UNITS,sizeof(device.computeUnits),&device.computeUnits,NULL);
+            device.name = InfoString(clGetDeviceInfo,devices[d],CL_DEVICE_NAME);
+            device.platformName = platformName;
+            device.version = InfoString(clGetDeviceInfo,devices[d],CL_DEVICE_VERSION) + " " + InfoString(clGetDeviceInfo,devices[d],CL_DRIVER_VERSION);
+            cl_bool unified = CL_FALSE;
+            clGetDeviceInfo(devices[d],CL_DEVICE_HOST_UNIFIED_MEMORY,sizeof(unified),&unified,NULL);
+            device.hostUnifiedMemory = (unified==CL_TRUE);
+            _devices.push_back(device);
+        }
+    }
     
     //print device info if required
     #ifdef DEBUG
-    char name[50];
-    for(int idx=0;idx<numDevices;idx++){
-
-        ret = clGetDeviceInfo(_devices[idx],CL_DEVICE_NAME,(size_t)50,(void*)name,NULL);
-        printf("Device name: %s \n", name);
+    for(size_t idx=0;idx<_devices.size();idx++){
+        printf("Device name: %s (%s, %u compute units)\n",_devices[idx].name.c_str(),_devices[idx].platformName.c_str(),_devices[idx].computeUnits);
     }
     #endif
+    
+    if(_devices.empty()){
+        _lastError = CL_DEVICE_NOT_FOUND;
+        return false;
+    }
+    
+    //the environment overrides the default device
+    const char *request = getenv(kDeviceVariable);
+    if(request!=NULL && request[0]!='\0'){
+        std::string value(request);
+        if(ContainsNoCase(value,"gpu")) return SelectDevice(CL_DEVICE_TYPE_GPU);
+        if(ContainsNoCase(value,"cpu")) return SelectDevice(CL_DEVICE_TYPE_CPU);
+        if(ContainsNoCase(value,"accelerator")) return SelectDevice(CL_DEVICE_TYPE_ACCELERATOR);
+        return SelectDevice(CL_DEVICE_TYPE_ALL,value);
+    }
+    
+    //otherwise prefer a GPU, then an accelerator, then fall back to a CPU device
+    const cl_device_type preference[] = {CL_DEVICE_TYPE_GPU,CL_DEVICE_TYPE_ACCELERATOR,CL_DEVICE_TYPE_CPU,CL_DEVICE_TYPE_ALL};
+    for(size_t idx=0;idx<sizeof(preference)/sizeof(preference[0]);idx++){
+        if(SelectDevice(preference[idx])) return true;
+    }
+    return false;
+}
+
+/**
+ * /name FindDevice
+ * /brief Finds the first device of the given type (CL_DEVICE_TYPE_ALL for any) whose device or platform name
+ * contains "name" (ignoring case, empty matches all). Returns false if there is none.
+ */
+bool ComputeManager::FindDevice(cl_device_type type,const std::string& name,size_t *device) const{
+    for(size_t idx=0;idx<_devices.size();idx++){
+        if((_devices[idx].type & type)==0) continue;
+        if(!name.empty() && !ContainsNoCase(_devices[idx].name,name) && !ContainsNoCase(_devices[idx].platformName,name)) continue;
+        *device = idx;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * /name OpenDevice
+ * /brief Creates a context and command queues on device number "device" of Devices(). Returns the number of the new
+ * context, which can be passed to the other calls to use several devices at once.
+ */
+bool ComputeManager::OpenDevice(size_t device,int *context){
+    if(device>=_devices.size()){
+        _lastError = CL_INVALID_DEVICE;
+        return false;
+    }
+    
+    ComputeContext opened;
+    opened.device = device;
+    
+    cl_context_properties properties[] = {CL_CONTEXT_PLATFORM,(cl_context_properties)_devices[device].platform,0};
+    opened.context = clCreateContext(properties,1,&_devices[device].device,NULL,NULL,&_lastError);
+    if(_lastError!=CL_SUCCESS) return false;
+    
+    // Command-queues
+    opened.queue = clCreateCommandQueue(opened.context,_devices[device].device,0,&_lastError);
+    if(_lastError!=CL_SUCCESS){
+        clReleaseContext(opened.context);
+        return false;
+    }
+    opened.transferQueue = clCreateCommandQueue(opened.context,_devices[device].device,0,&_lastError);
+    if(_lastError!=CL_SUCCESS){
+        clReleaseCommandQueue(opened.queue);
+        clReleaseContext(opened.context);
+        return false;
+    }
+    
+    _contexts.push_back(opened);
+    *context = static_cast<int>(_contexts.size()-1);
+    return true;
+}
+
+/**
+ * /name SelectDevice
+ * /brief Opens the first device matching the type and name (see FindDevice), and makes it the default context.
+ */
+bool ComputeManager::SelectDevice(cl_device_type type,const std::string& name){
+    size_t device;
+    if(!FindDevice(type,name,&device)){
+        _lastError = CL_DEVICE_NOT_FOUND;
+        return false;
+    }
+    
+    //reuse the context if the device is already open
+    for(size_t idx=0;idx<_contexts.size();idx++){
+        if(_contexts[idx].device==device){
+            _defaultContext = static_cast<int>(idx);
+            return true;
+        }
+    }
+    
+    int context;
+    if(!OpenDevice(device,&context)) return false;
+    _defaultContext = context;
+    return true;
+}
+
+/**
+ * /name ContextAt
+ * /brief Returns opened context number "context" (kDefaultContext for the default one), or NULL if there is none.
+ */
+const ComputeContext* ComputeManager::ContextAt(int context){
+    if(context==kDefaultContext) context = _defaultContext;
+    if(context<0 || context>=static_cast<int>(_contexts.size())){
+        _lastError = CL_INVALID_CONTEXT;
+        return NULL;
+    }
+    return &_contexts[context];
+}
+
+bool ComputeManager::AllocateBufferOfSize(size_t size,cl_mem *deviceMem,void *hostMem,int mode,int context){
+    *deviceMem = NULL;
+    const ComputeContext *opened = ContextAt(context);
+    if(opened==NULL) return false;
+
+    //create device buffer
+    (*deviceMem) = clCreateBuffer(opened->context,mode,size,hostMem,&_lastError);
+    
+    //if errors were encountered, make sure we can't use the mem pointer
+    if(_lastError!=CL_SUCCESS){
+        printf("Error: failed allocate cl_mem %d\n", _lastError);
+        *deviceMem = NULL;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * /name SizeClass
+ * /brief Rounds a buffer size up to its pool size class: powers of two, split in four steps (at most 25% waste),
+ * with a minimum of 64 KB.
+ */
+size_t ComputeManager::SizeClass(size_t size){
+    const size_t kMinClass = 64*1024;
+    if(size<=kMinClass) return kMinClass;
+    
+    size_t power = kMinClass;
+    while(power*2 < size) power *= 2;
+    size_t step = power/4;
+    return ((size + step - 1)/step)*step;
+}
 
+/**
+ * /name AcquireBuffer
+ * /brief Hands out a buffer of at least "size" bytes, with the given cl_mem_flags, from the pool of "context". Only
+ * allocates when the pool holds no free buffer of the same size class. Host pointer flags other than
+ * CL_MEM_ALLOC_HOST_PTR are not supported, use AllocateBufferOfSize for those.
+ */
+bool ComputeManager::AcquireBuffer(size_t size,int mode,DeviceBuffer *buffer,int context){
+    buffer->Release();
+    if(mode & (CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR)){
+        _lastError = CL_INVALID_VALUE;
+        return false;
+    }
+    if(context==kDefaultContext) context = _defaultContext;
+    const ComputeContext *opened = ContextAt(context);
+    if(opened==NULL) return false;
     
-    _context = clCreateContext(NULL, 1, _devices, NULL, NULL, &ret);
-    if (ret != CL_SUCCESS) return ret;
+    const size_t capacity = SizeClass(size);
+    cl_mem mem = NULL;
+    {
+        std::lock_guard<std::mutex> guard(_poolLock);
+        for(size_t idx=0;idx<_freeBuffers.size();idx++){
+            const PooledBuffer& pooled = _freeBuffers[idx];
+            if(pooled.context!=context || pooled.mode!=mode || pooled.capacity!=capacity) continue;
+            mem = pooled.mem;
+            _freeBuffers.erase(_freeBuffers.begin() + idx);
+            break;
+        }
+    }
     
-    // Command-queue
-    _queue = clCreateCommandQueue(_context, _devices[0], 0, &ret);
-    if (ret != CL_SUCCESS) return ret;
+    //nothing to reuse, so allocate
+    if(mem==NULL){
+        mem = clCreateBuffer(opened->context,mode,capacity,NULL,&_lastError);
+        if(_lastError!=CL_SUCCESS){
+            printf("Error: failed allocate cl_mem %d\n", _lastError);
+            return false;
+        }
+    }
+    
+    buffer->_manager = this;
+    buffer->_mem = mem;
+    buffer->_size = size;
+    buffer->_capacity = capacity;
+    buffer->_mode = mode;
+    buffer->_context = context;
     return true;
 }
 
-void ComputeManager::AllocateBufferOfSize(size_t size,cl_mem *deviceMem,void *hostMem, int mode){
-    cl_int error;
+/**
+ * /name ReturnBuffer
+ * /brief Puts the buffer of a handle back in the pool.
+ */
+void ComputeManager::ReturnBuffer(DeviceBuffer& buffer){
+    PooledBuffer pooled;
+    pooled.mem = buffer._mem;
+    pooled.capacity = buffer._capacity;
+    pooled.mode = buffer._mode;
+    pooled.context = buffer._context;
+    
+    std::lock_guard<std::mutex> guard(_poolLock);
+    _freeBuffers.push_back(pooled);
+}
+
+/**
+ * /name MapBuffer
+ * /brief Maps the buffer into host memory (blocking), returning NULL on failure. For pinned buffers and devices that
+ * share host memory, this gives direct access without a copy. Every map must be followed by UnmapBuffer.
+ */
+void* ComputeManager::MapBuffer(const DeviceBuffer& buffer,cl_map_flags flags){
+    cl_command_queue queue = CommandQueue(buffer._context);
+    if(queue==NULL || !buffer.IsValid()) return NULL;
+    
+    void *host = clEnqueueMapBuffer(queue,buffer._mem,CL_TRUE,flags,0,buffer._size,0,NULL,NULL,&_lastError);
+    return (_lastError==CL_SUCCESS) ? host : NULL;
+}
+
+/**
+ * /name UnmapBuffer
+ * /brief Unmaps a buffer mapped by MapBuffer, handing its contents back to the device.
+ */
+bool ComputeManager::UnmapBuffer(const DeviceBuffer& buffer,void *host){
+    cl_command_queue queue = CommandQueue(buffer._context);
+    if(queue==NULL) return false;
+    
+    _lastError = clEnqueueUnmapMemObject(queue,buffer._mem,host,0,NULL,NULL);
+    return _lastError==CL_SUCCESS;
+}
+
+/**
+ * /name HostUnifiedMemory
+ * /brief Returns true if the device of "context" shares memory with the host (CPU and integrated devices), in which
+ * case mapping a buffer is cheaper than copying it.
+ */
+bool ComputeManager::HostUnifiedMemory(int context){
+    const ComputeContext *opened = ContextAt(context);
+    return (opened!=NULL) && _devices[opened->device].hostUnifiedMemory;
+}
+
+/**
+ * /name DeviceBuffer
+ * /brief Move constructor, takes over the buffer of "other".
+ */
+DeviceBuffer::DeviceBuffer(DeviceBuffer&& other) : _manager(other._manager), _mem(other._mem), _size(other._size), _capacity(other._capacity), _mode(other._mode), _context(other._context) {
+    other._mem = NULL;
+    other._manager = NULL;
+}
+
+/**
+ * /name operator=
+ * /brief Move assignment, returns the current buffer to the pool and takes over the buffer of "other".
+ */
+DeviceBuffer& DeviceBuffer::operator= (DeviceBuffer&& other){
+    if(this!=&other){
+        Release();
+        _manager = other._manager;
+        _mem = other._mem;
+        _size = other._size;
+        _capacity = other._capacity;
+        _mode = other._mode;
+        _context = other._context;
+        other._mem = NULL;
+        other._manager = NULL;
+    }
+    return *this;
+}
+
+/**
+ * /name Release
+ * /brief Returns the buffer to the pool, leaving the handle empty.
+ */
+void DeviceBuffer::Release(){
+    if(_mem!=NULL && _manager!=NULL) _manager->ReturnBuffer(*this);
+    _mem = NULL;
+    _manager = NULL;
+    _size = 0;
+}
 
-    //create gpu buffer
-    (*deviceMem) = clCreateBuffer(_context,mode,size,hostMem,&error);
+/**
+ * /name CachePath
+ * /brief Returns the cache file for a program built from "source" with "options" for "device". Empty if caching is
+ * disabled.
+ */
+std::string ComputeManager::CachePath(const std::vector<char>& source,const std::string& options,const ComputeDevice& device) const{
+    if(_cacheDirectory.empty()) return std::string();
+    
+    //anything that changes the binary must change the key
+    uint64_t hash = HashBytes(&source[0],source.size());
+    const std::string key[] = {options,device.name,device.platformName,device.version};
+    for(size_t idx=0;idx<sizeof(key)/sizeof(key[0]);idx++){
+        hash = HashBytes(key[idx].c_str(),key[idx].size()+1,hash);
+    }
     
-    //if errors were encountered, make sure we can't use the mem pointers
-    if(error!=CL_SUCCESS){
-        printf("Error: failed allocate cl_mem %d\n", error);
+    std::stringstream ss;
+    ss << _cacheDirectory << "/" << std::hex << hash << ".clbin";
+    return ss.str();
+}
 
-        deviceMem = NULL;
-        hostMem = NULL;
+/**
+ * /name LoadCachedProgram
+ * /brief Creates and builds a program from the binary cached at "path". Returns NULL if there is no usable binary,
+ * e.g. because the driver no longer accepts it.
+ */
+cl_program ComputeManager::LoadCachedProgram(const std::string& path,cl_context context,cl_device_id device,const std::string& options){
+    std::ifstream binaryFile(path.c_str(),std::ios_base::in | std::ios_base::binary);
+    if(binaryFile.fail()) return NULL;
+    
+    binaryFile.seekg(0,std::ios::end);
+    size_t length = binaryFile.tellg();
+    binaryFile.seekg(0,std::ios::beg);
+    if(length==0) return NULL;
+    
+    std::vector<unsigned char> binary(length);
+    binaryFile.read(reinterpret_cast<char*>(&binary[0]),length);
+    if(binaryFile.fail()) return NULL;
+    
+    //binaries still need to be built, which is cheap
+    const unsigned char *binaryData = &binary[0];
+    cl_int status, error;
+    cl_program prog = clCreateProgramWithBinary(context,1,&device,&length,&binaryData,&status,&error);
+    if(error!=CL_SUCCESS || status!=CL_SUCCESS){
+        if(prog!=NULL) clReleaseProgram(prog);
+        return NULL;
+    }
+    
+    if(clBuildProgram(prog,1,&device,options.c_str(),NULL,NULL)!=CL_SUCCESS){
+        clReleaseProgram(prog);
+        return NULL;
     }
+    return prog;
 }
 
-bool ComputeManager::BuildKernelFromFile(const std::string sourceFilePath,const std::string kernelName,cl_kernel *kernel){
-	char *sourceString = NULL;
-	size_t length = 0;
-    cl_int error;
+/**
+ * /name StoreCachedProgram
+ * /brief Writes the binary of a built (single device) program to "path". Failures only cost the next start-up time,
+ * so they are ignored.
+ */
+void ComputeManager::StoreCachedProgram(const std::string& path,cl_program program){
+    size_t length = 0;
+    if(clGetProgramInfo(program,CL_PROGRAM_BINARY_SIZES,sizeof(length),&length,NULL)!=CL_SUCCESS || length==0) return;
+    
+    std::vector<unsigned char> binary(length);
+    unsigned char *binaryData = &binary[0];
+    if(clGetProgramInfo(program,CL_PROGRAM_BINARIES,sizeof(binaryData),&binaryData,NULL)!=CL_SUCCESS) return;
+    
+    //create the cache directory (and its parent) if needed
+    size_t parent = _cacheDirectory.find_last_of('/');
+    if(parent!=std::string::npos && parent>0) mkdir(_cacheDirectory.substr(0,parent).c_str(),0755);
+    mkdir(_cacheDirectory.c_str(),0755);
+    
+    //write to a temporary file first, so concurrent processes never load a partial binary
+    std::stringstream ss;
+    ss << path << "." << getpid() << ".tmp";
+    std::ofstream binaryFile(ss.str().c_str(),std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if(binaryFile.fail()) return;
+    binaryFile.write(reinterpret_cast<const char*>(&binary[0]),length);
+    binaryFile.close();
+    if(binaryFile.fail() || rename(ss.str().c_str(),path.c_str())!=0) remove(ss.str().c_str());
+}
+
+/**
+ * /name BuildKernelFromFile
+ * /brief Builds kernel "kernelName" from the source file for the device of "context". Loads the program from the
+ * binary cache when possible, otherwise builds it from source and caches the binary. Returns false on failure.
+ */
+bool ComputeManager::BuildKernelFromFile(const std::string sourceFilePath,const std::string kernelName,cl_kernel *kernel,int context,std::string options){
+    size_t length = 0;
+    
+    const ComputeContext *opened = ContextAt(context);
+    if(opened==NULL) return false;
+    cl_device_id device = _devices[opened->device].device;
     
     /* Step 1: Load the file
      * First, we open a new file, and check if it is valid */
     std::ifstream sourceFileStream(sourceFilePath.c_str(),std::ios_base::in);
-    if(sourceFileStream.fail()) return false;
+    if(sourceFileStream.fail()){
+        _lastError = CL_INVALID_VALUE;
+        return false;
+    }
 
     //we get length of file
     sourceFileStream.seekg(0,std::ios::end);
     length  = sourceFileStream.tellg();
     sourceFileStream.seekg(0,std::ios::beg);
     
-    
     //we read in the entire sourcefile
-    sourceString = new char[length];
-    if(sourceString==NULL) return false;
-    
-    sourceFileStream.read(sourceString,length);
+    std::vector<char> source(length+1,'\0');
+    sourceFileStream.read(&source[0],length);
     sourceFileStream.close();
     
-    //Step 2 & 3: Create & build program from source string (using the first context)
-    cl_program prog = clCreateProgramWithSource(_context,1,(const char**)&sourceString,&length,&error);
-    if(error!=CL_SUCCESS) return false;
-    
-    error = clBuildProgram(prog, 1, &_devices[0], NULL, NULL, NULL);
-    if(error!=CL_SUCCESS){
-        //Show results of build
-        // Shows the log
-        char* build_log;
-        size_t log_size;
-
-        //Get the size for the buffer that must hold the build results
-        clGetProgramBuildInfo(prog, _devices[0], CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-        build_log = new char[log_size+1];
-
-        //Get the build results
-        clGetProgramBuildInfo(prog,_devices[0], CL_PROGRAM_BUILD_LOG,log_size,build_log,NULL);
-        build_log[log_size] = '\0';
-        std::cout << build_log << std::endl;
-        return false;
+    //Step 2: Try the program cache
+    std::string cachePath = CachePath(source,options,_devices[opened->device]);
+    cl_program prog = NULL;
+    if(!cachePath.empty()) prog = LoadCachedProgram(cachePath,opened->context,device,options);
+    
+    if(prog!=NULL){
+        _cacheHits++;
+        #ifdef DEBUG
+        printf("Kernel cache hit: %s\n",cachePath.c_str());
+        #endif
+    } else {
+        _cacheMisses++;
+        #ifdef DEBUG
+        printf("Kernel cache miss: %s\n",cachePath.c_str());
+        #endif
+        
+        //Step 3 & 4: Create & build program from source string
+        const char *sourceString = &source[0];
+        prog = clCreateProgramWithSource(opened->context,1,&sourceString,&length,&_lastError);
+        if(_lastError!=CL_SUCCESS) return false;
+        
+        _lastError = clBuildProgram(prog, 1, &device, options.c_str(), NULL, NULL);
+        if(_lastError!=CL_SUCCESS){
+            //Show results of build
+            // Shows the log
+            size_t log_size = 0;
+
+            //Get the size for the buffer that must hold the build results
+            clGetProgramBuildInfo(prog, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+            std::vector<char> build_log(log_size+1,'\0');
+
+            //Get the build results
+            clGetProgramBuildInfo(prog, device, CL_PROGRAM_BUILD_LOG,log_size,&build_log[0],NULL);
+            std::cout << &build_log[0] << std::endl;
+            clReleaseProgram(prog);
+            return false;
+        }
+        
+        if(!cachePath.empty()) StoreCachedProgram(cachePath,prog);
     }
 
-    //Create the kernel
-    *kernel = clCreateKernel(prog,kernelName.c_str(),&error);
-    if(error!=CL_SUCCESS) return false;
+    //Create the kernel (it keeps the program alive)
+    *kernel = clCreateKernel(prog,kernelName.c_str(),&_lastError);
+    clReleaseProgram(prog);
+    if(_lastError!=CL_SUCCESS) return false;
 	return true;
 }
 
-cl_command_queue  ComputeManager::CommandQueue(){
-    return _queue;
+cl_command_queue  ComputeManager::CommandQueue(int context){
+    const ComputeContext *opened = ContextAt(context);
+    return (opened==NULL) ? NULL : opened->queue;
 }
 
+cl_command_queue  ComputeManager::TransferQueue(int context){
+    const ComputeContext *opened = ContextAt(context);
+    return (opened==NULL) ? NULL : opened->transferQueue;
+}
+
+cl_context  ComputeManager::Context(int context){
+    const ComputeContext *opened = ContextAt(context);
+    return (opened==NULL) ? NULL : opened->context;
+}
+
+cl_device_id  ComputeManager::Device(int context){
+    const ComputeContext *opened = ContextAt(context);
+    return (opened==NULL) ? NULL : _devices[opened->device].device;
+}
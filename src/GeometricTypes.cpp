@@ -10,6 +10,30 @@ Point AzInclRangeToXYZ(Angle az, Angle incl, Distance r){
 }
 
 Point RotateXYZ(Point p,Angle pitch, Angle roll, Angle yaw){
-    
-    return p;
+    double rotation[3][3];
+    RotationMatrix(Orientation(roll,pitch,yaw),rotation);
+    const double v[3] = {p.x.get(),p.y.get(),p.z.get()};
+    return Point(Distance(rotation[0][0]*v[0] + rotation[0][1]*v[1] + rotation[0][2]*v[2]),
+                 Distance(rotation[1][0]*v[0] + rotation[1][1]*v[1] + rotation[1][2]*v[2]),
+                 Distance(rotation[2][0]*v[0] + rotation[2][1]*v[1] + rotation[2][2]*v[2]));
+}
+
+/**
+ * /name RotationMatrix
+ * /brief Returns the rotation from a body frame (camera, sensor) to the scene frame: roll about x, then pitch 
+ * about y, then yaw about z.
+ */
+void RotationMatrix(const Orientation& orientation,double rotation[3][3]){
+	const double cr = cos(orientation.roll.get()), sr = sin(orientation.roll.get());
+	const double cp = cos(orientation.pitch.get()), sp = sin(orientation.pitch.get());
+	const double cy = cos(orientation.yaw.get()), sy = sin(orientation.yaw.get());
+	rotation[0][0] = cy*cp;
+	rotation[0][1] = cy*sp*sr - sy*cr;
+	rotation[0][2] = cy*sp*cr + sy*sr;
+	rotation[1][0] = sy*cp;
+	rotation[1][1] = sy*sp*sr + cy*cr;
+	rotation[1][2] = sy*sp*cr - cy*sr;
+	rotation[2][0] = -sp;
+	rotation[2][1] = cp*sr;
+	rotation[2][2] = cp*cr;
 }
\ No newline at end of file
@@ -23,22 +23,32 @@
 #include "Camera.hpp"
 #include "GenericTypes.hpp"
 #include "GeometricTypes.hpp"
+#include "BlockingQueue.hpp"
+#include "Trajectory.hpp"
 
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <atomic>
 #include <thread>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
 #include <png.h>
  
 const std::string kVersionString = "v0.2";
 const Distance kRayLength = 5.0_m;
-const int kNumThreads = 16;
+const int kTileSize = 32;
+const int kFiringBlock = 16;
+const char kSceneVariable[] = "RAYTRACER_SCENE";
+const char kChannelsVariable[] = "RAYTRACER_CHANNELS";
+const char kDeviceFramesVariable[] = "RAYTRACER_DEVICE_FRAMES";
  
- int main(int argc, char**arv){
-	//print welcome message
-	std::cout << "RayTracer " << kVersionString << " by Erik E. Beerepoot" << std::endl;
-	
-	//Construct scene
-	Scene scene(Size(4.0_m,4.0_m,2.0_m));
+ /**
+  * /name 	BuildScene
+  * /brief	Adds the test scene (a wall with a zebra stripe target) to "scene".
+  */
+static void BuildScene(Scene& scene){
     pixel_t color;
     color.red = 136;
     color.green = 136;
@@ -63,6 +73,9 @@ const int kNumThreads = 16;
 	scene.AddPlane(Point(3.0_m,1.5_m,0.5_m),Point(3.0_m,1.6_m,1.5_m),color);
 	scene.AddPlane(Point(3.0_m,1.7_m,0.5_m),Point(3.0_m,1.8_m,1.5_m),color);
 	scene.AddPlane(Point(3.0_m,1.9_m,0.5_m),Point(3.0_m,2.0_m,1.5_m),color);
+	
+	//Lets rays leap through the empty space in the scene
+	scene.BuildDistanceField();
      
 // ***************************************
 //             VICON LAB SIM
@@ -101,6 +114,19 @@ const int kNumThreads = 16;
 //	color.green = 200;
 //	color.blue = 200;
 //	scene.AddPlane(Point(3.99_m,0.0_m,0.0_m),Point(3.99_m,2.49_m,2.0_m),color);
+}
+
+ int main(int argc, char**arv){
+	//print welcome message
+	std::cout << "RayTracer " << kVersionString << " by Erik E. Beerepoot" << std::endl;
+	
+	//Construct scene, or load it from the scene file named by RAYTRACER_SCENE (saving it there if missing)
+	Scene scene(Size(4.0_m,4.0_m,2.0_m));
+	const char *sceneFile = getenv(kSceneVariable);
+	if(sceneFile==NULL || scene.Load(sceneFile)!=SUCCESS){
+		BuildScene(scene);
+		if(sceneFile!=NULL && scene.Save(sceneFile)!=SUCCESS) std::cout << "Failed to save scene " << sceneFile << std::endl;
+	}
 		
 	//Create camera
 	Point camCentre(0.0_m,1.5_m,1.0_m);
@@ -111,35 +137,114 @@ const int kNumThreads = 16;
 	//Render the scene
     //ImageRenderer renderer("c:\\RayTracer\\output\\");
     ImageRenderer renderer("~");
+    
+    //Extra output channels are listed in RAYTRACER_CHANNELS, e.g. "depth,normal"
+    const char *channelList = getenv(kChannelsVariable);
+    if(channelList!=NULL){
+        unsigned int channels;
+        if(ParseOutputChannels(channelList,channels)!=SUCCESS){
+            std::cout << "Unknown output channel in " << channelList << std::endl;
+            return ERROR;
+        }
+        renderer.SetOutputChannels(channels);
+    }
+    
+    //Batch mode: render the camera along a trajectory file, the scene is only built once. An optional second 
+    //argument selects the output format (png, ppm, pfm, raw or y4m)
+    if(argc > 2){
+        ImageFormat format;
+        if(ParseImageFormat(arv[2],format)!=SUCCESS){
+            std::cout << "Unknown output format " << arv[2] << std::endl;
+            return ERROR;
+        }
+        renderer.SetOutputFormat(format);
+    }
+    if(argc > 1){
+        Trajectory trajectory;
+        if(trajectory.Load(arv[1])!=SUCCESS){
+            std::cout << "Failed to read trajectory " << arv[1] << std::endl;
+            return ERROR;
+        }
+        return renderer.RenderTrajectory(scene,cam,trajectory);
+    }
+    
+    //Device mode: RAYTRACER_DEVICE_FRAMES=<n> renders n frames of the moving camera on the OpenCL device, with
+    //compute, read back and encode pipelined
+    const char *deviceFrames = getenv(kDeviceFramesVariable);
+    if(deviceFrames!=NULL){
+        AcceleratedPinholeCamera deviceCam(camCentre,camOrientation,camVelocity);
+        return renderer.RenderSequence(scene,&deviceCam,atoi(deviceFrames));
+    }
 
-    renderer.RenderScene(scene,&cam);
-	return SUCCESS;
+    return renderer.RenderScene(scene,&cam);
  }
  
  /** 
   * /name 	ImageRenderer
   * /brief	Constructor for ImageRenderer. Takes the destination image path as a parameter.
   * /param	destImagePath - The path of the image to be rendered to.
+  * /param	numThreads - The number of rendering threads, 0 uses one thread per core.
   */
- ImageRenderer::ImageRenderer(std::string destPath) : _outputPath(destPath){}
+ ImageRenderer::ImageRenderer(std::string destPath,unsigned int numThreads) : _outputPath(destPath), _format(PNG_FORMAT), _channels(0), _threadPool(numThreads){}
+
+/**
+ * /name	CreateImage
+ * /brief	Creates the output image for frame "frameNumber" (counting from 1) in the selected output format: 
+ * <name>-<frameNumber>.<ext>, or frame frameNumber-1 of <name>.y4m for video. The caller owns the image.
+ * /param	encodeThreads - The number of threads a PNG is compressed with.
+ */
+Bitmap* ImageRenderer::CreateImage(long frameNumber,int height,int width,int framerate,unsigned int encodeThreads,const std::string& name){
+	std::stringstream ss;
+	ss << _outputPath << name;
+	if(_format==Y4M_FORMAT){
+		ss << ImageExtension(_format);
+		return new Y4MImage(ss.str(),height,width,frameNumber - 1,framerate);
+	}
+	
+	ss << "-" << frameNumber << ImageExtension(_format);
+	switch(_format){
+		case PPM_FORMAT: return new PPMImage(ss.str(),height,width);
+		case PFM_FORMAT: return new PFMImage(ss.str(),height,width);
+		case RAW_FORMAT: return new RawImage(ss.str(),height,width);
+		default: {
+			PNGImage *img = new PNGImage(ss.str(),height,width);
+			PNGSettings settings;
+			settings.numThreads = encodeThreads;
+			img->SetSettings(settings);
+			return img;
+		}
+	}
+}
+
+/**
+ * /name	CreateChannels
+ * /brief	Creates the selected output channels of frame "frameNumber", written as <name>-<channel>-<frameNumber>.pfm,
+ * or returns NULL if no channels are selected. The caller owns the channels.
+ */
+ChannelImage* ImageRenderer::CreateChannels(long frameNumber,int height,int width,const std::string& name){
+	if(_channels==0) return NULL;
+	std::stringstream ss;
+	ss << "-" << frameNumber << ".pfm";
+	return new ChannelImage(_outputPath + name,ss.str(),height,width,_channels);
+}
 
  /** 
   * /name 	RenderScene (overloaded method)
   * /brief	Renders the scene to an image. Returns 0 on success.
   * /param	scene - The scene object to render.
   * /param	camera - The camera object used to view the scene.
-  * /notes	Side effect: Creates image containing rendering for each camera, appending a sequence number.  
+  * /notes	Side effect: Creates image containing rendering for each camera, appending a sequence number, and a PFM 
+  * file for each selected output channel (see SetOutputChannels).  
   */
 
 int ImageRenderer::RenderScene(const Scene& scene,PinholeCamera* camera){
 	static long renderNum = 1;	
 	
-	//Create output path
-	std::stringstream ss;
-	ss << _outputPath << "render-" << renderNum << ".png";
-	
-	//Create output image
-	PNGImage img(ss.str(),480,640);
+	//Create output image. A single frame leaves the pool idle while encoding, so a PNG is deflated on every thread
+	const int width = camera->sensor.resolution.horizontal;
+	const int height = camera->sensor.resolution.vertical;
+	std::unique_ptr<Bitmap> img(CreateImage(renderNum,height,width,camera->framerate,_threadPool.NumThreads()));
+	std::unique_ptr<ChannelImage> channels(CreateChannels(renderNum,height,width));
     
 	/* 
 	* For every pixel:
@@ -149,53 +254,310 @@ int ImageRenderer::RenderScene(const Scene& scene,PinholeCamera* camera){
 	pixel_t emptyPix;
 	emptyPix.red = 255;
     
-    for(int y=0;y < camera->sensor.resolution.vertical;y+=1){
-		for(int x=0;x < camera->sensor.resolution.horizontal;x+=1){
-            //generate ray trajectory
-            std::vector<Point> points = camera->TraceRay(x,y,kRayLength);
-            
-            //update camera position
-            camera->UpdatePosition();
-                                   
-            //Check for intersection with scene, write to image
-            img.SetPixel(x,y,scene.CheckPoints(points));
-		}
-	}
-	int result = img.Write();
+    //Every pixel computes its own (rolling shutter) pose, so the frame can be rendered out of order
+    camera->UpdateDirections();
+    RenderTiles(scene,*camera,*img,channels.get());
+    
+    //Move the camera on to the start of the next frame
+    camera->AdvanceFrame();
+    
+	int result = img->Write();
+	if(channels && channels->Write()!=SUCCESS) result = ERROR;
 
-	return SUCCESS;
+	return result;
 }
 
-void ThreadedTraceRay(int x,int y,const Scene &scene,const PinholeCamera* phc,PNGImage *img){
+/**
+ * /name	RenderTiles
+ * /brief	Renders the image in tiles of kTileSize x kTileSize pixels, spread over the thread pool. Rays are traced
+ * in packets, using the widest instruction set the CPU supports.
+ * /notes	Tiles write disjoint pixels, so no locking is needed. The camera is not modified.
+ */
+void ImageRenderer::RenderTiles(const Scene& scene,const PinholeCamera& camera,Bitmap& img,ChannelImage* channels){
+	const int width = camera.sensor.resolution.horizontal;
+	const int height = camera.sensor.resolution.vertical;
+	const int tilesX = (width + kTileSize - 1) / kTileSize;
+	const int tilesY = (height + kTileSize - 1) / kTileSize;
+	
+	_threadPool.Run(static_cast<size_t>(tilesX*tilesY),[&](size_t tile){
+		RenderTile(scene,camera,img,static_cast<int>(tile % tilesX) * kTileSize,static_cast<int>(tile / tilesX) * kTileSize,channels);
+	});
+}
 
+/**
+ * /name	RenderTile
+ * /brief	Renders the tile of kTileSize x kTileSize pixels whose top left pixel is (x0,y0). Rays are traced in 
+ * packets, using the widest instruction set the CPU supports.
+ * /notes	If "channels" isn't NULL, the traversal returns full hit records, and the output channels are filled in 
+ * the same pass.
+ */
+void ImageRenderer::RenderTile(const Scene& scene,const PinholeCamera& camera,Bitmap& img,int x0,int y0,ChannelImage* channels){
+	const int width = camera.sensor.resolution.horizontal;
+	const int height = camera.sensor.resolution.vertical;
+	const int x1 = std::min(x0 + kTileSize,width);
+	const int packetSize = PacketWidth(SelectedPacketISA());
+	
+	//Trace each row of the tile in packets of neighbouring pixels
+	RayPacket packet;
+	pixel_t hits[kMaxPacketSize];
+	HitRecord records[kMaxPacketSize];
+	for(int y=y0;y < std::min(y0 + kTileSize,height);++y){
+		for(int x=x0;x < x1;x+=packetSize){
+			camera.CastPacket(x,y,std::min(packetSize,x1 - x),kRayLength,packet);
+			scene.CheckPacket(packet,hits,(channels!=NULL) ? records : NULL);
+			for(int lane=0;lane<packet.size;++lane){
+				img.SetPixel(x + lane,y,hits[lane]);
+				if(channels!=NULL) channels->SetHit(x + lane,y,records[lane]);
+			}
+		}
+	}
 }
 
+/**
+ * /name	RenderTrajectory
+ * /brief	Renders a camera following "trajectory", from its first to its last pose, at the camera's frame rate. 
+ * Writes render-1.png, render-2.png, ... (or the selected output format), and render-<channel>-1.pfm, ... for the 
+ * selected output channels. Returns 0 on success.
+ * /param	camera - The camera used to view the scene. Its pose is ignored, and it is not modified.
+ * /notes	Frames are independent, so whole frames (rendering and encoding) are spread over the thread pool, each 
+ * worker using its own copy of the camera. Within a frame, the camera moves (rolling shutter) with the mean 
+ * velocity of the trajectory during the frame.
+ */
+int ImageRenderer::RenderTrajectory(const Scene& scene,const PinholeCamera& camera,const Trajectory& trajectory){
+	if(trajectory.Size()==0 || camera.framerate <= 0) return ERROR;
+	
+	const int width = camera.sensor.resolution.horizontal;
+	const int height = camera.sensor.resolution.vertical;
+	const int tilesX = (width + kTileSize - 1) / kTileSize;
+	const int tilesY = (height + kTileSize - 1) / kTileSize;
+	const Time start = trajectory.StartTime();
+	
+	//Frames go to their own place in the video stream, so start a new stream
+	if(_format==Y4M_FORMAT) remove((_outputPath + "render" + ImageExtension(_format)).c_str());
+	const double duration = trajectory.EndTime().get() - start.get();
+	const long numFrames = static_cast<long>(floor(duration * camera.framerate + 1e-9)) + 1;
+	
+	std::atomic<bool> failed(false);
+	_threadPool.Run(static_cast<size_t>(numFrames),[&](size_t frame){
+		PinholeCamera frameCamera(camera);
+		frameCamera.UpdateDirections();
+		Time t = start + Time(static_cast<double>(frame) / camera.framerate);
+		frameCamera.SetMotion(trajectory.PoseAt(t),trajectory.VelocityAt(t,frameCamera.FrameDuration()));
+		
+		std::unique_ptr<Bitmap> img(CreateImage(static_cast<long>(frame) + 1,height,width,camera.framerate));
+		std::unique_ptr<ChannelImage> channels(CreateChannels(static_cast<long>(frame) + 1,height,width));
+		for(int tile=0;tile<tilesX*tilesY;++tile){
+			RenderTile(scene,frameCamera,*img,(tile % tilesX) * kTileSize,(tile / tilesX) * kTileSize,channels.get());
+		}
+		if(img->Write()!=SUCCESS) failed = true;
+		if(channels && channels->Write()!=SUCCESS) failed = true;
+	});
+	
+	return failed ? ERROR : SUCCESS;
+}
+
+/**
+ * /name 	RenderScene (overloaded method)
+ * /brief	Renders the scene to an image on an OpenCL device. Returns 0 on success.
+ * /param	scene - The scene object to render.
+ * /param	camera - The accelerated camera object used to view the scene.
+ */
 int ImageRenderer::RenderScene(const Scene& scene,AcceleratedPinholeCamera* camera){
-    Distance distance(kRayLength);
-    
-    
-    std::vector<Point> points = camera->Trace(distance);
-    
-    //Check for intersection with scene, write to image
-    //img.SetPixel(x,y,scene.CheckPoints(points));
-    
+	static long renderNum = 1;
+	
+	//Create output image
+	std::unique_ptr<Bitmap> img(CreateImage(renderNum,camera->sensor.resolution.vertical,camera->sensor.resolution.horizontal,camera->framerate));
+	
+	//The whole frame is traced on the device, only the finished pixels come back
+	if(camera->RenderFrame(scene,kRayLength,*img)!=SUCCESS) return ERROR;
+	
+	//Move the camera on to the start of the next frame
+	camera->AdvanceFrame();
+	
+	if(img->Write()!=SUCCESS) return ERROR;
+	return SUCCESS;
+}
+
+/* Notes: One frame in flight in RenderSequence: its device buffer, the image it is read back into, and the event
+ * that completes when the read back is done. The image is created per frame, as a mapped image is its output 
+ * file. */
+struct FrameSlot {
+	DeviceBuffer deviceFrame;
+	Bitmap *image;
+	cl_event readBack;
+	long frameNumber;
+	
+	FrameSlot() : image(NULL), readBack(NULL), frameNumber(0) {};
+	~FrameSlot() { delete image; };
+};
+
+/**
+ * /name	RenderSequence
+ * /brief	Renders "numFrames" consecutive frames of a moving camera on an OpenCL device, writing render-1.png, 
+ * render-2.png, ... (or the selected output format). Returns 0 on success.
+ * /param	framesInFlight - The number of frames being processed at once.
+ * /notes	The frames go through a three stage pipeline: compute (kernel on the compute queue), read back (on the 
+ * transfer queue, waited for by a completion thread) and encode (writing the images, on worker threads). Frame k+1 computes while 
+ * frame k is read back and frame k-1 is encoded. The stages are linked by bounded queues, and a frame slot is only 
+ * reused once its image is written, so no stage runs more than "framesInFlight" frames ahead.
+ */
+int ImageRenderer::RenderSequence(const Scene& scene,AcceleratedPinholeCamera* camera,int numFrames,int framesInFlight){
+	if(numFrames <= 0 || framesInFlight <= 0) return ERROR;
+	const int width = camera->sensor.resolution.horizontal;
+	const int height = camera->sensor.resolution.vertical;
+	
+	//Frame slots (and their device memory) are allocated up front, and recycled between frames
+	if(_format==Y4M_FORMAT) remove((_outputPath + "render" + ImageExtension(_format)).c_str());
+	std::vector<FrameSlot*> slots;
+	BlockingQueue<FrameSlot*> freeSlots(framesInFlight);
+	BlockingQueue<FrameSlot*> readBackQueue(framesInFlight);
+	BlockingQueue<FrameSlot*> encodeQueue(framesInFlight);
+	for(int idx=0;idx<framesInFlight;++idx){
+		slots.push_back(new FrameSlot());
+		freeSlots.Push(slots.back());
+	}
+	std::atomic<bool> failed(false);
+	
+	//Read back: wait for each frame to arrive in host memory, in order
+	std::thread completion([&](){
+		FrameSlot *slot;
+		while(readBackQueue.Pop(slot)){
+			if(clWaitForEvents(1,&slot->readBack)!=CL_SUCCESS) failed = true;
+			clReleaseEvent(slot->readBack);
+			slot->readBack = NULL;
+			encodeQueue.Push(slot);
+		}
+		encodeQueue.Close();
+	});
+	
+	//Encode: write the images, then hand the slots back to the compute stage
+	const unsigned int numEncoders = std::max(1u,std::min(static_cast<unsigned int>(framesInFlight),std::thread::hardware_concurrency()));
+	std::vector<std::thread> encoders;
+	for(unsigned int idx=0;idx<numEncoders;++idx){
+		encoders.push_back(std::thread([&](){
+			FrameSlot *slot;
+			while(encodeQueue.Pop(slot)){
+				if(slot->image->Write()!=SUCCESS) failed = true;
+				delete slot->image;
+				slot->image = NULL;
+				freeSlots.Push(slot);
+			}
+		}));
+	}
+	
+	//Compute: queue the frames, blocking while all slots are in flight
+	for(long frame=1;frame<=numFrames && !failed;++frame){
+		FrameSlot *slot;
+		freeSlots.Pop(slot);
+		slot->frameNumber = frame;
+		slot->image = CreateImage(frame,height,width,camera->framerate);
+		if(camera->EnqueueFrame(scene,kRayLength,slot->deviceFrame,*slot->image,&slot->readBack)!=SUCCESS){
+			failed = true;
+			break;
+		}
+		camera->AdvanceFrame();
+		readBackQueue.Push(slot);
+	}
+	
+	//Drain the pipeline
+	readBackQueue.Close();
+	completion.join();
+	for(size_t idx=0;idx<encoders.size();++idx) encoders[idx].join();
+	for(size_t idx=0;idx<slots.size();++idx) delete slots[idx];
+	
+	return failed ? ERROR : SUCCESS;
 }
 
  /**
   * /name 	RenderScene (overloaded method)
-  * /brief	Renders the scene to an image. Returns 0 on success.
-  * /param	scene - The scene object to render.
-  * /param	cameras - The camera objects used to view the scene.
-  * /notes	Side effect: Creates image containing rendering for each camera, appending a sequence number.
+  * /brief	Renders one frame of a camera rig (e.g. a stereo pair): every camera views the scene from its own pose, 
+  * position and orientation, so the extrinsics may verge or rotate cameras as well as offset them, and with its own
+  * intrinsics. Returns 0 on success.
+  * /param	scene - The scene object to render, shared by all cameras.
+  * /param	cameras - The camera objects used to view the scene. Only CPU (PinholeCamera) cameras are supported.
+  * /notes	Side effect: Creates image render-cam<n>-<frame>.png (or the selected output format) for camera n, 
+  * counting from 1, and moves every camera on to its next frame. The tiles of all cameras are rendered as one 
+  * batch on the thread pool, so a rig keeps every core busy however many cameras it has; the images are then 
+  * written in parallel too.
   */
-int ImageRenderer::RenderScene(const Scene& scene,const std::vector<Camera*> cameras){
+int ImageRenderer::RenderScene(const Scene& scene,const std::vector<Camera*>& cameras){
+	static long renderNum = 1;
 	if(cameras.size()==0) return ERROR;
-	return ERROR;
-    
-//	//Render the scene for each camera
-//	for(auto it=cameras.begin();it!=cameras.end();++it){
-//		RenderScene(scene,cameras.at(0));	
-//	}
+	
+	//Tiles of camera n are numbered from firstTile[n]
+	std::vector<PinholeCamera*> rig;
+	std::vector<int> tilesX;
+	std::vector<size_t> firstTile(1,0);
+	for(auto it=cameras.begin();it!=cameras.end();++it){
+		PinholeCamera *camera = dynamic_cast<PinholeCamera*>(*it);
+		if(camera==NULL) return ERROR;
+		camera->UpdateDirections();
+		rig.push_back(camera);
+		
+		const int width = camera->sensor.resolution.horizontal;
+		const int height = camera->sensor.resolution.vertical;
+		tilesX.push_back((width + kTileSize - 1) / kTileSize);
+		firstTile.push_back(firstTile.back() + static_cast<size_t>(tilesX.back() * ((height + kTileSize - 1) / kTileSize)));
+	}
+	
+	//Create output images, compressing on every thread if there are fewer images than threads
+	const unsigned int encodeThreads = std::max(1U,_threadPool.NumThreads() / static_cast<unsigned int>(rig.size()));
+	std::vector<std::unique_ptr<Bitmap>> images;
+	std::vector<std::unique_ptr<ChannelImage>> channels;
+	for(size_t idx=0;idx<rig.size();++idx){
+		std::stringstream name;
+		name << "render-cam" << idx + 1;
+		images.push_back(std::unique_ptr<Bitmap>(CreateImage(renderNum,rig[idx]->sensor.resolution.vertical,rig[idx]->sensor.resolution.horizontal,rig[idx]->framerate,encodeThreads,name.str())));
+		channels.push_back(std::unique_ptr<ChannelImage>(CreateChannels(renderNum,rig[idx]->sensor.resolution.vertical,rig[idx]->sensor.resolution.horizontal,name.str())));
+	}
+	
+	//All tiles of all cameras, as one batch
+	_threadPool.Run(firstTile.back(),[&](size_t tile){
+		const size_t camera = static_cast<size_t>(std::upper_bound(firstTile.begin(),firstTile.end(),tile) - firstTile.begin()) - 1;
+		const int index = static_cast<int>(tile - firstTile[camera]);
+		RenderTile(scene,*rig[camera],*images[camera],(index % tilesX[camera]) * kTileSize,(index / tilesX[camera]) * kTileSize,channels[camera].get());
+	});
+	
+	//Move the cameras on to the start of the next frame, and write the images
+	std::atomic<bool> failed(false);
+	for(size_t idx=0;idx<rig.size();++idx) rig[idx]->AdvanceFrame();
+	_threadPool.Run(images.size(),[&](size_t idx){
+		if(images[idx]->Write()!=SUCCESS) failed = true;
+		if(channels[idx] && channels[idx]->Write()!=SUCCESS) failed = true;
+	});
+	renderNum++;
+	
+	return failed ? ERROR : SUCCESS;
+}
+
+/**
+ * /name	RenderScan
+ * /brief	Scans the scene with a spinning LiDAR for "numScans" revolutions, streaming the returns into "sink". 
+ * Returns 0 on success.
+ * /param	lidar - The LiDAR, which is moved on to the start of the next revolution after every scan.
+ * /notes	Every revolution is split into blocks of kFiringBlock firings, spread over the thread pool. Each block is
+ * written to the sink as one run as soon as it is done, numbered from the first return of the first scan.
+ */
+int ImageRenderer::RenderScan(const Scene& scene,LidarSensor* lidar,LidarSink& sink,int numScans){
+	lidar->UpdateDirections();
+	const int steps = lidar->AzimuthSteps();
+	const int beams = lidar->NumBeams();
+	const int numBlocks = (steps + kFiringBlock - 1) / kFiringBlock;
+	
+	std::atomic<bool> failed(false);
+	for(int scan=0;scan<numScans && !failed;++scan){
+		const uint64_t firstReturn = static_cast<uint64_t>(scan) * lidar->PointsPerScan();
+		_threadPool.Run(static_cast<size_t>(numBlocks),[&](size_t block){
+			const int firstStep = static_cast<int>(block) * kFiringBlock;
+			const int numSteps = std::min(kFiringBlock,steps - firstStep);
+			std::vector<LidarReturn> returns(static_cast<size_t>(numSteps) * beams);
+			lidar->ScanFirings(scene,firstStep,numSteps,&returns[0]);
+			if(sink.Write(firstReturn + static_cast<uint64_t>(firstStep) * beams,&returns[0],returns.size())!=SUCCESS) failed = true;
+		});
+		lidar->AdvanceFrame();
+	}
+	
+	return failed ? ERROR : SUCCESS;
 }
 
 /**
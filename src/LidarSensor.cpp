@@ -0,0 +1,252 @@
+
+/**
+ *      ___           ___           ___           ___
+ *     /\  \         /\  \         /\  \         /\__\
+ *    /::\  \       /::\  \       /::\  \       /:/  /
+ *   /:/\:\  \     /:/\ \  \     /:/\:\  \     /:/  /
+ *  /::\~\:\  \   _\:\~\ \  \   /::\~\:\  \   /:/  /
+ * /:/\:\ \:\__\ /\ \:\ \ \__\ /:/\:\ \:\__\ /:/__/
+ * \/__\:\/:/  / \:\ \:\ \/__/ \/_|::\/:/  / \:\  \
+ *      \::/  /   \:\ \:\__\      |:|::/  /   \:\  \
+ *      /:/  /     \:\/:/  /      |:|\/__/     \:\  \
+ *     /:/  /       \::/  /       |:|  |        \:\__\
+ *     \/__/         \/__/         \|__|         \/__/
+ * -----------------------------------------------------
+ * /name    LidarSensor
+ * /brief   Implements a spinning multi-beam LiDAR, and the sinks its returns are streamed into.
+ * /author  Erik E. Beerepoot
+ */
+
+#include "GenericTypes.hpp"
+#include "LidarSensor.hpp"
+
+//STL
+#include <algorithm>
+
+//libc
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+
+//Default beam pattern: 64 beams from 2 degrees above to 24.8 degrees below the horizon (like a Velodyne HDL-64E)
+const Angle kLidarUpperElevation = 0.0349_rad;
+const Angle kLidarLowerElevation = Angle(-0.4328);
+const Distance kLidarMaxRange = 120.0_m;
+
+/**
+ * /name LidarRingBuffer
+ * /brief Constructor for LidarRingBuffer class. Allocates room for "capacity" returns.
+ */
+LidarRingBuffer::LidarRingBuffer(size_t capacity) : _buffer(std::max<size_t>(1,capacity)), _head(0), _size(0), _closed(false) {}
+
+/**
+ * /name Write
+ * /brief Appends "count" returns, waiting for space while the buffer is full. Returns 0 on success, or 1 if the
+ * buffer was closed before all returns fit.
+ * /notes A run that doesn't fit at once is appended in parts, so runs written by different threads may
+ * interleave; every return carries its own beam and step.
+ */
+int LidarRingBuffer::Write(uint64_t,const LidarReturn* returns,size_t count){
+	std::unique_lock<std::mutex> guard(_lock);
+	while(count > 0){
+		_notFull.wait(guard,[this]{ return _size < _buffer.size() || _closed; });
+		if(_closed) return ERROR;
+		
+		const size_t tail = (_head + _size) % _buffer.size();
+		const size_t run = std::min(count,std::min(_buffer.size() - _size,_buffer.size() - tail));
+		std::copy(returns,returns + run,_buffer.begin() + tail);
+		_size += run;
+		returns += run;
+		count -= run;
+		_notEmpty.notify_all();
+	}
+	return SUCCESS;
+}
+
+/**
+ * /name Read
+ * /brief Takes up to "maxCount" of the oldest returns, waiting for one if the buffer is empty. Returns the number
+ * of returns taken, which is 0 once the buffer is closed and empty.
+ */
+size_t LidarRingBuffer::Read(LidarReturn* returns,size_t maxCount){
+	std::unique_lock<std::mutex> guard(_lock);
+	_notEmpty.wait(guard,[this]{ return _size > 0 || _closed; });
+	
+	size_t count = 0;
+	while(count < maxCount && _size > 0){
+		const size_t run = std::min(maxCount - count,std::min(_size,_buffer.size() - _head));
+		std::copy(_buffer.begin() + _head,_buffer.begin() + _head + run,returns + count);
+		_head = (_head + run) % _buffer.size();
+		_size -= run;
+		count += run;
+	}
+	_notFull.notify_all();
+	return count;
+}
+
+/**
+ * /name Close
+ * /brief Marks the end of the scan, waking all waiting readers (and writers, which then fail).
+ */
+void LidarRingBuffer::Close(){
+	std::lock_guard<std::mutex> guard(_lock);
+	_closed = true;
+	_notEmpty.notify_all();
+	_notFull.notify_all();
+}
+
+/**
+ * /name LidarFile
+ * /brief Constructor for LidarFile class. Creates (or truncates) the output file.
+ */
+LidarFile::LidarFile(std::string filePath) : _fd(open(filePath.c_str(),O_RDWR | O_CREAT | O_TRUNC,0644)) {}
+
+LidarFile::~LidarFile(){
+	if(_fd >= 0) close(_fd);
+}
+
+/**
+ * /name Write
+ * /brief Writes "count" returns at the place of return "index" in the file. Returns 0 on success.
+ */
+int LidarFile::Write(uint64_t index,const LidarReturn* returns,size_t count){
+	if(_fd < 0) return ERROR;
+	
+	const char *data = reinterpret_cast<const char*>(returns);
+	size_t length = count * sizeof(LidarReturn);
+	off_t offset = static_cast<off_t>(index * sizeof(LidarReturn));
+	while(length > 0){
+		ssize_t written = pwrite(_fd,data,length,offset);
+		if(written < 0 && errno==EINTR) continue;
+		if(written <= 0) return ERROR;
+		data += written;
+		length -= static_cast<size_t>(written);
+		offset += written;
+	}
+	return SUCCESS;
+}
+
+/**
+ * /name LidarSensor
+ * /brief Constructor for LidarSensor class. Sets up "numBeams" evenly spaced beams (see kLidarUpperElevation), 
+ * firing "azimuthSteps" times per revolution, at "rotationRate" revolutions per second.
+ */
+LidarSensor::LidarSensor(Point centre,Orientation orientation,Velocity velocity,int numBeams,int azimuthSteps,int rotationRate) : Camera(centre,orientation,velocity), maxRange(kLidarMaxRange), compensateMotion(true) {
+	SetBeams(LidarBeamModel::Uniform(numBeams,kLidarUpperElevation,kLidarLowerElevation),azimuthSteps,rotationRate);
+}
+
+/**
+ * /name SetBeams
+ * /brief Selects the beam pattern, the number of firings per revolution and the rotation rate, and builds the 
+ * direction table. Invalid patterns are ignored.
+ * /notes Steps and beams are reported as 16 bit numbers, so both are limited to 65536.
+ */
+void LidarSensor::SetBeams(std::shared_ptr<const LidarBeamModel> beams,int azimuthSteps,int rotationRate){
+	if(!beams || beams->NumBeams() <= 0 || beams->NumBeams() > 65536 || azimuthSteps <= 0 || azimuthSteps > 65536 || rotationRate <= 0) return;
+	
+	sensor.resolution.vertical = beams->NumBeams();
+	sensor.resolution.horizontal = azimuthSteps;
+	fieldOfView.horizontal = kPi * 2;
+	framerate = rotationRate;
+	
+	//A frame is one revolution: every beam of every firing counts as a pixel, so the camera's frame timing holds
+	_samplingTime = Time(1.0 / (static_cast<double>(rotationRate) * azimuthSteps * beams->NumBeams()));
+	SetModel(beams);
+}
+
+/**
+ * /name FiringTime
+ * /brief Returns the time, relative to the start of the scan, at which firing "step" fires.
+ */
+Time LidarSensor::FiringTime(int step) const{
+	return PixelTime(static_cast<long>(step) * NumBeams());
+}
+
+/**
+ * /name FiringPose
+ * /brief Returns the pose of the sensor while firing "step" fires.
+ */
+Pose LidarSensor::FiringPose(int step) const{
+	return PoseAt(FiringTime(step));
+}
+
+/**
+ * /name CastFiring
+ * /brief Fills "packet" with the rays of beams firstBeam ... firstBeam+count-1 of firing "step", cast from the
+ * pose of the sensor at the time of the firing, limited to maxRange.
+ */
+void LidarSensor::CastFiring(int step,int firstBeam,int count,RayPacket& packet) const{
+	const Pose pose = FiringPose(step);
+	double rotation[3][3];
+	RotationMatrix(pose.orientation,rotation);
+	const DirectionTable* table = Directions();
+	
+	packet.size = std::min(count,kMaxPacketSize);
+	for(int lane=0;lane<packet.size;++lane){
+		const int beam = firstBeam + lane;
+		double direction[3];
+		if(table!=NULL && step >= 0 && step < table->Width() && beam >= 0 && beam < table->Height()) table->Direction(step,beam,direction);
+		else PixelDirection(step,beam,direction);
+		
+		packet.originX[lane] = pose.centre.x.get();
+		packet.originY[lane] = pose.centre.y.get();
+		packet.originZ[lane] = pose.centre.z.get();
+		packet.directionX[lane] = rotation[0][0]*direction[0] + rotation[0][1]*direction[1] + rotation[0][2]*direction[2];
+		packet.directionY[lane] = rotation[1][0]*direction[0] + rotation[1][1]*direction[1] + rotation[1][2]*direction[2];
+		packet.directionZ[lane] = rotation[2][0]*direction[0] + rotation[2][1]*direction[1] + rotation[2][2]*direction[2];
+		packet.length[lane] = maxRange.get();
+	}
+}
+
+/**
+ * /name ScanFirings
+ * /brief Fires firings firstStep ... firstStep+numSteps-1 into the scene, writing their returns to "returns", 
+ * firing by firing, beam by beam. The intensity is the brightness of the voxel hit, scaled by the cosine of the 
+ * angle between the beam and the voxel face.
+ * /notes Does not modify the sensor, so disjoint ranges of firings may be scanned from several threads.
+ */
+void LidarSensor::ScanFirings(const Scene& scene,int firstStep,int numSteps,LidarReturn* returns) const{
+	const int beams = NumBeams();
+	const int packetSize = PacketWidth(SelectedPacketISA());
+	
+	RayPacket packet;
+	pixel_t hits[kMaxPacketSize];
+	HitRecord records[kMaxPacketSize];
+	for(int step=firstStep;step<firstStep + numSteps;++step){
+		const double time = FiringTime(step).get();
+		for(int first=0;first<beams;first+=packetSize){
+			CastFiring(step,first,std::min(packetSize,beams - first),packet);
+			scene.CheckPacket(packet,hits,records);
+			
+			for(int lane=0;lane<packet.size;++lane){
+				LidarReturn& ret = returns[static_cast<size_t>(step - firstStep) * beams + first + lane];
+				const HitRecord& hit = records[lane];
+				ret.time = time;
+				ret.beam = static_cast<uint16_t>(first + lane);
+				ret.step = static_cast<uint16_t>(step);
+				ret.range = ret.intensity = ret.x = ret.y = ret.z = 0.0f;
+				if(!hit.hit) continue;
+				
+				//Rays starting inside a voxel have no face to reflect off, so they keep the full brightness
+				const double brightness = (0.299*hit.color.red + 0.587*hit.color.green + 0.114*hit.color.blue) / 255.0;
+				const double incidence = -(packet.directionX[lane]*hit.normal[0] + packet.directionY[lane]*hit.normal[1] + packet.directionZ[lane]*hit.normal[2]);
+				const bool onFace = hit.normal[0]!=0 || hit.normal[1]!=0 || hit.normal[2]!=0;
+				ret.range = static_cast<float>(hit.distance.get());
+				ret.intensity = static_cast<float>(onFace ? brightness * std::max(0.0,incidence) : brightness);
+				
+				if(compensateMotion){
+					ret.x = static_cast<float>(hit.position.x.get());
+					ret.y = static_cast<float>(hit.position.y.get());
+					ret.z = static_cast<float>(hit.position.z.get());
+				} else {
+					double direction[3];
+					PixelDirection(step,first + lane,direction);
+					ret.x = static_cast<float>(hit.distance.get() * direction[0]);
+					ret.y = static_cast<float>(hit.distance.get() * direction[1]);
+					ret.z = static_cast<float>(hit.distance.get() * direction[2]);
+				}
+			}
+		}
+	}
+}
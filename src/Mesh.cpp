@@ -0,0 +1,352 @@
+
+/**
+ *      ___           ___           ___           ___
+ *     /\  \         /\  \         /\  \         /\__\
+ *    /::\  \       /::\  \       /::\  \       /:/  /
+ *   /:/\:\  \     /:/\ \  \     /:/\:\  \     /:/  /
+ *  /::\~\:\  \   _\:\~\ \  \   /::\~\:\  \   /:/  /
+ * /:/\:\ \:\__\ /\ \:\ \ \__\ /:/\:\ \:\__\ /:/__/
+ * \/__\:\/:/  / \:\ \:\ \/__/ \/_|::\/:/  / \:\  \
+ *      \::/  /   \:\ \:\__\      |:|::/  /   \:\  \
+ *      /:/  /     \:\/:/  /      |:|\/__/     \:\  \
+ *     /:/  /       \::/  /       |:|  |        \:\__\
+ *     \/__/         \/__/         \|__|         \/__/
+ * -----------------------------------------------------
+ * /name    Mesh
+ * /brief   Triangle mesh loading (OBJ with MTL materials, ASCII and binary PLY).
+ * /author  Erik E. Beerepoot
+ */
+
+#include "GenericTypes.hpp"
+#include "Mesh.hpp"
+#include "ModelFile.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+//OBJ default diffuse colour (Kd 0.8), for faces without a material in files that use materials
+const uint8_t kDefaultDiffuse = 204;
+
+/**
+ * /name ReadFile
+ * /brief Reads a whole file into "data", adding a terminating zero so it can be parsed as text. Returns false if
+ * the file can't be read.
+ */
+static bool ReadFile(const std::string& path,std::vector<char>& data){
+	std::ifstream file(path.c_str(),std::ios_base::in | std::ios_base::binary);
+	if(file.fail()) return false;
+	file.seekg(0,std::ios_base::end);
+	std::streamoff length = file.tellg();
+	if(length < 0) return false;
+	file.seekg(0,std::ios_base::beg);
+	
+	data.resize(static_cast<size_t>(length) + 1);
+	if(length > 0) file.read(&data[0],length);
+	data[static_cast<size_t>(length)] = '\0';
+	return !file.fail();
+}
+
+/**
+ * /name Load
+ * /brief Loads a mesh from an OBJ (.obj) or PLY (.ply) file, picked by extension. Returns 0 on success.
+ */
+int Mesh::Load(const std::string& path){
+	size_t dot = path.find_last_of('.');
+	std::string extension = (dot==std::string::npos) ? "" : path.substr(dot + 1);
+	std::transform(extension.begin(),extension.end(),extension.begin(),::tolower);
+	
+	if(extension=="obj") return LoadOBJ(path);
+	if(extension=="ply") return LoadPLY(path);
+	return ERROR;
+}
+
+/**
+ * /name Clear
+ * /brief Empties the mesh.
+ */
+void Mesh::Clear(){
+	_vertices.clear();
+	_vertexColors.clear();
+	_indices.clear();
+	_faceColors.clear();
+}
+
+/**
+ * /name AddPolygon
+ * /brief Adds a polygon (vertex indices, counting from 0) as a fan of triangles. Returns false if an index is 
+ * negative or too large to store.
+ * /notes The vertices need not be read yet: the loaders check all indices with ValidIndices once the file is read.
+ */
+bool Mesh::AddPolygon(const std::vector<long long>& polygon){
+	for(size_t idx=0;idx<polygon.size();++idx){
+		if(polygon[idx] < 0 || polygon[idx] > static_cast<long long>(UINT32_MAX)) return false;
+	}
+	for(size_t idx=2;idx<polygon.size();++idx){
+		_indices.push_back(static_cast<uint32_t>(polygon[0]));
+		_indices.push_back(static_cast<uint32_t>(polygon[idx-1]));
+		_indices.push_back(static_cast<uint32_t>(polygon[idx]));
+	}
+	return true;
+}
+
+/**
+ * /name ValidIndices
+ * /brief Returns true if every triangle corner is one of the vertices.
+ */
+bool Mesh::ValidIndices() const{
+	const size_t numVertices = NumVertices();
+	for(size_t idx=0;idx<_indices.size();++idx){
+		if(_indices[idx] >= numVertices) return false;
+	}
+	return true;
+}
+
+/**
+ * /name Triangle
+ * /brief Returns the corners of triangle "idx".
+ */
+void Mesh::Triangle(size_t idx,double vertices[3][3]) const{
+	for(int corner=0;corner<3;++corner){
+		const double *vertex = &_vertices[3*static_cast<size_t>(_indices[3*idx + corner])];
+		vertices[corner][0] = vertex[0];
+		vertices[corner][1] = vertex[1];
+		vertices[corner][2] = vertex[2];
+	}
+}
+
+/**
+ * /name TriangleColor
+ * /brief Returns the colour of triangle "idx": its face colour, or the mean of its vertex colours. Returns false if
+ * the mesh has no colours.
+ */
+bool Mesh::TriangleColor(size_t idx,pixel_t& color) const{
+	if(!_faceColors.empty()){
+		color = _faceColors[idx];
+		return true;
+	}
+	if(_vertexColors.empty()) return false;
+	
+	int sum[3] = {0,0,0};
+	for(int corner=0;corner<3;++corner){
+		const pixel_t& vertex = _vertexColors[_indices[3*idx + corner]];
+		sum[0] += vertex.red;
+		sum[1] += vertex.green;
+		sum[2] += vertex.blue;
+	}
+	color.red = static_cast<uint8_t>((sum[0] + 1) / 3);
+	color.green = static_cast<uint8_t>((sum[1] + 1) / 3);
+	color.blue = static_cast<uint8_t>((sum[2] + 1) / 3);
+	return true;
+}
+
+/**
+ * /name NextLine
+ * /brief Returns the start of the line after "text", or the terminating zero.
+ */
+static const char* NextLine(const char *text){
+	while(*text!='\0' && *text!='\n') ++text;
+	return (*text=='\n') ? text + 1 : text;
+}
+
+/**
+ * /name ReadMaterials
+ * /brief Reads the diffuse colours (Kd) of the materials in an MTL file. Missing files are ignored.
+ */
+static void ReadMaterials(const std::string& path,std::map<std::string,pixel_t>& materials){
+	std::ifstream file(path.c_str());
+	std::string line,name;
+	while(std::getline(file,line)){
+		std::istringstream fields(line);
+		std::string keyword;
+		fields >> keyword;
+		if(keyword=="newmtl"){
+			fields >> name;
+			pixel_t grey;
+			grey.red = grey.green = grey.blue = kDefaultDiffuse;
+			materials[name] = grey;
+		} else if(keyword=="Kd" && !name.empty()){
+			double r = 0.0,g = 0.0,b = 0.0;
+			fields >> r >> g >> b;
+			materials[name].red = ToColorChannel(r,true);
+			materials[name].green = ToColorChannel(g,true);
+			materials[name].blue = ToColorChannel(b,true);
+		}
+	}
+}
+
+/**
+ * /name LoadOBJ
+ * /brief Loads a Wavefront OBJ file: vertices (with optional colours), faces, and the diffuse colours of the 
+ * materials in its MTL library. Returns 0 on success.
+ */
+int Mesh::LoadOBJ(const std::string& path){
+	Clear();
+	std::vector<char> data;
+	if(!ReadFile(path,data)) return ERROR;
+	
+	const size_t slash = path.find_last_of('/');
+	const std::string directory = (slash==std::string::npos) ? "" : path.substr(0,slash + 1);
+	std::map<std::string,pixel_t> materials;
+	pixel_t material;
+	material.red = material.green = material.blue = kDefaultDiffuse;
+	bool usesMaterials = false;
+	bool hasVertexColors = false;
+	std::vector<long long> polygon;
+	
+	for(const char *line=&data[0];*line!='\0';line=NextLine(line)){
+		while(*line==' ' || *line=='\t') ++line;
+		
+		if(line[0]=='v' && (line[1]==' ' || line[1]=='\t')){
+			//"v x y z [r g b]"
+			char *end;
+			const char *field = line + 2;
+			double values[6];
+			int numValues = 0;
+			for(;numValues<6;++numValues){
+				values[numValues] = strtod(field,&end);
+				if(end==field) break;
+				field = end;
+			}
+			if(numValues < 3) return ERROR;
+			_vertices.insert(_vertices.end(),values,values + 3);
+			
+			pixel_t color;
+			color.red = color.green = color.blue = 0;
+			if(numValues==6){
+				bool fraction = std::max(values[3],std::max(values[4],values[5])) <= 1.0;
+				color.red = ToColorChannel(values[3],fraction);
+				color.green = ToColorChannel(values[4],fraction);
+				color.blue = ToColorChannel(values[5],fraction);
+				hasVertexColors = true;
+			}
+			_vertexColors.push_back(color);
+		} else if(line[0]=='f' && (line[1]==' ' || line[1]=='\t')){
+			//"f v1 v2 v3 ...", each vertex "v", "v/vt", "v//vn" or "v/vt/vn", negative indices count back
+			polygon.clear();
+			const char *field = line + 2;
+			char *end;
+			for(;;){
+				long long index = strtoll(field,&end,10);
+				if(end==field) break;
+				polygon.push_back((index < 0) ? static_cast<long long>(NumVertices()) + index : index - 1);
+				field = end;
+				while(*field!='\0' && *field!=' ' && *field!='\t' && *field!='\r' && *field!='\n') ++field;
+			}
+			if(!AddPolygon(polygon)) return ERROR;
+			_faceColors.resize(NumTriangles(),material);
+		} else if(strncmp(line,"usemtl",6)==0 || strncmp(line,"mtllib",6)==0){
+			std::istringstream fields(std::string(line,NextLine(line) - line));
+			std::string keyword,name;
+			fields >> keyword >> name;
+			if(keyword=="mtllib"){
+				ReadMaterials(directory + name,materials);
+			} else {
+				std::map<std::string,pixel_t>::const_iterator it = materials.find(name);
+				material.red = material.green = material.blue = kDefaultDiffuse;
+				if(it!=materials.end()) material = it->second;
+				usesMaterials = true;
+			}
+		}
+	}
+	
+	if(!ValidIndices()){
+		Clear();
+		return ERROR;
+	}
+	
+	//Only keep the colours the file actually has
+	if(!usesMaterials) _faceColors.clear();
+	if(!hasVertexColors) _vertexColors.clear();
+	return SUCCESS;
+}
+
+/**
+ * /name LoadPLY
+ * /brief Loads a PLY file (ASCII, or binary in either byte order): vertices with optional colours, and faces with
+ * optional colours. Other elements and properties are skipped. Returns 0 on success.
+ */
+int Mesh::LoadPLY(const std::string& path){
+	Clear();
+	std::vector<char> data;
+	PLYHeader header;
+	if(!ReadFile(path,data) || ParsePLYHeader(&data[0],data.size() - 1,header)!=SUCCESS) return ERROR;
+	const std::vector<PLYElement>& elements = header.elements;
+	PLYReader reader(&data[header.body],data.size() - 1 - header.body,header.ascii,header.swap);
+	
+	//Body, one element type after the other
+	static const char *positionNames[3][1] = {{"x"},{"y"},{"z"}};
+	static const char *colorNames[3][2] = {{"red","diffuse_red"},{"green","diffuse_green"},{"blue","diffuse_blue"}};
+	static const char *indexNames[2] = {"vertex_indices","vertex_index"};
+	std::vector<double> values;
+	std::vector<long long> polygon;
+	for(size_t e=0;e<elements.size();++e){
+		const PLYElement& element = elements[e];
+		const bool isVertex = (element.name=="vertex");
+		const bool isFace = (element.name=="face");
+		
+		int position[3],color[3];
+		for(int axis=0;axis<3;++axis){
+			position[axis] = PLYPropertyIndex(element,positionNames[axis],1);
+			color[axis] = PLYPropertyIndex(element,colorNames[axis],2);
+		}
+		const int indices = PLYPropertyIndex(element,indexNames,2);
+		const bool hasColor = color[0]>=0 && color[1]>=0 && color[2]>=0;
+		if(isVertex && (position[0] < 0 || position[1] < 0 || position[2] < 0)) return ERROR;
+		if(isFace && (indices < 0 || !element.properties[indices].isList)) return ERROR;
+		
+		values.resize(element.properties.size());
+		for(size_t item=0;item<element.count;++item){
+			polygon.clear();
+			for(size_t p=0;p<element.properties.size();++p){
+				const PLYProperty& property = element.properties[p];
+				if(!property.isList){
+					if(!reader.Read(property.type,values[p])) return ERROR;
+					continue;
+				}
+				double count;
+				if(!reader.Read(property.countType,count) || count < 0) return ERROR;
+				for(long long idx=0;idx<static_cast<long long>(count);++idx){
+					double index;
+					if(!reader.Read(property.type,index)) return ERROR;
+					if(isFace && static_cast<int>(p)==indices) polygon.push_back(static_cast<long long>(index));
+				}
+			}
+			
+			if(isVertex){
+				for(int axis=0;axis<3;++axis) _vertices.push_back(values[position[axis]]);
+				if(hasColor){
+					bool fraction = element.properties[color[0]].type>=PLY_FLOAT32;
+					pixel_t vertexColor;
+					vertexColor.red = ToColorChannel(values[color[0]],fraction);
+					vertexColor.green = ToColorChannel(values[color[1]],fraction);
+					vertexColor.blue = ToColorChannel(values[color[2]],fraction);
+					_vertexColors.push_back(vertexColor);
+				}
+			} else if(isFace){
+				if(!AddPolygon(polygon)) return ERROR;
+				if(hasColor){
+					bool fraction = element.properties[color[0]].type>=PLY_FLOAT32;
+					pixel_t faceColor;
+					faceColor.red = ToColorChannel(values[color[0]],fraction);
+					faceColor.green = ToColorChannel(values[color[1]],fraction);
+					faceColor.blue = ToColorChannel(values[color[2]],fraction);
+					_faceColors.resize(NumTriangles(),faceColor);
+				}
+			}
+		}
+	}
+	
+	//Faces may come before vertices in the file, so indices are only checked against the final vertex count
+	if(!ValidIndices()){
+		Clear();
+		return ERROR;
+	}
+	if(!_faceColors.empty() && _faceColors.size()!=NumTriangles()) _faceColors.clear();
+	if(!_vertexColors.empty() && _vertexColors.size()!=NumVertices()) _vertexColors.clear();
+	return SUCCESS;
+}
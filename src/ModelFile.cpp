@@ -0,0 +1,224 @@
+
+/**
+ *      ___           ___           ___           ___
+ *     /\  \         /\  \         /\  \         /\__\
+ *    /::\  \       /::\  \       /::\  \       /:/  /
+ *   /:/\:\  \     /:/\ \  \     /:/\:\  \     /:/  /
+ *  /::\~\:\  \   _\:\~\ \  \   /::\~\:\  \   /:/  /
+ * /:/\:\ \:\__\ /\ \:\ \ \__\ /:/\:\ \:\__\ /:/__/
+ * \/__\:\/:/  / \:\ \:\ \/__/ \/_|::\/:/  / \:\  \
+ *      \::/  /   \:\ \:\__\      |:|::/  /   \:\  \
+ *      /:/  /     \:\/:/  /      |:|\/__/     \:\  \
+ *     /:/  /       \::/  /       |:|  |        \:\__\
+ *     \/__/         \/__/         \|__|         \/__/
+ * -----------------------------------------------------
+ * /name    ModelFile
+ * /brief   Parsing helpers shared by the model loaders (PLY headers and values, text numbers).
+ * /author  Erik E. Beerepoot
+ */
+
+#include "GenericTypes.hpp"
+#include "ModelFile.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <math.h>
+#include <string.h>
+
+//Exactly representable powers of ten, for ParseNumber
+static const double kPowersOfTen[] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,1e12,1e13,1e14,1e15,1e16,
+	1e17,1e18,1e19,1e20,1e21,1e22};
+
+/**
+ * /name ParsePLYType
+ * /brief Looks up a PLY type by name (both the old and the sized names are accepted).
+ */
+static PLYType ParsePLYType(const std::string& name){
+	if(name=="char" || name=="int8") return PLY_INT8;
+	if(name=="uchar" || name=="uint8") return PLY_UINT8;
+	if(name=="short" || name=="int16") return PLY_INT16;
+	if(name=="ushort" || name=="uint16") return PLY_UINT16;
+	if(name=="int" || name=="int32") return PLY_INT32;
+	if(name=="uint" || name=="uint32") return PLY_UINT32;
+	if(name=="float" || name=="float32") return PLY_FLOAT32;
+	if(name=="double" || name=="float64") return PLY_FLOAT64;
+	return PLY_INVALID;
+}
+
+/**
+ * /name ParsePLYHeader
+ * /brief Parses the header at the start of the "length" bytes of a PLY file. Returns 0 on success.
+ */
+int ParsePLYHeader(const char *data,size_t length,PLYHeader& header){
+	if(length < 3 || strncmp(data,"ply",3)!=0) return ERROR;
+	
+	//The header ends with the line "end_header"
+	const char *end = data + length;
+	const char *start = data;
+	const char *headerEnd = NULL;
+	while(start < end){
+		const char *next = static_cast<const char*>(memchr(start,'\n',static_cast<size_t>(end - start)));
+		next = (next==NULL) ? end : next + 1;
+		if(next - start >= 10 && strncmp(start,"end_header",10)==0){
+			headerEnd = start;
+			header.body = static_cast<size_t>(next - data);
+			break;
+		}
+		start = next;
+	}
+	if(headerEnd==NULL) return ERROR;
+	
+	std::istringstream text(std::string(data,static_cast<size_t>(headerEnd - data)));
+	std::string line,format;
+	header.elements.clear();
+	while(std::getline(text,line)){
+		std::istringstream fields(line);
+		std::string keyword;
+		fields >> keyword;
+		if(keyword=="format"){
+			fields >> format;
+			header.ascii = (format=="ascii");
+			if(!header.ascii && format!="binary_little_endian" && format!="binary_big_endian") return ERROR;
+			
+			const uint16_t probe = 1;
+			const bool littleEndian = *reinterpret_cast<const uint8_t*>(&probe)==1;
+			header.swap = !header.ascii && (format=="binary_little_endian")!=littleEndian;
+		} else if(keyword=="element"){
+			PLYElement element;
+			fields >> element.name >> element.count;
+			if(fields.fail()) return ERROR;
+			header.elements.push_back(element);
+		} else if(keyword=="property" && !header.elements.empty()){
+			PLYProperty property;
+			std::string type;
+			fields >> type;
+			property.isList = (type=="list");
+			property.countType = PLY_INVALID;
+			if(property.isList){
+				std::string countType;
+				fields >> countType >> type;
+				property.countType = ParsePLYType(countType);
+				if(property.countType==PLY_INVALID) return ERROR;
+			}
+			property.type = ParsePLYType(type);
+			fields >> property.name;
+			if(property.type==PLY_INVALID) return ERROR;
+			header.elements.back().properties.push_back(property);
+		}
+	}
+	return format.empty() ? ERROR : SUCCESS;
+}
+
+/**
+ * /name PLYTypeSize
+ * /brief Returns the size in bytes of a binary PLY value.
+ */
+size_t PLYTypeSize(PLYType type){
+	static const size_t sizes[] = {1,1,2,2,4,4,4,8,0};
+	return sizes[type];
+}
+
+/**
+ * /name PLYPropertyIndex
+ * /brief Returns the index of the first property of "element" named one of "names", or -1.
+ */
+int PLYPropertyIndex(const PLYElement& element,const char *names[],int numNames){
+	for(size_t idx=0;idx<element.properties.size();++idx){
+		for(int name=0;name<numNames;++name){
+			if(element.properties[idx].name==names[name]) return static_cast<int>(idx);
+		}
+	}
+	return -1;
+}
+
+/**
+ * /name ParseNumber
+ * /brief Parses the decimal number at "text" (after any white space), stopping at "end", and moves "text" past 
+ * it. Returns false if there is no number.
+ * /notes Much faster than strtod, which also needs zero terminated text. Up to 19 significant digits are used,
+ * which is plenty for coordinates and colours.
+ */
+bool ParseNumber(const char *&text,const char *end,double& value){
+	const char *p = text;
+	while(p < end && (*p==' ' || *p=='\t' || *p=='\r' || *p=='\n')) ++p;
+	bool negative = false;
+	if(p < end && (*p=='-' || *p=='+')) negative = (*p++=='-');
+	
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	int digits = 0;
+	for(;p < end && *p>='0' && *p<='9';++p,++digits){
+		if(mantissa < 1000000000000000000ULL) mantissa = mantissa*10 + static_cast<uint64_t>(*p - '0');
+		else exponent++;
+	}
+	if(p < end && *p=='.'){
+		for(++p;p < end && *p>='0' && *p<='9';++p,++digits){
+			if(mantissa < 1000000000000000000ULL){
+				mantissa = mantissa*10 + static_cast<uint64_t>(*p - '0');
+				exponent--;
+			}
+		}
+	}
+	if(digits==0) return false;
+	
+	if(p < end && (*p=='e' || *p=='E')){
+		const char *q = p + 1;
+		bool negativeExponent = false;
+		if(q < end && (*q=='-' || *q=='+')) negativeExponent = (*q++=='-');
+		if(q < end && *q>='0' && *q<='9'){
+			int e = 0;
+			for(;q < end && *q>='0' && *q<='9';++q) e = std::min(e*10 + (*q - '0'),100000);
+			exponent += negativeExponent ? -e : e;
+			p = q;
+		}
+	}
+	
+	double result = static_cast<double>(mantissa);
+	if(exponent < 0 && exponent >= -22) result /= kPowersOfTen[-exponent];
+	else if(exponent > 0 && exponent <= 22) result *= kPowersOfTen[exponent];
+	else if(exponent!=0) result *= pow(10.0,exponent);
+	value = negative ? -result : result;
+	text = p;
+	return true;
+}
+
+/**
+ * /name ToColorChannel
+ * /brief Converts a colour channel to 8 bits. Fractions (0-1) are scaled to 0-255 first.
+ */
+uint8_t ToColorChannel(double value,bool fraction){
+	double scaled = fraction ? value * 255.0 : value;
+	return static_cast<uint8_t>(std::min(255.0,std::max(0.0,floor(scaled + 0.5))));
+}
+
+/**
+ * /name Read
+ * /brief Reads the next value, of type "type". Returns false at the end of the data.
+ */
+bool PLYReader::Read(PLYType type,double& value){
+	if(_ascii){
+		const char *text = _data + _position;
+		if(!ParseNumber(text,_data + _length,value)) return false;
+		_position = static_cast<size_t>(text - _data);
+		return true;
+	}
+	
+	const size_t size = PLYTypeSize(type);
+	if(size==0 || _position + size > _length) return false;
+	uint8_t bytes[8];
+	memcpy(bytes,_data + _position,size);
+	_position += size;
+	if(_swap) std::reverse(bytes,bytes + size);
+	
+	switch(type){
+		case PLY_INT8: { int8_t v; memcpy(&v,bytes,1); value = v; break; }
+		case PLY_UINT8: { uint8_t v; memcpy(&v,bytes,1); value = v; break; }
+		case PLY_INT16: { int16_t v; memcpy(&v,bytes,2); value = v; break; }
+		case PLY_UINT16: { uint16_t v; memcpy(&v,bytes,2); value = v; break; }
+		case PLY_INT32: { int32_t v; memcpy(&v,bytes,4); value = v; break; }
+		case PLY_UINT32: { uint32_t v; memcpy(&v,bytes,4); value = v; break; }
+		case PLY_FLOAT32: { float v; memcpy(&v,bytes,4); value = v; break; }
+		default: { double v; memcpy(&v,bytes,8); value = v; break; }
+	}
+	return true;
+}
@@ -27,12 +27,16 @@
 #include <new>
 #include <cstring>
 #include <iostream>
+#include <algorithm>
+#include <thread>
+#include <vector>
  
  //libc
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <png.h>
+#include <zlib.h>
 
  /**
   * /name Bitmap
@@ -43,6 +47,7 @@ Bitmap::Bitmap(std::string filePath,int imgHeight,int imgWidth){
 	_bitmap.width = imgWidth;
 	_bitmap.height = imgHeight;
 	_filePath = filePath;
+	_ownsImageData = true;
 	
 	try {
 		AllocateBitmap(_bitmap);
@@ -52,8 +57,21 @@ Bitmap::Bitmap(std::string filePath,int imgHeight,int imgWidth){
 	}
 }
 
+/**
+ * /name Bitmap
+ * /brief Construct for subclasses that provide the pixel memory themselves (e.g. a memory mapped file). The 
+ * bitmap does not free "imageData".
+ */
+Bitmap::Bitmap(std::string filePath,int imgHeight,int imgWidth,pixel_t *imageData){
+	_bitmap.imageData = imageData;
+	_bitmap.width = imgWidth;
+	_bitmap.height = imgHeight;
+	_filePath = filePath;
+	_ownsImageData = false;
+}
+
 Bitmap::~Bitmap(){
-	DeallocateBitmap(_bitmap);
+	if(_ownsImageData) DeallocateBitmap(_bitmap);
 }
 
 /**
@@ -100,21 +118,27 @@ void Bitmap::SetPixel(int x,int y, pixel_t pix){
 }
 /**
  * /name WriteImage
- * /brief Commits the bitmap to disk by writing it to a PNG file
+ * /brief Commits the bitmap to disk by writing it to a PNG file. libpng reads the rows straight from the bitmap, 
+ * without copying them.
  */
 int PNGImage::Write(){
 	if(_bitmap.imageData==NULL) return ERROR;
+	if(_settings.numThreads > 1 && static_cast<unsigned int>(_bitmap.height) >= 2*_settings.numThreads) return WriteParallel();
 	
 	int status = ERROR;
-	int pixel_size = 3;
     int depth = 8;
     
-	png_byte ** row_pointers = NULL;
 	png_structp png_ptr = NULL;
 	png_infop info_ptr = NULL;
-	size_t x, y;
 	FILE * fp;
 	
+	/* The pixels are packed RGB triplets, so every bitmap row is a PNG row already. */
+	static_assert(sizeof(pixel_t)==3,"pixel_t must be packed RGB");
+	std::vector<png_bytep> row_pointers(_bitmap.height);
+	for (int y = 0; y < _bitmap.height; ++y) {
+		row_pointers[y] = reinterpret_cast<png_bytep>(_bitmap.imageData + static_cast<size_t>(y)*_bitmap.width);
+	}
+	
     fp = fopen (_filePath.c_str(), "wb");
     if (! fp) {
         goto fopen_failed;
@@ -147,34 +171,20 @@ int PNGImage::Write(){
                   PNG_COMPRESSION_TYPE_DEFAULT,
                   PNG_FILTER_TYPE_DEFAULT);
     
-    /* Initialize rows of PNG. */ 
-    row_pointers = static_cast<png_byte**>(png_malloc (png_ptr, _bitmap.height * sizeof (png_byte *)));
-    for (y = 0; y < _bitmap.height; ++y) {
-        png_byte *row = static_cast<png_byte*>(png_malloc (png_ptr, sizeof (uint8_t) * _bitmap.width * pixel_size));
-        row_pointers[y] = row;
-		
-        for (x = 0; x < _bitmap.width; ++x) {
-            pixel_t pixel = _bitmap(x, y);
-            *row++ = pixel.red;
-            *row++ = pixel.green;
-            *row++ = pixel.blue;
-        }
-    }
+    /* Set compression settings, if any. */
+    if (_settings.level >= 0) png_set_compression_level (png_ptr, _settings.level);
+    if (_settings.strategy >= 0) png_set_compression_strategy (png_ptr, _settings.strategy);
+    if (_settings.filters >= 0) png_set_filter (png_ptr, PNG_FILTER_TYPE_BASE, _settings.filters);
     
     /* Write the image data to "fp". */
     png_init_io (png_ptr, fp);
-    png_set_rows (png_ptr, info_ptr, row_pointers);
+    png_set_rows (png_ptr, info_ptr, &row_pointers[0]);
     png_write_png (png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
 
     /* The routine has successfully written the file, so we set
        "status" to a value which indicates success. */
     status = 0;
     
-    for (y = 0; y < _bitmap.height; y++) {
-        png_free (png_ptr, row_pointers[y]);
-    }
-    png_free (png_ptr, row_pointers);
-    
 	png_failure:
 	png_create_info_struct_failed:
 		png_destroy_write_struct (&png_ptr, &info_ptr);
@@ -184,6 +194,202 @@ int PNGImage::Write(){
 	return status;
 }
 
+/**
+ * /name PaethPredictor
+ * /brief The PNG Paeth predictor: whichever of left (a), up (b) or upper left (c) is closest to a + b - c.
+ */
+static inline int PaethPredictor(int a,int b,int c){
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if(pa <= pb && pa <= pc) return a;
+	return (pb <= pc) ? b : c;
+}
+
+/**
+ * /name FilterRow
+ * /brief Filters one row with PNG filter type "type" (0-4) into "out". "prev" is the previous (unfiltered) row, 
+ * or NULL for the first row. Returns the sum of the absolute filtered values, used to pick the best filter.
+ */
+static unsigned long FilterRow(int type,const png_byte *row,const png_byte *prev,size_t stride,png_byte *out){
+	const int bpp = 3;
+	unsigned long sum = 0;
+	for(size_t x=0;x<stride;++x){
+		int a = (x >= bpp) ? row[x-bpp] : 0;
+		int b = (prev!=NULL) ? prev[x] : 0;
+		int c = (prev!=NULL && x >= bpp) ? prev[x-bpp] : 0;
+		int predicted = 0;
+		switch(type){
+			case 1: predicted = a; break;
+			case 2: predicted = b; break;
+			case 3: predicted = (a + b) / 2; break;
+			case 4: predicted = PaethPredictor(a,b,c); break;
+		}
+		png_byte value = static_cast<png_byte>(row[x] - predicted);
+		out[x] = value;
+		sum += (value < 128) ? value : 256 - value;
+	}
+	return sum;
+}
+
+/* Notes: One horizontal strip of the image in WriteParallel: its filtered rows, and its compressed data. */
+struct PNGStrip {
+	int firstRow;
+	int lastRow;
+	std::vector<png_byte> filtered;
+	std::vector<png_byte> compressed;
+	uLong adler;
+	bool ok;
+};
+
+/**
+ * /name WriteChunk
+ * /brief Writes one PNG chunk (length, type, data, CRC). Returns false on a write error.
+ */
+static bool WriteChunk(FILE *fp,const char *type,const png_byte *data,size_t length){
+	png_byte header[8];
+	png_save_uint_32(header,static_cast<png_uint_32>(length));
+	memcpy(header + 4,type,4);
+	uLong crc = crc32(0L,header + 4,4);
+	if(length > 0) crc = crc32(crc,data,static_cast<uInt>(length));
+	png_byte trailer[4];
+	png_save_uint_32(trailer,static_cast<png_uint_32>(crc));
+	
+	if(fwrite(header,1,8,fp)!=8) return false;
+	if(length > 0 && fwrite(data,1,length,fp)!=length) return false;
+	return fwrite(trailer,1,4,fp)==4;
+}
+
+/**
+ * /name WriteParallel
+ * /brief Writes the PNG file, filtering and deflating horizontal strips on separate threads (pigz style). Each 
+ * strip is a raw deflate stream, primed with the last 32 KB of the previous strip and ended by a sync flush, so the
+ * strips join into one valid zlib stream. Returns 0 on success.
+ */
+int PNGImage::WriteParallel(){
+	const int kWindowSize = 32768;
+	const size_t stride = static_cast<size_t>(_bitmap.width) * 3;
+	const png_byte *pixels = reinterpret_cast<const png_byte*>(_bitmap.imageData);
+	const unsigned int numStrips = _settings.numThreads;
+	
+	//libpng defaults: adaptive filtering over all filters, with the filtered zlib strategy
+	const int filters = (_settings.filters >= 0) ? _settings.filters : PNG_ALL_FILTERS;
+	const int level = (_settings.level >= 0) ? _settings.level : Z_DEFAULT_COMPRESSION;
+	const int strategy = (_settings.strategy >= 0) ? _settings.strategy : ((filters==PNG_FILTER_NONE) ? Z_DEFAULT_STRATEGY : Z_FILTERED);
+	const int filterFlags[5] = {PNG_FILTER_NONE,PNG_FILTER_SUB,PNG_FILTER_UP,PNG_FILTER_AVG,PNG_FILTER_PAETH};
+	
+	std::vector<PNGStrip> strips(numStrips);
+	for(unsigned int idx=0;idx<numStrips;++idx){
+		strips[idx].firstRow = static_cast<int>(static_cast<long>(_bitmap.height) * idx / numStrips);
+		strips[idx].lastRow = static_cast<int>(static_cast<long>(_bitmap.height) * (idx + 1) / numStrips);
+		strips[idx].ok = true;
+	}
+	
+	//Step 1: filter the strips (a row only depends on the unfiltered rows, so strips are independent)
+	std::vector<std::thread> workers;
+	for(unsigned int idx=0;idx<numStrips;++idx){
+		workers.push_back(std::thread([&,idx](){
+			PNGStrip& strip = strips[idx];
+			strip.filtered.resize(static_cast<size_t>(strip.lastRow - strip.firstRow) * (stride + 1));
+			std::vector<png_byte> candidate(stride);
+			
+			png_byte *out = &strip.filtered[0];
+			for(int y=strip.firstRow;y<strip.lastRow;++y,out += stride + 1){
+				const png_byte *row = pixels + y*stride;
+				const png_byte *prev = (y > 0) ? row - stride : NULL;
+				
+				//try every allowed filter, keeping the one with the smallest sum
+				unsigned long best = ~0UL;
+				for(int type=0;type<5;++type){
+					if(!(filters & filterFlags[type])) continue;
+					unsigned long sum = FilterRow(type,row,prev,stride,&candidate[0]);
+					if(sum < best){
+						best = sum;
+						out[0] = static_cast<png_byte>(type);
+						memcpy(out + 1,&candidate[0],stride);
+					}
+				}
+				if(best==~0UL){
+					out[0] = 0;
+					memcpy(out + 1,row,stride);
+				}
+			}
+			strip.adler = adler32(adler32(0L,Z_NULL,0),&strip.filtered[0],static_cast<uInt>(strip.filtered.size()));
+		}));
+	}
+	for(size_t idx=0;idx<workers.size();++idx) workers[idx].join();
+	workers.clear();
+	
+	//Step 2: deflate the strips
+	for(unsigned int idx=0;idx<numStrips;++idx){
+		workers.push_back(std::thread([&,idx](){
+			PNGStrip& strip = strips[idx];
+			z_stream stream;
+			memset(&stream,0,sizeof(stream));
+			if(deflateInit2(&stream,level,Z_DEFLATED,-15,8,strategy)!=Z_OK){
+				strip.ok = false;
+				return;
+			}
+			
+			//prime with the end of the previous strip, so matches can reach across the seam
+			if(idx > 0){
+				const std::vector<png_byte>& previous = strips[idx-1].filtered;
+				size_t dictionary = std::min(previous.size(),static_cast<size_t>(kWindowSize));
+				deflateSetDictionary(&stream,&previous[previous.size() - dictionary],static_cast<uInt>(dictionary));
+			}
+			
+			strip.compressed.resize(deflateBound(&stream,static_cast<uLong>(strip.filtered.size())) + 16);
+			stream.next_in = &strip.filtered[0];
+			stream.avail_in = static_cast<uInt>(strip.filtered.size());
+			stream.next_out = &strip.compressed[0];
+			stream.avail_out = static_cast<uInt>(strip.compressed.size());
+			
+			//only the last strip ends the stream, the others end byte aligned on a sync flush
+			int result = deflate(&stream,(idx + 1==numStrips) ? Z_FINISH : Z_SYNC_FLUSH);
+			strip.ok = (idx + 1==numStrips) ? (result==Z_STREAM_END) : (result==Z_OK && stream.avail_in==0);
+			strip.compressed.resize(strip.compressed.size() - stream.avail_out);
+			deflateEnd(&stream);
+		}));
+	}
+	for(size_t idx=0;idx<workers.size();++idx) workers[idx].join();
+	
+	uLong adler = strips[0].adler;
+	for(unsigned int idx=0;idx<numStrips;++idx){
+		if(!strips[idx].ok) return ERROR;
+		if(idx > 0) adler = adler32_combine(adler,strips[idx].adler,static_cast<z_off_t>(strips[idx].filtered.size()));
+	}
+	
+	//Step 3: write the file: signature, header, one IDAT chunk per strip, end
+	FILE *fp = fopen(_filePath.c_str(),"wb");
+	if(!fp) return ERROR;
+	
+	png_byte ihdr[13];
+	png_save_uint_32(ihdr,static_cast<png_uint_32>(_bitmap.width));
+	png_save_uint_32(ihdr + 4,static_cast<png_uint_32>(_bitmap.height));
+	ihdr[8] = 8;	//bit depth
+	ihdr[9] = PNG_COLOR_TYPE_RGB;
+	ihdr[10] = PNG_COMPRESSION_TYPE_BASE;
+	ihdr[11] = PNG_FILTER_TYPE_BASE;
+	ihdr[12] = PNG_INTERLACE_NONE;
+	
+	//zlib header for a 32 KB window, with the level hint, followed by the strips and the adler32 checksum
+	const int levelHint = (level==Z_DEFAULT_COMPRESSION) ? 2 : ((level < 2) ? 0 : ((level < 6) ? 1 : ((level==6) ? 2 : 3)));
+	png_byte zlibHeader[2] = {0x78,static_cast<png_byte>(levelHint << 6)};
+	zlibHeader[1] += static_cast<png_byte>(31 - ((zlibHeader[0]*256 + zlibHeader[1]) % 31));
+	strips.front().compressed.insert(strips.front().compressed.begin(),zlibHeader,zlibHeader + 2);
+	png_byte zlibTrailer[4];
+	png_save_uint_32(zlibTrailer,static_cast<png_uint_32>(adler));
+	strips.back().compressed.insert(strips.back().compressed.end(),zlibTrailer,zlibTrailer + 4);
+	
+	static const png_byte signature[8] = {137,80,78,71,13,10,26,10};
+	bool ok = (fwrite(signature,1,8,fp)==8) && WriteChunk(fp,"IHDR",ihdr,13);
+	for(unsigned int idx=0;idx<numStrips && ok;++idx){
+		ok = WriteChunk(fp,"IDAT",&strips[idx].compressed[0],strips[idx].compressed.size());
+	}
+	ok = ok && WriteChunk(fp,"IEND",NULL,0);
+	if(fclose(fp)!=0) ok = false;
+	return ok ? SUCCESS : ERROR;
+}
+
 /**
  * /name ReadImage
  * /brief Reads a PNG image from disk
@@ -0,0 +1,288 @@
+
+/**
+ *      ___           ___           ___           ___
+ *     /\  \         /\  \         /\  \         /\__\
+ *    /::\  \       /::\  \       /::\  \       /:/  /
+ *   /:/\:\  \     /:/\ \  \     /:/\:\  \     /:/  /
+ *  /::\~\:\  \   _\:\~\ \  \   /::\~\:\  \   /:/  /
+ * /:/\:\ \:\__\ /\ \:\ \ \__\ /:/\:\ \:\__\ /:/__/
+ * \/__\:\/:/  / \:\ \:\ \/__/ \/_|::\/:/  / \:\  \
+ *      \::/  /   \:\ \:\__\      |:|::/  /   \:\  \
+ *      /:/  /     \:\/:/  /      |:|\/__/     \:\  \
+ *     /:/  /       \::/  /       |:|  |        \:\__\
+ *     \/__/         \/__/         \|__|         \/__/
+ * -----------------------------------------------------
+ * /name    PointCloud
+ * /brief   Point clouds, streamed from memory mapped PLY and XYZ files in chunks.
+ * /author  Erik E. Beerepoot
+ */
+
+#include "GenericTypes.hpp"
+#include "PointCloud.hpp"
+
+#include <algorithm>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//Points are read in chunks of about this many bytes of the file
+const size_t kCloudChunkBytes = 16 << 20;
+
+/**
+ * /name PointCloud
+ * /brief Constructor for PointCloud class, creating an empty cloud.
+ */
+PointCloud::PointCloud() : _data(NULL), _length(0), _hasColors(false), _isPLY(false) {
+	for(int axis=0;axis<3;++axis){
+		_position[axis] = -1;
+		_color[axis] = -1;
+	}
+}
+
+/**
+ * /name ~PointCloud
+ * /brief Destructor for PointCloud class, unmapping the file.
+ */
+PointCloud::~PointCloud(){
+	Unmap();
+}
+
+/**
+ * /name Unmap
+ * /brief Unmaps the file, leaving an empty cloud.
+ */
+void PointCloud::Unmap(){
+	if(_data!=NULL) munmap(const_cast<char*>(_data),_length);
+	_data = NULL;
+	_length = 0;
+	_chunks.clear();
+	_hasColors = false;
+	_isPLY = false;
+}
+
+/**
+ * /name Load
+ * /brief Maps a PLY (.ply) or XYZ (any other extension) point cloud, and splits it into chunks. Returns 0 on 
+ * success.
+ */
+int PointCloud::Load(const std::string& path){
+	Unmap();
+	int fd = open(path.c_str(),O_RDONLY);
+	if(fd < 0) return ERROR;
+	struct stat info;
+	if(fstat(fd,&info)!=0 || info.st_size <= 0){
+		close(fd);
+		return ERROR;
+	}
+	
+	void *mapping = mmap(NULL,static_cast<size_t>(info.st_size),PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if(mapping==MAP_FAILED) return ERROR;
+	madvise(mapping,static_cast<size_t>(info.st_size),MADV_SEQUENTIAL);
+	_data = static_cast<const char*>(mapping);
+	_length = static_cast<size_t>(info.st_size);
+	
+	size_t dot = path.find_last_of('.');
+	std::string extension = (dot==std::string::npos) ? "" : path.substr(dot + 1);
+	std::transform(extension.begin(),extension.end(),extension.begin(),::tolower);
+	int result = (extension=="ply") ? IndexPLY() : IndexXYZ();
+	if(result!=SUCCESS) Unmap();
+	return result;
+}
+
+/**
+ * /name SplitLines
+ * /brief Splits the text in [begin,end) into chunks of whole lines.
+ */
+void PointCloud::SplitLines(size_t begin,size_t end){
+	while(begin < end){
+		size_t split = std::min(begin + kCloudChunkBytes,end);
+		if(split < end){
+			const char *newline = static_cast<const char*>(memchr(_data + split,'\n',end - split));
+			split = (newline==NULL) ? end : static_cast<size_t>(newline - _data) + 1;
+		}
+		Chunk chunk = {begin,split,0};
+		_chunks.push_back(chunk);
+		begin = split;
+	}
+}
+
+/**
+ * /name IndexPLY
+ * /brief Finds the vertex element of a PLY file and splits it into chunks. Returns 0 on success.
+ * /notes Elements in front of the vertices are skipped: ASCII elements have one line per item, binary ones must 
+ * not have list properties (their size is unknown without reading them).
+ */
+int PointCloud::IndexPLY(){
+	if(ParsePLYHeader(_data,_length,_header)!=SUCCESS) return ERROR;
+	_isPLY = true;
+	
+	size_t offset = _header.body;
+	size_t element = 0;
+	for(;element<_header.elements.size() && _header.elements[element].name!="vertex";++element){
+		const PLYElement& skipped = _header.elements[element];
+		if(_header.ascii){
+			for(size_t line=0;line<skipped.count;++line){
+				const char *newline = static_cast<const char*>(memchr(_data + offset,'\n',_length - offset));
+				if(newline==NULL) return ERROR;
+				offset = static_cast<size_t>(newline - _data) + 1;
+			}
+		} else {
+			size_t stride = 0;
+			for(size_t p=0;p<skipped.properties.size();++p){
+				if(skipped.properties[p].isList) return ERROR;
+				stride += PLYTypeSize(skipped.properties[p].type);
+			}
+			if(stride!=0 && skipped.count > (_length - offset) / stride) return ERROR;
+			offset += stride * skipped.count;
+		}
+	}
+	if(element==_header.elements.size() || offset > _length) return ERROR;
+	_vertex = _header.elements[element];
+	
+	static const char *positionNames[3][1] = {{"x"},{"y"},{"z"}};
+	static const char *colorNames[3][2] = {{"red","diffuse_red"},{"green","diffuse_green"},{"blue","diffuse_blue"}};
+	for(int axis=0;axis<3;++axis){
+		_position[axis] = PLYPropertyIndex(_vertex,positionNames[axis],1);
+		_color[axis] = PLYPropertyIndex(_vertex,colorNames[axis],2);
+		if(_position[axis] < 0) return ERROR;
+	}
+	_hasColors = _color[0]>=0 && _color[1]>=0 && _color[2]>=0;
+	
+	if(_header.ascii){
+		//One line per point: count the lines of every chunk
+		size_t remaining = _vertex.count;
+		size_t begin = offset;
+		while(remaining > 0){
+			Chunk chunk = {begin,begin,0};
+			while(remaining > 0 && chunk.end - begin < kCloudChunkBytes){
+				const char *newline = static_cast<const char*>(memchr(_data + chunk.end,'\n',_length - chunk.end));
+				chunk.end = (newline==NULL) ? _length : static_cast<size_t>(newline - _data) + 1;
+				chunk.numPoints++;
+				remaining--;
+				if(newline==NULL) break;
+			}
+			if(chunk.numPoints==0 || (remaining > 0 && chunk.end==_length)) return ERROR;
+			_chunks.push_back(chunk);
+			begin = chunk.end;
+		}
+		return SUCCESS;
+	}
+	
+	//Binary: list properties would make the points differ in size
+	size_t stride = 0;
+	for(size_t p=0;p<_vertex.properties.size();++p){
+		if(_vertex.properties[p].isList) return ERROR;
+		stride += PLYTypeSize(_vertex.properties[p].type);
+	}
+	if(stride==0 || _vertex.count > (_length - offset) / stride) return ERROR;
+	const size_t pointsPerChunk = std::max<size_t>(1,kCloudChunkBytes / stride);
+	for(size_t first=0;first<_vertex.count;first+=pointsPerChunk){
+		size_t numPoints = std::min(pointsPerChunk,_vertex.count - first);
+		Chunk chunk = {offset + first*stride,offset + (first + numPoints)*stride,numPoints};
+		_chunks.push_back(chunk);
+	}
+	return SUCCESS;
+}
+
+/**
+ * /name IndexXYZ
+ * /brief Splits an XYZ file into chunks, and checks its first point for colours. Returns 0 on success.
+ */
+int PointCloud::IndexXYZ(){
+	const char *line = _data;
+	const char *end = _data + _length;
+	while(line < end){
+		const char *lineEnd = static_cast<const char*>(memchr(line,'\n',static_cast<size_t>(end - line)));
+		if(lineEnd==NULL) lineEnd = end;
+		
+		const char *text = line;
+		while(text < lineEnd && (*text==' ' || *text=='\t' || *text=='\r')) ++text;
+		if(text < lineEnd && *text!='#'){
+			double value;
+			int numValues = 0;
+			while(numValues < 6 && ParseNumber(text,lineEnd,value)) numValues++;
+			if(numValues < 3) return ERROR;
+			_hasColors = (numValues==6);
+			break;
+		}
+		line = lineEnd + 1;
+	}
+	SplitLines(0,_length);
+	return SUCCESS;
+}
+
+/**
+ * /name ReadChunk
+ * /brief Reads the points of chunk "chunk" into "points" (replacing its contents). Safe to call concurrently.
+ * Returns 0 on success.
+ */
+int PointCloud::ReadChunk(size_t chunk,std::vector<CloudPoint>& points) const{
+	points.clear();
+	if(chunk >= _chunks.size()) return ERROR;
+	const Chunk& range = _chunks[chunk];
+	CloudPoint point;
+	point.color.red = point.color.green = point.color.blue = 0;
+	
+	if(!_isPLY){
+		const char *line = _data + range.begin;
+		const char *end = _data + range.end;
+		while(line < end){
+			const char *lineEnd = static_cast<const char*>(memchr(line,'\n',static_cast<size_t>(end - line)));
+			if(lineEnd==NULL) lineEnd = end;
+			
+			const char *text = line;
+			double values[6];
+			int numValues = 0;
+			while(text < lineEnd && (*text==' ' || *text=='\t' || *text=='\r')) ++text;
+			if(text < lineEnd && *text!='#'){
+				while(numValues < 6 && ParseNumber(text,lineEnd,values[numValues])) numValues++;
+				if(numValues < 3) return ERROR;
+				point.x = values[0];
+				point.y = values[1];
+				point.z = values[2];
+				point.color.red = point.color.green = point.color.blue = 0;
+				if(_hasColors && numValues==6){
+					point.color.red = ToColorChannel(values[3],false);
+					point.color.green = ToColorChannel(values[4],false);
+					point.color.blue = ToColorChannel(values[5],false);
+				}
+				points.push_back(point);
+			}
+			line = lineEnd + 1;
+		}
+		return SUCCESS;
+	}
+	
+	const size_t numProperties = _vertex.properties.size();
+	const bool fraction = _hasColors && _vertex.properties[_color[0]].type>=PLY_FLOAT32;
+	std::vector<double> values(numProperties);
+	PLYReader reader(_data + range.begin,range.end - range.begin,_header.ascii,_header.swap);
+	points.reserve(range.numPoints);
+	for(size_t idx=0;idx<range.numPoints;++idx){
+		for(size_t p=0;p<numProperties;++p){
+			const PLYProperty& property = _vertex.properties[p];
+			if(!property.isList){
+				if(!reader.Read(property.type,values[p])) return ERROR;
+				continue;
+			}
+			double count,item;
+			if(!reader.Read(property.countType,count) || count < 0) return ERROR;
+			for(long long n=0;n<static_cast<long long>(count);++n){
+				if(!reader.Read(property.type,item)) return ERROR;
+			}
+		}
+		point.x = values[_position[0]];
+		point.y = values[_position[1]];
+		point.z = values[_position[2]];
+		if(_hasColors){
+			point.color.red = ToColorChannel(values[_color[0]],fraction);
+			point.color.green = ToColorChannel(values[_color[1]],fraction);
+			point.color.blue = ToColorChannel(values[_color[2]],fraction);
+		}
+		points.push_back(point);
+	}
+	return SUCCESS;
+}
@@ -0,0 +1,404 @@
+
+/**
+ *      ___           ___           ___           ___
+ *     /\  \         /\  \         /\  \         /\__\
+ *    /::\  \       /::\  \       /::\  \       /:/  /
+ *   /:/\:\  \     /:/\ \  \     /:/\:\  \     /:/  /
+ *  /::\~\:\  \   _\:\~\ \  \   /::\~\:\  \   /:/  /
+ * /:/\:\ \:\__\ /\ \:\ \ \__\ /:/\:\ \:\__\ /:/__/
+ * \/__\:\/:/  / \:\ \:\ \/__/ \/_|::\/:/  / \:\  \
+ *      \::/  /   \:\ \:\__\      |:|::/  /   \:\  \
+ *      /:/  /     \:\/:/  /      |:|\/__/     \:\  \
+ *     /:/  /       \::/  /       |:|  |        \:\__\
+ *     \/__/         \/__/         \|__|         \/__/
+ * -----------------------------------------------------
+ * /name    RawImage
+ * /brief   Implementation file for the uncompressed image writers (PPM, PFM, raw RGB and Y4M video), and the
+ *          float output channels.
+ * /author  Erik E. Beerepoot
+ */
+
+#include "GenericTypes.hpp"
+#include "RawImage.hpp"
+
+//STL
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+//libc
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//Serialises growing Y4M streams, so concurrent frames never truncate each other
+static std::mutex streamLock;
+
+/**
+ * /name ParseImageFormat
+ * /brief Looks up an output format by its name or extension ("png", "ppm", "pfm", "raw"/"rgb", "y4m"). Returns 0
+ * on success.
+ */
+int ParseImageFormat(const std::string& name,ImageFormat& format){
+	std::string lower(name);
+	std::transform(lower.begin(),lower.end(),lower.begin(),::tolower);
+	if(!lower.empty() && lower[0]=='.') lower.erase(0,1);
+	
+	if(lower=="png") format = PNG_FORMAT;
+	else if(lower=="ppm") format = PPM_FORMAT;
+	else if(lower=="pfm") format = PFM_FORMAT;
+	else if(lower=="raw" || lower=="rgb") format = RAW_FORMAT;
+	else if(lower=="y4m") format = Y4M_FORMAT;
+	else return ERROR;
+	return SUCCESS;
+}
+
+/**
+ * /name ImageExtension
+ * /brief Returns the file extension of an output format, including the dot.
+ */
+std::string ImageExtension(ImageFormat format){
+	switch(format){
+		case PPM_FORMAT: return ".ppm";
+		case PFM_FORMAT: return ".pfm";
+		case RAW_FORMAT: return ".rgb";
+		case Y4M_FORMAT: return ".y4m";
+		default: return ".png";
+	}
+}
+
+/**
+ * /name ParseOutputChannels
+ * /brief Parses a comma separated list of output channels ("depth", "position", "voxel", "normal", or "all") into
+ * a mask of OutputChannel bits. Returns 0 on success.
+ */
+int ParseOutputChannels(const std::string& list,unsigned int& channels){
+	channels = 0;
+	std::stringstream ss(list);
+	std::string name;
+	while(std::getline(ss,name,',')){
+		std::transform(name.begin(),name.end(),name.begin(),::tolower);
+		if(name=="depth") channels |= DEPTH_CHANNEL;
+		else if(name=="position") channels |= POSITION_CHANNEL;
+		else if(name=="voxel") channels |= VOXEL_CHANNEL;
+		else if(name=="normal") channels |= NORMAL_CHANNEL;
+		else if(name=="all") channels |= DEPTH_CHANNEL | POSITION_CHANNEL | VOXEL_CHANNEL | NORMAL_CHANNEL;
+		else if(!name.empty()) return ERROR;
+	}
+	return SUCCESS;
+}
+
+/**
+ * /name MapFileRegion
+ * /brief Maps "length" bytes of the open file "fd", starting at "offset", for writing. The mapping has to start on
+ * a page boundary, so "base" and "baseLength" receive the actual mapping (to pass to munmap). Returns a pointer to
+ * byte "offset" of the file, or NULL on failure.
+ */
+static uint8_t* MapFileRegion(int fd,size_t offset,size_t length,void*& base,size_t& baseLength){
+	const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t start = offset - (offset % pageSize);
+	
+	base = NULL;
+	baseLength = length + (offset - start);
+	if(baseLength==0) return NULL;
+	
+	void *mapping = mmap(NULL,baseLength,PROT_READ | PROT_WRITE,MAP_SHARED,fd,static_cast<off_t>(start));
+	if(mapping==MAP_FAILED) return NULL;
+	base = mapping;
+	return static_cast<uint8_t*>(mapping) + (offset - start);
+}
+
+/**
+ * /name CreateMappedFile
+ * /brief Creates (or truncates) the file at "path", sizes it to "length" bytes and maps all of it for writing. 
+ * Returns a pointer to the start of the file, or NULL on failure.
+ */
+static uint8_t* CreateMappedFile(const std::string& path,size_t length,void*& base,size_t& baseLength){
+	base = NULL;
+	int fd = open(path.c_str(),O_RDWR | O_CREAT | O_TRUNC,0644);
+	if(fd < 0) return NULL;
+	
+	uint8_t *data = NULL;
+	if(ftruncate(fd,static_cast<off_t>(length))==0){
+		data = MapFileRegion(fd,0,length,base,baseLength);
+	}
+	
+	//the mapping keeps the file referenced
+	close(fd);
+	return data;
+}
+
+/**
+ * /name MappedImage
+ * /brief Creates the output file, with room for "header" and the pixels, and maps it as the pixel memory.
+ */
+MappedImage::MappedImage(std::string filePath,int imgHeight,int imgWidth,std::string header) : Bitmap(filePath,imgHeight,imgWidth,NULL), _header(header), _mapping(NULL), _mappingSize(0) {
+	const size_t dataSize = static_cast<size_t>(imgHeight)*imgWidth*sizeof(pixel_t);
+	uint8_t *data = CreateMappedFile(filePath,header.size() + dataSize,_mapping,_mappingSize);
+	if(data!=NULL){
+		memcpy(data,header.data(),header.size());
+		_bitmap.imageData = reinterpret_cast<pixel_t*>(data + header.size());
+		return;
+	}
+	
+	//Can't map the file (e.g. not a regular file system): render into heap memory, and write the file on Write()
+	_mapping = NULL;
+	AllocateBitmap(_bitmap);
+	_ownsImageData = true;
+}
+
+/**
+ * /name ~MappedImage
+ * /brief Unmaps the output file. The kernel writes back the pages when it sees fit.
+ */
+MappedImage::~MappedImage(){
+	if(_mapping!=NULL){
+		munmap(_mapping,_mappingSize);
+		_bitmap.imageData = NULL;
+	}
+}
+
+/**
+ * /name Write
+ * /brief The pixels already live in the file, so this only writes anything for an image that couldn't be mapped.
+ * Returns 0 on success.
+ */
+int MappedImage::Write(){
+	if(_bitmap.imageData==NULL) return ERROR;
+	if(_mapping!=NULL) return SUCCESS;
+	
+	FILE *fp = fopen(_filePath.c_str(),"wb");
+	if(!fp) return ERROR;
+	const size_t dataSize = static_cast<size_t>(_bitmap.height)*_bitmap.width*sizeof(pixel_t);
+	bool ok = fwrite(_header.data(),1,_header.size(),fp)==_header.size();
+	ok = ok && fwrite(_bitmap.imageData,1,dataSize,fp)==dataSize;
+	if(fclose(fp)!=0) ok = false;
+	return ok ? SUCCESS : ERROR;
+}
+
+/**
+ * /name Read
+ * /brief Reads a mapped image from disk
+ */
+int MappedImage::Read(){
+	if(_bitmap.imageData==NULL) return ERROR;
+	return SUCCESS;
+}
+
+/**
+ * /name PPMHeader
+ * /brief Returns the header of a binary (P6) PPM file with 8 bit channels.
+ */
+static std::string PPMHeader(int width,int height){
+	std::stringstream ss;
+	ss << "P6\n" << width << " " << height << "\n255\n";
+	return ss.str();
+}
+
+PPMImage::PPMImage(std::string filePath,int imgHeight,int imgWidth) : MappedImage(filePath,imgHeight,imgWidth,PPMHeader(imgWidth,imgHeight)) {}
+
+/**
+ * /name PFMHeader
+ * /brief Returns the header of a PFM file with 1 (greyscale) or 3 (RGB) components per pixel, in host byte order.
+ */
+static std::string PFMHeader(int width,int height,int components){
+	//A negative scale marks little endian data
+	const uint16_t probe = 1;
+	const bool littleEndian = *reinterpret_cast<const uint8_t*>(&probe)==1;
+	std::stringstream ss;
+	ss << ((components==1) ? "Pf\n" : "PF\n") << width << " " << height << "\n" << (littleEndian ? "-1.0" : "1.0") << "\n";
+	return ss.str();
+}
+
+/**
+ * /name Write
+ * /brief Writes the bitmap as a PFM file: RGB floats in [0,1], in host byte order, bottom row first. Returns 0 on 
+ * success.
+ */
+int PFMImage::Write(){
+	if(_bitmap.imageData==NULL) return ERROR;
+	const std::string header = PFMHeader(_bitmap.width,_bitmap.height,3);
+	
+	const size_t rowSize = static_cast<size_t>(_bitmap.width)*3*sizeof(float);
+	void *base;
+	size_t baseLength;
+	uint8_t *data = CreateMappedFile(_filePath,header.size() + rowSize*_bitmap.height,base,baseLength);
+	if(data==NULL) return ERROR;
+	memcpy(data,header.data(),header.size());
+	
+	//Rows are converted into a local buffer, as the float data in the file isn't aligned
+	std::vector<float> row(static_cast<size_t>(_bitmap.width)*3);
+	for(int y=0;y<_bitmap.height;++y){
+		const pixel_t *pixels = _bitmap.imageData + static_cast<size_t>(y)*_bitmap.width;
+		for(int x=0;x<_bitmap.width;++x){
+			row[3*x] = pixels[x].red / 255.0f;
+			row[3*x + 1] = pixels[x].green / 255.0f;
+			row[3*x + 2] = pixels[x].blue / 255.0f;
+		}
+		memcpy(data + header.size() + (_bitmap.height - 1 - y)*rowSize,&row[0],rowSize);
+	}
+	
+	munmap(base,baseLength);
+	return SUCCESS;
+}
+
+/**
+ * /name Read
+ * /brief Reads a PFM image from disk
+ */
+int PFMImage::Read(){
+	if(_bitmap.imageData==NULL) return ERROR;
+	return SUCCESS;
+}
+
+/**
+ * /name WriteFloatPFM
+ * /brief Writes "data" (top row first, "components" floats per pixel) to a PFM file. Returns 0 on success.
+ */
+static int WriteFloatPFM(const std::string& path,int width,int height,int components,const float *data){
+	const std::string header = PFMHeader(width,height,components);
+	const size_t rowSize = static_cast<size_t>(width)*components*sizeof(float);
+	void *base;
+	size_t baseLength;
+	uint8_t *file = CreateMappedFile(path,header.size() + rowSize*height,base,baseLength);
+	if(file==NULL) return ERROR;
+	memcpy(file,header.data(),header.size());
+	
+	for(int y=0;y<height;++y){
+		memcpy(file + header.size() + (height - 1 - y)*rowSize,data + static_cast<size_t>(y)*width*components,rowSize);
+	}
+	
+	munmap(base,baseLength);
+	return SUCCESS;
+}
+
+ChannelImage::ChannelImage(std::string prefix,std::string suffix,int imgHeight,int imgWidth,unsigned int channels) :
+	_prefix(prefix), _suffix(suffix), _height(imgHeight), _width(imgWidth), _channels(channels) {
+	const size_t numPixels = static_cast<size_t>(imgHeight)*imgWidth;
+	if(channels & DEPTH_CHANNEL) _depth.assign(numPixels,0.0f);
+	if(channels & POSITION_CHANNEL) _position.assign(3*numPixels,0.0f);
+	if(channels & VOXEL_CHANNEL) _voxel.assign(3*numPixels,-1.0f);
+	if(channels & NORMAL_CHANNEL) _normal.assign(3*numPixels,0.0f);
+}
+
+/**
+ * /name SetHit
+ * /brief Sets pixel (x,y) of every selected channel from the hit record of its ray.
+ */
+void ChannelImage::SetHit(int x,int y,const HitRecord& hit){
+	if(x < 0 || x >= _width || y < 0 || y >= _height || !hit.hit) return;
+	const size_t pixel = static_cast<size_t>(y)*_width + x;
+	
+	if(_channels & DEPTH_CHANNEL) _depth[pixel] = static_cast<float>(hit.distance.get());
+	if(_channels & POSITION_CHANNEL){
+		_position[3*pixel] = static_cast<float>(hit.position.x.get());
+		_position[3*pixel + 1] = static_cast<float>(hit.position.y.get());
+		_position[3*pixel + 2] = static_cast<float>(hit.position.z.get());
+	}
+	for(int axis=0;axis<3;++axis){
+		if(_channels & VOXEL_CHANNEL) _voxel[3*pixel + axis] = static_cast<float>(hit.voxel[axis]);
+		if(_channels & NORMAL_CHANNEL) _normal[3*pixel + axis] = static_cast<float>(hit.normal[axis]);
+	}
+}
+
+/**
+ * /name Write
+ * /brief Writes every selected channel to its own PFM file. Returns 0 on success.
+ */
+int ChannelImage::Write(){
+	int result = SUCCESS;
+	if((_channels & DEPTH_CHANNEL) && WriteFloatPFM(_prefix + "-depth" + _suffix,_width,_height,1,&_depth[0])!=SUCCESS) result = ERROR;
+	if((_channels & POSITION_CHANNEL) && WriteFloatPFM(_prefix + "-position" + _suffix,_width,_height,3,&_position[0])!=SUCCESS) result = ERROR;
+	if((_channels & VOXEL_CHANNEL) && WriteFloatPFM(_prefix + "-voxel" + _suffix,_width,_height,3,&_voxel[0])!=SUCCESS) result = ERROR;
+	if((_channels & NORMAL_CHANNEL) && WriteFloatPFM(_prefix + "-normal" + _suffix,_width,_height,3,&_normal[0])!=SUCCESS) result = ERROR;
+	return result;
+}
+
+Y4MImage::Y4MImage(std::string filePath,int imgHeight,int imgWidth,long frameNumber,int framerate) : Bitmap(filePath,imgHeight,imgWidth), _frameNumber(frameNumber), _framerate(framerate) {}
+
+/**
+ * /name Write
+ * /brief Writes the bitmap as one frame of the Y4M stream, converted to BT.601 YCbCr 4:4:4. Returns 0 on success.
+ */
+int Y4MImage::Write(){
+	if(_bitmap.imageData==NULL || _framerate <= 0) return ERROR;
+	
+	std::stringstream ss;
+	ss << "YUV4MPEG2 W" << _bitmap.width << " H" << _bitmap.height << " F" << _framerate << ":1 Ip A1:1 C444\n";
+	const std::string header = ss.str();
+	const char frameHeader[] = "FRAME\n";
+	const size_t planeSize = static_cast<size_t>(_bitmap.width)*_bitmap.height;
+	const size_t frameSize = (sizeof(frameHeader) - 1) + 3*planeSize;
+	
+	int fd = open(_filePath.c_str(),O_RDWR | O_CREAT,0644);
+	if(fd < 0) return ERROR;
+	
+	//Find (and reserve) this frame's place in the stream
+	size_t offset;
+	{
+		std::lock_guard<std::mutex> lock(streamLock);
+		struct stat info;
+		if(fstat(fd,&info)!=0){
+			close(fd);
+			return ERROR;
+		}
+		size_t fileSize = static_cast<size_t>(info.st_size);
+		
+		if(fileSize==0){
+			if(pwrite(fd,header.data(),header.size(),0)!=static_cast<ssize_t>(header.size())){
+				close(fd);
+				return ERROR;
+			}
+			fileSize = header.size();
+		} else {
+			//only add to a stream of the same size and rate
+			std::vector<char> existing(header.size());
+			if(pread(fd,&existing[0],existing.size(),0)!=static_cast<ssize_t>(existing.size()) || memcmp(&existing[0],header.data(),header.size())!=0){
+				close(fd);
+				return ERROR;
+			}
+		}
+		
+		offset = (_frameNumber >= 0) ? header.size() + _frameNumber*frameSize : std::max(fileSize,header.size());
+		if(fileSize < offset + frameSize && ftruncate(fd,static_cast<off_t>(offset + frameSize))!=0){
+			close(fd);
+			return ERROR;
+		}
+	}
+	
+	void *base;
+	size_t baseLength;
+	uint8_t *data = MapFileRegion(fd,offset,frameSize,base,baseLength);
+	close(fd);
+	if(data==NULL) return ERROR;
+	
+	memcpy(data,frameHeader,sizeof(frameHeader) - 1);
+	uint8_t *planeY = data + sizeof(frameHeader) - 1;
+	uint8_t *planeU = planeY + planeSize;
+	uint8_t *planeV = planeU + planeSize;
+	for(size_t idx=0;idx<planeSize;++idx){
+		const int r = _bitmap.imageData[idx].red;
+		const int g = _bitmap.imageData[idx].green;
+		const int b = _bitmap.imageData[idx].blue;
+		planeY[idx] = static_cast<uint8_t>(((66*r + 129*g + 25*b + 128) >> 8) + 16);
+		planeU[idx] = static_cast<uint8_t>(((-38*r - 74*g + 112*b + 128) >> 8) + 128);
+		planeV[idx] = static_cast<uint8_t>(((112*r - 94*g - 18*b + 128) >> 8) + 128);
+	}
+	
+	munmap(base,baseLength);
+	return SUCCESS;
+}
+
+/**
+ * /name Read
+ * /brief Reads a Y4M frame from disk
+ */
+int Y4MImage::Read(){
+	if(_bitmap.imageData==NULL) return ERROR;
+	return SUCCESS;
+}
@@ -0,0 +1,76 @@
+
+/**
+ *      ___           ___           ___           ___
+ *     /\  \         /\  \         /\  \         /\__\
+ *    /::\  \       /::\  \       /::\  \       /:/  /
+ *   /:/\:\  \     /:/\ \  \     /:/\:\  \     /:/  /
+ *  /::\~\:\  \   _\:\~\ \  \   /::\~\:\  \   /:/  /
+ * /:/\:\ \:\__\ /\ \:\ \ \__\ /:/\:\ \:\__\ /:/__/
+ * \/__\:\/:/  / \:\ \:\ \/__/ \/_|::\/:/  / \:\  \
+ *      \::/  /   \:\ \:\__\      |:|::/  /   \:\  \
+ *      /:/  /     \:\/:/  /      |:|\/__/     \:\  \
+ *     /:/  /       \::/  /       |:|  |        \:\__\
+ *     \/__/         \/__/         \|__|         \/__/
+ * -----------------------------------------------------
+ * /name    RayPacket
+ * /brief   Runtime selection of the instruction set used to trace ray packets.
+ * /author  Erik E. Beerepoot
+ */
+
+#include "RayPacket.hpp"
+
+#include <atomic>
+
+static std::atomic<int> selectedISA(-1);
+
+/**
+ * /name SupportedPacketISA
+ * /brief Returns the widest instruction set the packet tracer supports on this CPU.
+ */
+PacketISA SupportedPacketISA(){
+#ifdef RT_PACKET_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")) return AVX512_ISA;
+	if(__builtin_cpu_supports("avx2")) return AVX2_ISA;
+	if(__builtin_cpu_supports("sse2")) return SSE2_ISA;
+#endif
+	return SCALAR_ISA;
+}
+
+/**
+ * /name SelectedPacketISA
+ * /brief Returns the instruction set used to trace packets. Defaults to the widest one supported.
+ */
+PacketISA SelectedPacketISA(){
+	int isa = selectedISA.load();
+	if(isa < 0){
+		isa = SupportedPacketISA();
+		selectedISA.store(isa);
+	}
+	return static_cast<PacketISA>(isa);
+}
+
+/**
+ * /name SelectPacketISA
+ * /brief Selects the instruction set used to trace packets, e.g. to compare against the scalar fallback. 
+ * Instruction sets the CPU does not support are lowered to the widest one it does.
+ */
+void SelectPacketISA(PacketISA isa){
+	PacketISA supported = SupportedPacketISA();
+	selectedISA.store((isa > supported) ? supported : isa);
+}
+
+/**
+ * /name PacketWidth
+ * /brief Returns the number of rays per packet for the instruction set.
+ */
+int PacketWidth(PacketISA isa){
+	switch(isa){
+		case AVX512_ISA:
+			return 16;
+		case AVX2_ISA:
+			return 8;
+		default:
+			return 4;
+	}
+}
@@ -21,15 +21,91 @@
  */
 
  #include "Scene.hpp"
+ #include "ThreadPool.hpp"
  #include <string>
  #include <iostream>
+ #include <algorithm>
+ #include <atomic>
+ #include <limits>
+ #include <thread>
+ #include <vector>
+ #include <math.h>
+ #include <stdlib.h>
+ #include <stdio.h>
+ #include <string.h>
+ #include <sstream>
+ #include <fcntl.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+
+//Distance field: distances are stored squared, in voxels, and capped at kMaxFieldDistance voxels
+const long long kMaxFieldDistance = 64;
+const uint16_t kMaxFieldValue = kMaxFieldDistance*kMaxFieldDistance;
+const double kSqrt3 = 1.7320508075688772;
+
+//Shapes with fewer voxels than this are voxelized on a single thread
+const long long kParallelFillVoxels = 1 << 18;
+
+//Meshes are voxelized in cubic regions of kMeshRegionSize voxels, one region per thread at a time
+const long long kMeshRegionSize = 32;
+
+//Point clouds are binned in cubic regions of kPointRegionSize voxels
+const long long kPointRegionSize = 64;
+
+//Scene files: a fixed header, followed by the payload sections, each aligned to kSceneFileAlignment bytes
+const char kSceneFileMagic[8] = {'R','T','S','C','E','N','E','\0'};
+const uint32_t kSceneFileVersion = 2;
+const uint32_t kSceneFileByteOrder = 0x01020304;
+const uint64_t kSceneFileAlignment = 64;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RT_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define RT_ALWAYS_INLINE inline
+#endif
+
+/* Notes: State of a 3D-DDA walk through the voxel grid. "t" is the distance along the ray at which the current
+ * voxel was entered. */
+struct GridWalk {
+	long long index[3];
+	long long step[3];
+	double tMax[3];
+	double tDelta[3];
+	double t;
+};
+
+/* Notes: Header of a scene file. Sizes are in metres, and all fields are in host byte order ("byteOrder" tells if
+ * the file came from a machine with another one). The payload is the raw voxel buffer of the grid, in the layout
+ * of the scene, then the brick map (sparse layout only) and the distance field (if built). An offset of 0 means 
+ * the section is absent. */
+struct SceneFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t layout;
+	uint32_t reserved;
+	double sceneSize[3];
+	double voxelSize[3];
+	int64_t dimension[3];
+	uint64_t numVoxels;
+	uint64_t voxelOffset;
+	uint64_t brickMapOffset;
+	uint64_t fieldOffset;
+	uint64_t fileSize;
+};
 
  /** 
   * /name Scene
   * /brief Constructs scene with default size 
   */
-Scene::Scene() : _sceneSize(Size(5.0_m,5.0_m,2.0_m)), _gridDim(Size(0.01_m,0.01_m,0.01_m)) {
+Scene::Scene() : _layout(LINEAR_LAYOUT), _sceneSize(Size(5.0_m,5.0_m,2.0_m)), _gridDim(Size(0.01_m,0.01_m,0.01_m)) {
 	_sceneData = NULL;
+	_distanceField = NULL;
+	_revision = 0;
+	_mapping = NULL;
+	_mappingSize = 0;
+	_fieldMapped = false;
 	
 	//need try catch
 	AllocScene();
@@ -39,10 +115,15 @@ Scene::Scene() : _sceneSize(Size(5.0_m,5.0_m,2.0_m)), _gridDim(Size(0.01_m,0.01_
 
  /** 
   * /name Scene
-  * /brief Constructs scene with custom size 
+  * /brief Constructs scene with custom size, storing the voxels using "layout"
   */
-Scene::Scene(Size size) : _sceneSize(size),_gridDim(0.01_m,0.01_m,0.01_m){
+Scene::Scene(Size size,VoxelLayout layout) : _layout(layout),_sceneSize(size),_gridDim(0.01_m,0.01_m,0.01_m){
 	_sceneData = NULL;
+	_distanceField = NULL;
+	_revision = 0;
+	_mapping = NULL;
+	_mappingSize = 0;
+	_fieldMapped = false;
 	
 	//need try catch
 	AllocScene();
@@ -51,24 +132,14 @@ Scene::Scene(Size size) : _sceneSize(size),_gridDim(0.01_m,0.01_m,0.01_m){
 /**
  * /name AllocScene
  * /brief Allocate memory for scene pixels
+ * /notes Throws an std::bad_alloc exception when out of memory.
  */
 void Scene::AllocScene(){
 	long long len = static_cast<long long>((_sceneSize.length/_gridDim.length).get());
 	long long wid = static_cast<long long>((_sceneSize.width/_gridDim.width).get());
 	long long hei = static_cast<long long>((_sceneSize.height/_gridDim.height).get());
 	
-	_sceneData = new pixel_t**[len];
-	for(long long x = 0; x < len; ++x){
-		_sceneData[x] = new pixel_t*[wid];
-		 for(long long y = 0; y <wid; ++y){
-			 _sceneData[x][y] = new pixel_t[hei];
-			 for(long long z = 0; z < hei; ++z){
-				 _sceneData[x][y][z].red = 0;
-				 _sceneData[x][y][z].green = 0;
-				 _sceneData[x][y][z].blue = 0;
-			 }
-		 }
-	 }
+	_sceneData = new VoxelGrid(len,wid,hei,_layout);
 }
 
 /**
@@ -76,20 +147,15 @@ void Scene::AllocScene(){
  * /brief Deallocate scene memory
  */
 void Scene::DeallocScene(){
-	long long len = static_cast<long>((_sceneSize.length/_gridDim.length).get());
-	long long wid = static_cast<long>((_sceneSize.width/_gridDim.width).get());
-
-	for(long long x = 0; x <  len; ++x)
-	{
-		for(long long y = 0; y <  wid; ++y)
-		{
-			delete[] _sceneData[x][y];
-		}
-
-		delete[] _sceneData[x];
-	}
-
-	delete[] _sceneData;
+	delete _sceneData;
+	_sceneData = NULL;
+	if(!_fieldMapped) free(_distanceField);
+	_distanceField = NULL;
+	_fieldMapped = false;
+	
+	if(_mapping!=NULL) munmap(_mapping,_mappingSize);
+	_mapping = NULL;
+	_mappingSize = 0;
 }
 		
 /**
@@ -102,79 +168,1320 @@ Scene::~Scene(){
 }
 
 /**
- * /name CheckPoints 
- * /brief Checks the points in the points vector for intersection with scene objects. 
+ * /name ClipSegment
+ * /brief Clips the first "length" metres of a ray against the box [0,size] (slab test). Returns false if they miss
+ * the box, otherwise sets the distances along the ray at which it enters and leaves the box.
+ */
+static bool ClipSegment(const double origin[3],const double dir[3],double length,const double size[3],double& tEnter,double& tExit){
+	tEnter = 0.0;
+	tExit = length;
+	for(int axis=0;axis<3;++axis){
+		if(dir[axis]==0.0){
+			//parallel to this slab, so it must start inside it
+			if(origin[axis] < 0.0 || origin[axis] > size[axis]) return false;
+			continue;
+		}
+		double t0 = (0.0 - origin[axis]) / dir[axis];
+		double t1 = (size[axis] - origin[axis]) / dir[axis];
+		if(t0 > t1) std::swap(t0,t1);
+		tEnter = std::max(tEnter,t0);
+		tExit = std::min(tExit,t1);
+		if(tEnter > tExit) return false;
+	}
+	return true;
+}
+
+/**
+ * /name StartWalk
+ * /brief Sets up a 3D-DDA walk from the voxel containing the point at distance "t" along the ray.
+ */
+static void StartWalk(GridWalk& walk,const double origin[3],const double dir[3],const double cell[3],const long long count[3],double t){
+	walk.t = t;
+	for(int axis=0;axis<3;++axis){
+		double entry = origin[axis] + t*dir[axis];
+		walk.index[axis] = static_cast<long long>(floor(entry/cell[axis]));
+		walk.index[axis] = std::max(0LL,std::min(walk.index[axis],count[axis]-1));
+		
+		if(dir[axis] > 0.0){
+			walk.step[axis] = 1;
+			walk.tMax[axis] = ((walk.index[axis]+1)*cell[axis] - origin[axis]) / dir[axis];
+			walk.tDelta[axis] = cell[axis] / dir[axis];
+		} else if(dir[axis] < 0.0){
+			walk.step[axis] = -1;
+			walk.tMax[axis] = (walk.index[axis]*cell[axis] - origin[axis]) / dir[axis];
+			walk.tDelta[axis] = -cell[axis] / dir[axis];
+		} else {
+			walk.step[axis] = 0;
+			walk.tMax[axis] = std::numeric_limits<double>::infinity();
+			walk.tDelta[axis] = std::numeric_limits<double>::infinity();
+		}
+	}
+}
+
+/**
+ * /name FillHitRecord
+ * /brief Describes a hit on voxel "index", entered at distance "t" along the ray. The ray entered through the face
+ * its entry point lies on: of the faces of the voxel that face the ray, the one closest to that point.
  */
-pixel_t Scene::CheckPoints(std::vector<Point>& points) const{
+static void FillHitRecord(HitRecord& hit,const double origin[3],const double dir[3],const double cell[3],const long long index[3],double t,const pixel_t& pix){
+	double entry[3];
+	int faceAxis = -1;
+	double faceGap = std::numeric_limits<double>::infinity();
+	for(int axis=0;axis<3;++axis){
+		entry[axis] = origin[axis] + t*dir[axis];
+		hit.voxel[axis] = index[axis];
+		hit.normal[axis] = 0;
+		if(dir[axis]==0.0) continue;
+		
+		double face = ((dir[axis] > 0.0) ? index[axis] : index[axis] + 1) * cell[axis];
+		double gap = fabs(entry[axis] - face) / cell[axis];
+		if(gap < faceGap){
+			faceGap = gap;
+			faceAxis = axis;
+		}
+	}
+	
+	hit.hit = true;
+	hit.color = pix;
+	hit.distance = Distance(t);
+	hit.position = Point(Distance(entry[0]),Distance(entry[1]),Distance(entry[2]));
+	if(t > 0.0 && faceAxis >= 0) hit.normal[faceAxis] = (dir[faceAxis] > 0.0) ? -1 : 1;
+}
+
+/**
+ * /name CheckRay
+ * /brief Finds the first non-empty voxel along the ray, using an exact 3D-DDA (Amanatides & Woo) traversal. 
+ * The ray is clipped against the scene once, after which every voxel it crosses is visited exactly once, 
+ * using integer steps. Empty sparse bricks are skipped in one step, and if a distance field has been built,
+ * the ray leaps through empty space by the distance to the nearest occupied voxel.
+ * /notes If "hit" isn't NULL, it is set to the full description of the hit (or a miss).
+ */
+pixel_t Scene::CheckRay(const Ray& ray,HitRecord* hit) const{
 	static pixel_t emptyPix;
+	if(hit!=NULL) *hit = HitRecord();
+	
+	double tEnter,tExit;
+	if(!ClipRay(ray,tEnter,tExit)) return emptyPix;
+	
+	//The traversal works on raw doubles, since it needs per-axis indexing
+	const double origin[3] = {ray.origin.x.get(),ray.origin.y.get(),ray.origin.z.get()};
+	const double dir[3] = {ray.direction.x.get(),ray.direction.y.get(),ray.direction.z.get()};
+	const double cell[3] = {_gridDim.length.get(),_gridDim.width.get(),_gridDim.height.get()};
+	const double minCell = std::min(cell[0],std::min(cell[1],cell[2]));
+	const long long count[3] = {_sceneData->Dimension(0),_sceneData->Dimension(1),_sceneData->Dimension(2)};
+	
+	GridWalk walk;
+	StartWalk(walk,origin,dir,cell,count,tEnter);
+	
+	//Visit every voxel crossed by the ray, in order
+	const VoxelGrid& grid = *_sceneData;
+	const long long brickSize = grid.BrickDimension();
+	long long* index = walk.index;
+	long long* step = walk.step;
+	double* tMax = walk.tMax;
+	double* tDelta = walk.tDelta;
+	for(;;){
+		if(grid.IsEmptyBrick(index[0],index[1],index[2])){
+			//Skip the whole brick: find the axis along which the ray leaves it first...
+			int exitAxis = -1;
+			long long exitSteps = 0;
+			double tLeave = std::numeric_limits<double>::infinity();
+			for(int axis=0;axis<3;++axis){
+				if(step[axis]==0) continue;
+				long long steps = (step[axis] > 0) ? (brickSize - 1 - index[axis] % brickSize) : (index[axis] % brickSize);
+				double t = tMax[axis] + steps*tDelta[axis];
+				if(t < tLeave){
+					tLeave = t;
+					exitAxis = axis;
+					exitSteps = steps + 1;
+				}
+			}
+			if(exitAxis < 0 || tLeave > tExit) return emptyPix;
+			
+			//...then advance every axis to that point, crossing into the next brick along exitAxis
+			for(int axis=0;axis<3;++axis){
+				if(axis==exitAxis || step[axis]==0) continue;
+				while(tMax[axis] < tLeave){
+					index[axis] += step[axis];
+					tMax[axis] += tDelta[axis];
+				}
+				if(index[axis] < 0 || index[axis] >= count[axis]) return emptyPix;
+			}
+			index[exitAxis] += exitSteps*step[exitAxis];
+			tMax[exitAxis] += exitSteps*tDelta[exitAxis];
+			walk.t = tLeave;
+			if(index[exitAxis] < 0 || index[exitAxis] >= count[exitAxis]) return emptyPix;
+			continue;
+		}
+		
+		if(_distanceField!=NULL){
+			//Every point within "leap" of where the ray entered this voxel is empty, so jump straight past it
+			double leap = (sqrt(static_cast<double>(_distanceField[FieldIndex(index[0],index[1],index[2])])) - kSqrt3) * minCell;
+			if(leap > minCell){
+				if(walk.t + leap > tExit) return emptyPix;
+				StartWalk(walk,origin,dir,cell,count,walk.t + leap);
+				continue;
+			}
+		}
+		
+		const pixel_t& pix = grid(index[0],index[1],index[2]);
+		if(pix.red!=0 || pix.blue!=0 || pix.green!=0){
+			if(hit!=NULL) FillHitRecord(*hit,origin,dir,cell,index,walk.t,pix);
+			return pix;
+		}
+		
+		int axis = (tMax[0] < tMax[1]) ? ((tMax[0] < tMax[2]) ? 0 : 2) : ((tMax[1] < tMax[2]) ? 1 : 2);
+		if(tMax[axis] > tExit) return emptyPix;
+		
+		walk.t = tMax[axis];
+		index[axis] += step[axis];
+		if(index[axis] < 0 || index[axis] >= count[axis]) return emptyPix;
+		tMax[axis] += tDelta[axis];
+	}
+}
+ 
+/* Notes: Read-only view of the scene handed to the packet kernels. */
+struct PacketScene {
+	const VoxelGrid* grid;
+	const uint16_t* field;
+	double size[3];
+	double cell[3];
+	double minCell;
+	long long count[3];
+};
+
+/**
+ * /name StepLanes
+ * /brief Steps every active lane of a packet walk into its next voxel, and retires the lanes that leave their 
+ * segment or the grid. Works on W lanes at a time.
+ * /notes Written with GCC/Clang vector types, so every operation is a SIMD instruction of the target of the
+ * calling kernel. Compares give masks of all ones or all zeros, which select with bitwise operators only: the
+ * step has no branches. An index is inside the grid if neither it nor count-1-index is negative, which is tested
+ * on the sign bit, as SSE2 has no 64 bit compares.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+template<int W>
+struct LaneVectors {
+	typedef double Double __attribute__((vector_size(W*sizeof(double))));
+	typedef long long Int __attribute__((vector_size(W*sizeof(long long))));
+	typedef unsigned long long UInt __attribute__((vector_size(W*sizeof(long long))));
+};
+
+template<int N,int W>
+static RT_ALWAYS_INLINE void StepLanes(const PacketScene& scene,long long (&index)[3][N],const long long (&step)[3][N],double (&tMax)[3][N],const double (&tDelta)[3][N],double (&t)[N],const double (&tExit)[N],long long (&active)[N]){
+	typedef typename LaneVectors<W>::Double Double;
+	typedef typename LaneVectors<W>::Int Int;
+	typedef typename LaneVectors<W>::UInt UInt;
+	
+	for(int lane=0;lane<N;lane+=W){
+		Double tm[3],td[3],tv,te;
+		Int idx[3],st[3],live;
+		for(int axis=0;axis<3;++axis){
+			memcpy(&tm[axis],&tMax[axis][lane],sizeof(Double));
+			memcpy(&td[axis],&tDelta[axis][lane],sizeof(Double));
+			memcpy(&idx[axis],&index[axis][lane],sizeof(Int));
+			memcpy(&st[axis],&step[axis][lane],sizeof(Int));
+		}
+		memcpy(&tv,&t[lane],sizeof(Double));
+		memcpy(&te,&tExit[lane],sizeof(Double));
+		memcpy(&live,&active[lane],sizeof(Int));
+		
+		//Pick the axis whose boundary is nearest, and the time at which it is crossed
+		Int stepAxis[3];
+		const Int xBeforeY = tm[0] < tm[1];
+		stepAxis[0] = xBeforeY & (tm[0] < tm[2]);
+		stepAxis[1] = ~xBeforeY & (tm[1] < tm[2]);
+		stepAxis[2] = ~(stepAxis[0] | stepAxis[1]);
+		const Int tNext = ((Int)tm[0] & stepAxis[0]) | ((Int)tm[1] & stepAxis[1]) | ((Int)tm[2] & stepAxis[2]);
+		live &= ((Double)tNext <= te);
+		tv = (Double)((tNext & live) | ((Int)tv & ~live));
+		
+		//Cross it, adding 0 to the other axes and the retired lanes
+		Int outside = idx[0] ^ idx[0];
+		for(int axis=0;axis<3;++axis){
+			idx[axis] += st[axis] & (live & stepAxis[axis]);
+			tm[axis] += (Double)((Int)td[axis] & (live & stepAxis[axis]));
+			outside |= idx[axis] | ((scene.count[axis] - 1) - idx[axis]);
+		}
+		live &= (Int)(((UInt)outside >> 63) - 1);
+		
+		for(int axis=0;axis<3;++axis){
+			memcpy(&tMax[axis][lane],&tm[axis],sizeof(Double));
+			memcpy(&index[axis][lane],&idx[axis],sizeof(Int));
+		}
+		memcpy(&t[lane],&tv,sizeof(Double));
+		memcpy(&active[lane],&live,sizeof(Int));
+	}
+}
+#else
+template<int N,int W>
+static RT_ALWAYS_INLINE void StepLanes(const PacketScene& scene,long long (&index)[3][N],const long long (&step)[3][N],double (&tMax)[3][N],const double (&tDelta)[3][N],double (&t)[N],const double (&tExit)[N],long long (&active)[N]){
+	for(int lane=0;lane<N;++lane){
+		const bool stepX = tMax[0][lane] < tMax[1][lane] && tMax[0][lane] < tMax[2][lane];
+		const bool stepY = !(tMax[0][lane] < tMax[1][lane]) && tMax[1][lane] < tMax[2][lane];
+		const int axis = stepX ? 0 : (stepY ? 1 : 2);
+		if(!active[lane] || tMax[axis][lane] > tExit[lane]){
+			active[lane] = 0;
+			continue;
+		}
+		t[lane] = tMax[axis][lane];
+		index[axis][lane] += step[axis][lane];
+		tMax[axis][lane] += tDelta[axis][lane];
+		if(index[axis][lane] < 0 || index[axis][lane] >= scene.count[axis]) active[lane] = 0;
+	}
+}
+#endif
+
+/**
+ * /name TracePacketLanes
+ * /brief Traces rays first ... first+N-1 of the packet in lock-step, writing the first non-empty voxel of every 
+ * ray to "hits", and if "records" isn't NULL, the full hit records to "records". Lanes follow exactly the same 
+ * walk as CheckRay, so the results are identical.
+ * /notes Compiled once per instruction set (see TracePacket*), with SIMD vectors of W lanes. The clip, leap and
+ * fetch phases are per lane, the step phase (StepLanes) runs in SIMD lanes. Lanes are active while their mask in
+ * "active" is all ones.
+ */
+template<int N,int W>
+static RT_ALWAYS_INLINE void TracePacketLanes(const PacketScene& scene,const RayPacket& packet,int first,pixel_t* hits,HitRecord* records){
+	long long index[3][N];
+	long long step[3][N];
+	double tMax[3][N];
+	double tDelta[3][N];
+	double t[N];
+	double tExit[N];
+	long long active[N];
+	
+	//Clip every ray against the scene, and set up its walk. Lanes without a ray idle in voxel 0, so the step phase
+	//only ever sees defined values
+	for(int lane=0;lane<N;++lane){
+		const int ray = first + lane;
+		hits[lane].red = 0;
+		hits[lane].green = 0;
+		hits[lane].blue = 0;
+		if(records!=NULL) records[lane] = HitRecord();
+		for(int axis=0;axis<3;++axis){
+			index[axis][lane] = 0;
+			step[axis][lane] = 0;
+			tMax[axis][lane] = std::numeric_limits<double>::infinity();
+			tDelta[axis][lane] = 0.0;
+		}
+		t[lane] = 0.0;
+		tExit[lane] = 0.0;
+		active[lane] = 0;
+		if(ray >= packet.size) continue;
+		
+		const double origin[3] = {packet.originX[ray],packet.originY[ray],packet.originZ[ray]};
+		const double dir[3] = {packet.directionX[ray],packet.directionY[ray],packet.directionZ[ray]};
+		double tEnter;
+		if(!ClipSegment(origin,dir,packet.length[ray],scene.size,tEnter,tExit[lane])) continue;
+		
+		GridWalk walk;
+		StartWalk(walk,origin,dir,scene.cell,scene.count,tEnter);
+		for(int axis=0;axis<3;++axis){
+			index[axis][lane] = walk.index[axis];
+			step[axis][lane] = walk.step[axis];
+			tMax[axis][lane] = walk.tMax[axis];
+			tDelta[axis][lane] = walk.tDelta[axis];
+		}
+		t[lane] = walk.t;
+		active[lane] = -1;
+	}
+	
+	for(;;){
+		long long any = 0;
+		for(int lane=0;lane<N;++lane) any |= active[lane];
+		if(!any) return;
+		
+		//Leap the lanes that are far from any surface
+		if(scene.field!=NULL){
+			for(int lane=0;lane<N;++lane){
+				while(active[lane]){
+					size_t cell = static_cast<size_t>((index[0][lane]*scene.count[1] + index[1][lane])*scene.count[2] + index[2][lane]);
+					double leap = (sqrt(static_cast<double>(scene.field[cell])) - kSqrt3) * scene.minCell;
+					if(!(leap > scene.minCell)) break;
+					if(t[lane] + leap > tExit[lane]){
+						active[lane] = 0;
+						break;
+					}
+					
+					const int ray = first + lane;
+					const double origin[3] = {packet.originX[ray],packet.originY[ray],packet.originZ[ray]};
+					const double dir[3] = {packet.directionX[ray],packet.directionY[ray],packet.directionZ[ray]};
+					GridWalk walk;
+					StartWalk(walk,origin,dir,scene.cell,scene.count,t[lane] + leap);
+					for(int axis=0;axis<3;++axis){
+						index[axis][lane] = walk.index[axis];
+						tMax[axis][lane] = walk.tMax[axis];
+					}
+					t[lane] = walk.t;
+				}
+			}
+		}
+		
+		//Fetch the voxel of every lane, and retire the lanes that hit something
+		for(int lane=0;lane<N;++lane){
+			if(!active[lane]) continue;
+			const pixel_t& pix = (*scene.grid)(index[0][lane],index[1][lane],index[2][lane]);
+			if(pix.red!=0 || pix.blue!=0 || pix.green!=0){
+				hits[lane] = pix;
+				active[lane] = 0;
+				if(records!=NULL){
+					const int ray = first + lane;
+					const double origin[3] = {packet.originX[ray],packet.originY[ray],packet.originZ[ray]};
+					const double dir[3] = {packet.directionX[ray],packet.directionY[ray],packet.directionZ[ray]};
+					const long long voxel[3] = {index[0][lane],index[1][lane],index[2][lane]};
+					FillHitRecord(records[lane],origin,dir,scene.cell,voxel,t[lane],pix);
+				}
+			}
+		}
+		
+		//Step every remaining lane into its next voxel
+		StepLanes<N,W>(scene,index,step,tMax,tDelta,t,tExit,active);
+	}
+}
+
+/**
+ * /name TracePacket*
+ * /brief The packet kernel, compiled for every supported instruction set, at its natural packet width.
+ */
+static void TracePacketScalar(const PacketScene& scene,const RayPacket& packet,int first,pixel_t* hits,HitRecord* records){
+	TracePacketLanes<4,1>(scene,packet,first,hits,records);
+}
+
+#ifdef RT_PACKET_X86
+__attribute__((target("sse2")))
+static void TracePacketSSE2(const PacketScene& scene,const RayPacket& packet,int first,pixel_t* hits,HitRecord* records){
+	TracePacketLanes<4,2>(scene,packet,first,hits,records);
+}
+
+__attribute__((target("avx2")))
+static void TracePacketAVX2(const PacketScene& scene,const RayPacket& packet,int first,pixel_t* hits,HitRecord* records){
+	TracePacketLanes<8,4>(scene,packet,first,hits,records);
+}
+
+__attribute__((target("avx512f")))
+static void TracePacketAVX512(const PacketScene& scene,const RayPacket& packet,int first,pixel_t* hits,HitRecord* records){
+	TracePacketLanes<16,8>(scene,packet,first,hits,records);
+}
+#endif
+
+/**
+ * /name CheckPacket
+ * /brief Finds the first non-empty voxel along every ray in the packet, writing them to hits[0] ... hits[size-1]. 
+ * Gives the same results as CheckRay, using the packet kernel for the selected instruction set.
+ * /notes If "records" isn't NULL, the full hit records are written to records[0] ... records[size-1] in the same
+ * pass.
+ */
+void Scene::CheckPacket(const RayPacket& packet,pixel_t* hits,HitRecord* records) const{
+	//The sparse layout skips bricks per ray, so its rays are traced one by one
+	if(_layout==SPARSE_LAYOUT){
+		for(int lane=0;lane<packet.size;++lane){
+			Ray ray(Point(Distance(packet.originX[lane]),Distance(packet.originY[lane]),Distance(packet.originZ[lane])),
+					Point(Distance(packet.directionX[lane]),Distance(packet.directionY[lane]),Distance(packet.directionZ[lane])),
+					Distance(packet.length[lane]));
+			hits[lane] = CheckRay(ray,(records!=NULL) ? records + lane : NULL);
+		}
+		return;
+	}
+	
+	PacketScene scene;
+	scene.grid = _sceneData;
+	scene.field = _distanceField;
+	scene.size[0] = _sceneSize.length.get();
+	scene.size[1] = _sceneSize.width.get();
+	scene.size[2] = _sceneSize.height.get();
+	scene.cell[0] = _gridDim.length.get();
+	scene.cell[1] = _gridDim.width.get();
+	scene.cell[2] = _gridDim.height.get();
+	scene.minCell = std::min(scene.cell[0],std::min(scene.cell[1],scene.cell[2]));
+	for(int axis=0;axis<3;++axis) scene.count[axis] = _sceneData->Dimension(axis);
+	
+	void (*kernel)(const PacketScene&,const RayPacket&,int,pixel_t*,HitRecord*) = TracePacketScalar;
+	PacketISA isa = SelectedPacketISA();
+#ifdef RT_PACKET_X86
+	if(isa==SSE2_ISA) kernel = TracePacketSSE2;
+	if(isa==AVX2_ISA) kernel = TracePacketAVX2;
+	if(isa==AVX512_ISA) kernel = TracePacketAVX512;
+#endif
 	
-	for(auto it=points.begin();it!=points.end();++it){
-			Point tmp = *it;
-			if(ClipPoint(tmp)) return emptyPix;
-			pixel_t pix = *((Scene*)this)->At(tmp);
-			if(pix.red!=0 || pix.blue!=0 || pix.green!=0) return pix;
+	const int width = PacketWidth(isa);
+	for(int first=0;first<packet.size;first+=width){
+		kernel(scene,packet,first,hits + first,(records!=NULL) ? records + first : NULL);
 	}
-	return emptyPix;
 }
  
 /**
  * /name AddPlane
- * /brief Adds a plane to the current scene, clipping it if necessary.
+ * /brief Adds a plane to the current scene, clipping it if necessary. The plane is the box spanned by the two
+ * corners, and covers every voxel that box touches.
  */
 void Scene::AddPlane(Point p1,Point p2,pixel_t color){
-	ClipPoint(p1);
-	ClipPoint(p2);
+	AddBox(p1,p2,color,true);
+}
+
+/**
+ * /name AddRightCuboid
+ * /brief Adds a right cuboid, centred on "centroid", to the current scene, clipping it if necessary. A cuboid that
+ * is not solid is a one voxel thick shell.
+ */
+void Scene::AddRightCuboid(Point centroid,Size size,pixel_t color,bool solid){
+	const Distance halfLength = size.length * 0.5;
+	const Distance halfWidth = size.width * 0.5;
+	const Distance halfHeight = size.height * 0.5;
+	AddBox(Point(centroid.x - halfLength,centroid.y - halfWidth,centroid.z - halfHeight),Point(centroid.x + halfLength,centroid.y + halfWidth,centroid.z + halfHeight),color,solid);
+}
+
+/**
+ * /name AddSphere
+ * /brief Adds a sphere to the current scene, clipping it if necessary. It covers the voxels whose centre lies in
+ * the sphere; a sphere that is not solid is a one voxel thick shell.
+ */
+void Scene::AddSphere(Point centre,Distance radius,pixel_t color,bool solid){
+	const double c[3] = {centre.x.get(),centre.y.get(),centre.z.get()};
+	const double cell[3] = {_gridDim.length.get(),_gridDim.width.get(),_gridDim.height.get()};
+	const double r = radius.get();
+	if(!(r > 0.0)) return;
+	
+	long long lo[3] = {0,0,0},hi[3] = {-1,-1,-1};
+	for(int axis=0;axis<3;++axis){
+		lo[axis] = CellIndex(c[axis] - r,axis);
+		hi[axis] = CellIndex(c[axis] + r,axis);
+	}
+	
+	//The column through voxel centre (x,y) holds the chord of the sphere at that point
+	AddShape(lo,hi,[&](long long x,long long y,long long& z0,long long& z1){
+		const double dx = (x + 0.5)*cell[0] - c[0];
+		const double dy = (y + 0.5)*cell[1] - c[1];
+		const double chord = r*r - dx*dx - dy*dy;
+		if(chord < 0.0) return false;
+		const double h = sqrt(chord);
+		z0 = static_cast<long long>(ceil((c[2] - h) / cell[2] - 0.5));
+		z1 = static_cast<long long>(floor((c[2] + h) / cell[2] - 0.5));
+		return z0 <= z1;
+	},color,solid);
+}
+
+/**
+ * /name AddCylinder
+ * /brief Adds an upright (z axis) cylinder to the current scene, standing on "base", clipping it if necessary. It
+ * covers the columns whose centre lies within "radius" of the axis; a cylinder that is not solid is a one voxel 
+ * thick shell (closed at both ends).
+ */
+void Scene::AddCylinder(Point base,Distance radius,Distance height,pixel_t color,bool solid){
+	const double c[3] = {base.x.get(),base.y.get(),base.z.get()};
+	const double cell[3] = {_gridDim.length.get(),_gridDim.width.get(),_gridDim.height.get()};
+	const double r = radius.get();
+	if(!(r > 0.0) || height.get() < 0.0) return;
+	
+	long long lo[3],hi[3];
+	for(int axis=0;axis<2;++axis){
+		lo[axis] = CellIndex(c[axis] - r,axis);
+		hi[axis] = CellIndex(c[axis] + r,axis);
+	}
+	lo[2] = CellIndex(c[2],2);
+	hi[2] = CellIndex(c[2] + height.get(),2);
+	
+	AddShape(lo,hi,[&](long long x,long long y,long long& z0,long long& z1){
+		const double dx = (x + 0.5)*cell[0] - c[0];
+		const double dy = (y + 0.5)*cell[1] - c[1];
+		if(dx*dx + dy*dy > r*r) return false;
+		z0 = lo[2];
+		z1 = hi[2];
+		return true;
+	},color,solid);
+}
+
+/**
+ * /name TriangleOverlapsBox
+ * /brief Tests whether triangle "tri" overlaps the cube with centre "centre" and half size "half", touching 
+ * included (Akenine-Moller's separating axis test).
+ * /notes The candidate axes are the 9 cross products of the triangle edges with the coordinate axes, the 3 
+ * coordinate axes themselves (the bounding box test) and the triangle normal.
+ */
+static bool TriangleOverlapsBox(const double centre[3],double half,const double tri[3][3]){
+	double v[3][3];
+	for(int vertex=0;vertex<3;++vertex){
+		for(int axis=0;axis<3;++axis) v[vertex][axis] = tri[vertex][axis] - centre[axis];
+	}
+	
+	//Edge x axis tests
+	for(int edge=0;edge<3;++edge){
+		const double *a = v[edge];
+		const double *b = v[(edge + 1) % 3];
+		const double e[3] = {b[0] - a[0],b[1] - a[1],b[2] - a[2]};
+		for(int axis=0;axis<3;++axis){
+			const int a1 = (axis + 1) % 3;
+			const int a2 = (axis + 2) % 3;
+			double direction[3] = {0.0,0.0,0.0};
+			direction[a1] = -e[a2];
+			direction[a2] = e[a1];
+			const double p0 = v[0][a1]*direction[a1] + v[0][a2]*direction[a2];
+			const double p1 = v[1][a1]*direction[a1] + v[1][a2]*direction[a2];
+			const double p2 = v[2][a1]*direction[a1] + v[2][a2]*direction[a2];
+			const double r = half*(fabs(direction[a1]) + fabs(direction[a2]));
+			if(std::min(p0,std::min(p1,p2)) > r || std::max(p0,std::max(p1,p2)) < -r) return false;
+		}
+	}
+	
+	//Bounding box tests
+	for(int axis=0;axis<3;++axis){
+		if(std::min(v[0][axis],std::min(v[1][axis],v[2][axis])) > half) return false;
+		if(std::max(v[0][axis],std::max(v[1][axis],v[2][axis])) < -half) return false;
+	}
+	
+	//Plane test
+	const double e0[3] = {v[1][0] - v[0][0],v[1][1] - v[0][1],v[1][2] - v[0][2]};
+	const double e1[3] = {v[2][0] - v[1][0],v[2][1] - v[1][1],v[2][2] - v[1][2]};
+	const double n[3] = {e0[1]*e1[2] - e0[2]*e1[1],e0[2]*e1[0] - e0[0]*e1[2],e0[0]*e1[1] - e0[1]*e1[0]};
+	const double d = n[0]*v[0][0] + n[1]*v[0][1] + n[2]*v[0][2];
+	return fabs(d) <= half*(fabs(n[0]) + fabs(n[1]) + fabs(n[2]));
+}
+
+/**
+ * /name TriangleBounds
+ * /brief Computes the voxels [lo,hi] touched by the bounding box of "tri" (in voxel units). Returns false if the
+ * box lies outside [from,to].
+ */
+static bool TriangleBounds(const double tri[3][3],const long long from[3],const long long to[3],long long lo[3],long long hi[3]){
+	for(int axis=0;axis<3;++axis){
+		const double low = std::min(tri[0][axis],std::min(tri[1][axis],tri[2][axis]));
+		const double high = std::max(tri[0][axis],std::max(tri[1][axis],tri[2][axis]));
+		lo[axis] = std::max(from[axis],static_cast<long long>(ceil(low)) - 1);
+		hi[axis] = std::min(to[axis],static_cast<long long>(floor(high)));
+		if(!(lo[axis] <= hi[axis])) return false;
+	}
+	return true;
+}
+
+/**
+ * /name VoxelizeTriangle
+ * /brief Sets every voxel in [from,to] that triangle "tri" (in voxel units) overlaps to "color".
+ * /notes The columns along the dominant axis of the normal are walked, and only the voxels of a column between
+ * the heights of the triangle's plane at the column's corners are tested.
+ */
+static void VoxelizeTriangle(VoxelGrid& grid,const double tri[3][3],const long long from[3],const long long to[3],pixel_t color){
+	long long lo[3],hi[3];
+	if(!TriangleBounds(tri,from,to,lo,hi)) return;
+	
+	const double e0[3] = {tri[1][0] - tri[0][0],tri[1][1] - tri[0][1],tri[1][2] - tri[0][2]};
+	const double e1[3] = {tri[2][0] - tri[1][0],tri[2][1] - tri[1][1],tri[2][2] - tri[1][2]};
+	const double n[3] = {e0[1]*e1[2] - e0[2]*e1[1],e0[2]*e1[0] - e0[0]*e1[2],e0[0]*e1[1] - e0[1]*e1[0]};
+	const int k = (fabs(n[0]) > fabs(n[1])) ? ((fabs(n[0]) > fabs(n[2])) ? 0 : 2) : ((fabs(n[1]) > fabs(n[2])) ? 1 : 2);
+	const int a = (k + 1) % 3;
+	const int b = (k + 2) % 3;
+	const double d = n[0]*tri[0][0] + n[1]*tri[0][1] + n[2]*tri[0][2];
+	
+	long long cell[3];
+	double centre[3];
+	for(cell[a]=lo[a];cell[a]<=hi[a];++cell[a]){
+		for(cell[b]=lo[b];cell[b]<=hi[b];++cell[b]){
+			long long k0 = lo[k],k1 = hi[k];
+			if(n[k]!=0.0){
+				double low = std::numeric_limits<double>::max();
+				double high = -low;
+				for(int corner=0;corner<4;++corner){
+					const double pa = static_cast<double>(cell[a] + (corner & 1));
+					const double pb = static_cast<double>(cell[b] + (corner >> 1));
+					const double height = (d - n[a]*pa - n[b]*pb) / n[k];
+					low = std::min(low,height);
+					high = std::max(high,height);
+				}
+				k0 = std::max(k0,static_cast<long long>(ceil(low)) - 1);
+				k1 = std::min(k1,static_cast<long long>(floor(high)));
+			}
+			centre[a] = cell[a] + 0.5;
+			centre[b] = cell[b] + 0.5;
+			for(cell[k]=k0;cell[k]<=k1;++cell[k]){
+				centre[k] = cell[k] + 0.5;
+				if(TriangleOverlapsBox(centre,0.5,tri)) grid(cell[0],cell[1],cell[2]) = color;
+			}
+		}
+	}
+}
+
+/**
+ * /name AddMesh
+ * /brief Adds a triangle mesh, placed at "origin", to the current scene, clipping it if necessary. Every voxel a
+ * triangle touches is set to the triangle's colour, or "color" if the mesh has no colours.
+ * /notes The voxelization is conservative, so meshes of triangles smaller than a voxel stay watertight. Triangles 
+ * are binned by the kMeshRegionSize cubes they touch, and threads voxelize whole regions (clipping the triangles 
+ * to them), so no two threads ever write the same voxel. Triangles are voxelized in file order within a region,
+ * so where triangles of different colours share a voxel, the last one wins, whatever the number of threads. 
+ */
+void Scene::AddMesh(const Mesh& mesh,Point origin,pixel_t color){
+	const double offset[3] = {origin.x.get(),origin.y.get(),origin.z.get()};
+	const double cell[3] = {_gridDim.length.get(),_gridDim.width.get(),_gridDim.height.get()};
+	const long long first[3] = {0,0,0};
+	const long long last[3] = {_sceneData->Dimension(0)-1,_sceneData->Dimension(1)-1,_sceneData->Dimension(2)-1};
+	const size_t numTriangles = mesh.NumTriangles();
+	if(numTriangles==0) return;
+	
+	//The triangle in voxel units
+	auto triangle = [&](size_t idx,double tri[3][3]){
+		mesh.Triangle(idx,tri);
+		for(int vertex=0;vertex<3;++vertex){
+			for(int axis=0;axis<3;++axis) tri[vertex][axis] = (tri[vertex][axis] + offset[axis]) / cell[axis];
+		}
+	};
+	
+	//Bin the triangles by region (counting sort, so every bin lists its triangles in order)
+	long long regions[3];
+	for(int axis=0;axis<3;++axis) regions[axis] = (last[axis] + kMeshRegionSize) / kMeshRegionSize;
+	const size_t numRegions = static_cast<size_t>(regions[0]*regions[1]*regions[2]);
+	std::vector<size_t> binStart(numRegions + 1,0);
+	std::vector<uint32_t> bins;
+	for(int pass=0;pass<2;++pass){
+		if(pass==1){
+			for(size_t region=0;region<numRegions;++region) binStart[region+1] += binStart[region];
+			bins.resize(binStart[numRegions]);
+		}
+		std::vector<size_t> next(binStart.begin(),binStart.end() - 1);
+		for(size_t idx=0;idx<numTriangles;++idx){
+			double tri[3][3];
+			long long lo[3],hi[3];
+			triangle(idx,tri);
+			if(!TriangleBounds(tri,first,last,lo,hi)) continue;
+			for(long long rx=lo[0]/kMeshRegionSize;rx<=hi[0]/kMeshRegionSize;++rx){
+				for(long long ry=lo[1]/kMeshRegionSize;ry<=hi[1]/kMeshRegionSize;++ry){
+					for(long long rz=lo[2]/kMeshRegionSize;rz<=hi[2]/kMeshRegionSize;++rz){
+						const size_t region = static_cast<size_t>((rx*regions[1] + ry)*regions[2] + rz);
+						if(pass==0) binStart[region+1]++;
+						else bins[next[region]++] = static_cast<uint32_t>(idx);
+					}
+				}
+			}
+		}
+	}
+	if(bins.empty()) return;
+	_revision++;
 	
-	//ERROR: need proper directory checking
-	for(auto x = p1.x; x <= p2.x; x = x + _gridDim.length){
-		for(auto y = p1.y; y <= p2.y; y = y + _gridDim.width){
-			for(auto z = p1.z; z <= p2.z; z = z + _gridDim.height){
-				At(Point(x,y,z))->red = color.red;
-				At(Point(x,y,z))->blue = color.blue;
-				At(Point(x,y,z))->green = color.green;
+	//Voxelize, one region at a time per thread. Sparse grids allocate bricks while filling, so they are filled on 
+	//one thread
+	VoxelGrid& grid = *_sceneData;
+	const unsigned int numThreads = (_layout==SPARSE_LAYOUT || bins.size() < static_cast<size_t>(kMeshRegionSize)) ? 1 : 0;
+	ThreadPool::RunOnce(numRegions,numThreads,[&](size_t region){
+		const long long r[3] = {static_cast<long long>(region) / (regions[1]*regions[2]),(static_cast<long long>(region) / regions[2]) % regions[1],static_cast<long long>(region) % regions[2]};
+		long long from[3],to[3];
+		for(int axis=0;axis<3;++axis){
+			from[axis] = r[axis]*kMeshRegionSize;
+			to[axis] = std::min(from[axis] + kMeshRegionSize - 1,last[axis]);
+		}
+		for(size_t entry=binStart[region];entry<binStart[region+1];++entry){
+			double tri[3][3];
+			pixel_t triangleColor = color;
+			triangle(bins[entry],tri);
+			mesh.TriangleColor(bins[entry],triangleColor);
+			if(triangleColor.red==0 && triangleColor.green==0 && triangleColor.blue==0){
+				//(0,0,0) marks empty voxels
+				triangleColor.red = triangleColor.green = triangleColor.blue = 1;
 			}
-		}	
+			VoxelizeTriangle(grid,tri,from,to,triangleColor);
+		}
+	});
+	
+	//The mesh may be scattered over the whole scene, so the distance field (if any) is rebuilt
+	if(_distanceField!=NULL) BuildDistanceField();
+}
+
+/**
+ * /name ResolvePointColor
+ * /brief Picks the colour of a voxel from the colours (24 bit RGB) of the points in it, in file order.
+ */
+static pixel_t ResolvePointColor(const uint64_t *colors,size_t count,PointColorPolicy policy,std::vector<uint64_t>& scratch){
+	uint32_t rgb = static_cast<uint32_t>(colors[count - 1]);
+	if(policy==AVERAGE_POINT_COLOR){
+		uint64_t sum[3] = {0,0,0};
+		for(size_t idx=0;idx<count;++idx){
+			for(int channel=0;channel<3;++channel) sum[channel] += (colors[idx] >> (16 - 8*channel)) & 0xFF;
+		}
+		rgb = 0;
+		for(int channel=0;channel<3;++channel) rgb |= static_cast<uint32_t>((sum[channel] + count/2) / count) << (16 - 8*channel);
+	} else if(policy==MAJORITY_POINT_COLOR && count > 1){
+		//Sort the colours, tagged with their position, and take the longest run (the latest one on ties)
+		scratch.resize(count);
+		for(size_t idx=0;idx<count;++idx) scratch[idx] = ((colors[idx] & 0xFFFFFF) << 32) | idx;
+		std::sort(scratch.begin(),scratch.end());
+		size_t bestCount = 0,bestLast = 0;
+		for(size_t first=0,last=0;first<count;first=last){
+			while(last < count && (scratch[last] >> 32)==(scratch[first] >> 32)) ++last;
+			const size_t position = scratch[last - 1] & 0xFFFFFFFF;
+			if(last - first > bestCount || (last - first==bestCount && position > bestLast)){
+				bestCount = last - first;
+				bestLast = position;
+				rgb = static_cast<uint32_t>(scratch[first] >> 32);
+			}
+		}
 	}
+	
+	pixel_t color;
+	color.red = static_cast<uint8_t>(rgb >> 16);
+	color.green = static_cast<uint8_t>(rgb >> 8);
+	color.blue = static_cast<uint8_t>(rgb);
+	return color;
 }
 
+/**
+ * /name AddPointCloud
+ * /brief Adds a point cloud, placed at "origin", to the current scene, clipping it if necessary. Every voxel 
+ * holding points gets a colour picked from theirs by "policy", or "color" if the cloud has no colours. Returns 0 
+ * on success; if the cloud can't be read, the scene is left unchanged.
+ * /notes Two passes, both spread over all cores without locks. First, threads read chunks of the cloud and bin 
+ * the points by the kPointRegionSize cubes of voxels they fall in, as (voxel in region, colour) records. Then 
+ * threads take whole regions, gather their records from all chunks in file order, sort them by voxel (keeping 
+ * the file order) and resolve every voxel's colour. Sparse grids allocate bricks while filling, so they are 
+ * filled on one thread (but still read in parallel).
+ */
+int Scene::AddPointCloud(const PointCloud& cloud,Point origin,pixel_t color,PointColorPolicy policy){
+	const double offset[3] = {origin.x.get(),origin.y.get(),origin.z.get()};
+	const double cell[3] = {_gridDim.length.get(),_gridDim.width.get(),_gridDim.height.get()};
+	const long long count[3] = {_sceneData->Dimension(0),_sceneData->Dimension(1),_sceneData->Dimension(2)};
+	const size_t numChunks = cloud.NumChunks();
+	const uint64_t defaultColor = (static_cast<uint64_t>(color.red) << 16) | (static_cast<uint64_t>(color.green) << 8) | color.blue;
+	
+	long long regions[3];
+	for(int axis=0;axis<3;++axis) regions[axis] = (count[axis] + kPointRegionSize - 1) / kPointRegionSize;
+	const size_t numRegions = static_cast<size_t>(regions[0]*regions[1]*regions[2]);
+	
+	//Records: the voxel within its region in the upper bits, the colour in the lower 24 bits
+	struct ChunkBins {
+		std::vector<uint64_t> records;
+		std::vector<uint32_t> regionStart;
+	};
+	std::vector<ChunkBins> bins(numChunks);
+	std::atomic<bool> failed(false);
+	
+	//Pass 1: read and bin the chunks
+	ThreadPool::RunOnce(numChunks,0,[&](size_t chunk){
+		if(failed) return;
+		std::vector<CloudPoint> points;
+		if(cloud.ReadChunk(chunk,points)!=SUCCESS){
+			failed = true;
+			return;
+		}
+		
+		std::vector<uint32_t> pointRegions;
+		std::vector<uint64_t> records;
+		ChunkBins& bin = bins[chunk];
+		bin.regionStart.assign(numRegions + 1,0);
+		for(auto it=points.begin();it!=points.end();++it){
+			const double position[3] = {it->x + offset[0],it->y + offset[1],it->z + offset[2]};
+			long long voxel[3];
+			bool inside = true;
+			for(int axis=0;axis<3 && inside;++axis){
+				const double index = floor(position[axis] / cell[axis]);
+				inside = (index >= 0.0 && index < static_cast<double>(count[axis]));
+				voxel[axis] = inside ? static_cast<long long>(index) : 0;
+			}
+			if(!inside) continue;
+			
+			const uint32_t region = static_cast<uint32_t>(((voxel[0] / kPointRegionSize)*regions[1] + voxel[1] / kPointRegionSize)*regions[2] + voxel[2] / kPointRegionSize);
+			const uint64_t local = static_cast<uint64_t>(((voxel[0] % kPointRegionSize)*kPointRegionSize + voxel[1] % kPointRegionSize)*kPointRegionSize + voxel[2] % kPointRegionSize);
+			uint64_t rgb = (static_cast<uint64_t>(it->color.red) << 16) | (static_cast<uint64_t>(it->color.green) << 8) | it->color.blue;
+			if(!cloud.HasColors()) rgb = defaultColor;
+			pointRegions.push_back(region);
+			records.push_back((local << 24) | rgb);
+			bin.regionStart[region + 1]++;
+		}
 		
+		//Counting sort by region, keeping the file order within every region
+		for(size_t region=0;region<numRegions;++region) bin.regionStart[region + 1] += bin.regionStart[region];
+		std::vector<uint32_t> next(bin.regionStart.begin(),bin.regionStart.end() - 1);
+		bin.records.resize(records.size());
+		for(size_t idx=0;idx<records.size();++idx) bin.records[next[pointRegions[idx]]++] = records[idx];
+	});
+	if(failed) return ERROR;
+	
+	//Pass 2: resolve the voxels, one region at a time per thread
+	VoxelGrid& grid = *_sceneData;
+	_revision++;
+	ThreadPool::RunOnce(numRegions,(_layout==SPARSE_LAYOUT) ? 1 : 0,[&](size_t region){
+		size_t numRecords = 0;
+		for(size_t chunk=0;chunk<numChunks;++chunk) numRecords += bins[chunk].regionStart[region + 1] - bins[chunk].regionStart[region];
+		if(numRecords==0) return;
+		
+		std::vector<uint64_t> records,scratch;
+		records.reserve(numRecords);
+		for(size_t chunk=0;chunk<numChunks;++chunk){
+			const ChunkBins& bin = bins[chunk];
+			records.insert(records.end(),bin.records.begin() + bin.regionStart[region],bin.records.begin() + bin.regionStart[region + 1]);
+		}
+		std::stable_sort(records.begin(),records.end(),[](uint64_t a,uint64_t b){ return (a >> 24) < (b >> 24); });
+		
+		const long long base[3] = {static_cast<long long>(region) / (regions[1]*regions[2]) * kPointRegionSize,(static_cast<long long>(region) / regions[2]) % regions[1] * kPointRegionSize,static_cast<long long>(region) % regions[2] * kPointRegionSize};
+		for(size_t first=0,last=0;first<records.size();first=last){
+			const uint64_t local = records[first] >> 24;
+			while(last < records.size() && (records[last] >> 24)==local) ++last;
+			pixel_t voxelColor = ResolvePointColor(&records[first],last - first,policy,scratch);
+			if(voxelColor.red==0 && voxelColor.green==0 && voxelColor.blue==0){
+				//(0,0,0) marks empty voxels
+				voxelColor.red = voxelColor.green = voxelColor.blue = 1;
+			}
+			const long long x = base[0] + static_cast<long long>(local / (kPointRegionSize*kPointRegionSize));
+			const long long y = base[1] + static_cast<long long>((local / kPointRegionSize) % kPointRegionSize);
+			const long long z = base[2] + static_cast<long long>(local % kPointRegionSize);
+			grid(x,y,z) = voxelColor;
+		}
+	});
+	
+	//The points may be scattered over the whole scene, so the distance field (if any) is rebuilt
+	if(_distanceField!=NULL) BuildDistanceField();
+	return SUCCESS;
+}
+
 /**
- * /name AddRightCuboid
- * /brief Adds a AddRightCuboid to the current scene, clipping it if necessary.
+ * /name AddBox
+ * /brief Adds the box spanned by corners p1 and p2 (in any order), covering every voxel the box touches.
+ */
+void Scene::AddBox(Point p1,Point p2,pixel_t color,bool solid){
+	const double a[3] = {p1.x.get(),p1.y.get(),p1.z.get()};
+	const double b[3] = {p2.x.get(),p2.y.get(),p2.z.get()};
+	long long lo[3],hi[3];
+	for(int axis=0;axis<3;++axis){
+		lo[axis] = CellIndex(std::min(a[axis],b[axis]),axis);
+		hi[axis] = CellIndex(std::max(a[axis],b[axis]),axis);
+	}
+	
+	AddShape(lo,hi,[&](long long x,long long y,long long& z0,long long& z1){
+		if(x < lo[0] || x > hi[0] || y < lo[1] || y > hi[1]) return false;
+		z0 = lo[2];
+		z1 = hi[2];
+		return true;
+	},color,solid);
+}
+
+/**
+ * /name CellIndex
+ * /brief Returns the index, along "axis", of the voxel holding "coordinate" (in metres). Coordinates outside the
+ * scene give indices outside the grid.
  */
-void Scene::AddRightCuboid(Point centroid, Size size){
+long long Scene::CellIndex(double coordinate,int axis) const{
+	const double cell = (axis==0) ? _gridDim.length.get() : ((axis==1) ? _gridDim.width.get() : _gridDim.height.get());
+	return static_cast<long long>(floor(coordinate / cell));
 }
 
 /**
- * /name ClipPoint
- * /brief Performs clipping on the point, modifies the point if required. Returns true if clipped.
+ * /name FillColumns
+ * /brief Voxelizes the columns x in [x0,x1) and y in [y0,y1] of a shape (see AddShape), each as one or two spans.
+ * /notes For a shell, only voxels with a 6-neighbour outside the shape are set. The interior of a column is where
+ * its four neighbouring columns overlap it (inner ends excluded), so the shell never has gaps.
+ */
+template<typename Span>
+static void FillColumns(VoxelGrid& grid,long long x0,long long x1,long long y0,long long y1,const Span& span,pixel_t color,bool solid){
+	const long long lastZ = grid.Dimension(2) - 1;
+	auto fill = [&](long long x,long long y,long long z0,long long z1){
+		grid.FillSpan(x,y,std::max(z0,0LL),std::min(z1,lastZ),color);
+	};
+	
+	for(long long x=x0;x<x1;++x){
+		for(long long y=y0;y<=y1;++y){
+			long long z0,z1;
+			if(!span(x,y,z0,z1)) continue;
+			if(solid){
+				fill(x,y,z0,z1);
+				continue;
+			}
+			
+			const long long nx[4] = {x-1,x+1,x,x};
+			const long long ny[4] = {y,y,y-1,y+1};
+			long long inner0 = z0 + 1,inner1 = z1 - 1;
+			for(int n=0;n<4 && inner0<=inner1;++n){
+				long long n0,n1;
+				if(!span(nx[n],ny[n],n0,n1)){
+					inner1 = inner0 - 1;
+					break;
+				}
+				inner0 = std::max(inner0,n0);
+				inner1 = std::min(inner1,n1);
+			}
+			if(inner0 > inner1){
+				fill(x,y,z0,z1);
+			} else {
+				fill(x,y,z0,inner0-1);
+				fill(x,y,inner1+1,z1);
+			}
+		}
+	}
+}
+
+/**
+ * /name AddShape
+ * /brief Voxelizes a shape within the voxel box [lo,hi]. "span(x,y,z0,z1)" gives the first and last voxel of the
+ * shape in column (x,y), returning false if the column is empty.
+ * /notes The box is clipped to the grid, but "span" is also asked about columns just outside it (for shells), so
+ * shapes cut by the scene boundary are open there. Large shapes are split into slabs of x, one per core; sparse 
+ * grids allocate bricks while filling, so they are filled on one thread. Afterwards, the distance field is lowered
+ * around the box, which is conservative for shapes that don't fill it.
+ */
+template<typename Span>
+void Scene::AddShape(const long long lo[3],const long long hi[3],const Span& span,pixel_t color,bool solid){
+	long long from[3],to[3];
+	for(int axis=0;axis<3;++axis){
+		from[axis] = std::max(lo[axis],0LL);
+		to[axis] = std::min(hi[axis],_sceneData->Dimension(axis) - 1);
+		if(from[axis] > to[axis]) return;
+	}
+	_revision++;
+	
+	const long long numVoxels = (to[0] - from[0] + 1) * (to[1] - from[1] + 1) * (to[2] - from[2] + 1);
+	long long numSlabs = std::max(1U,std::thread::hardware_concurrency());
+	if(_layout==SPARSE_LAYOUT || numVoxels < kParallelFillVoxels) numSlabs = 1;
+	numSlabs = std::min(numSlabs,to[0] - from[0] + 1);
+	
+	VoxelGrid& grid = *_sceneData;
+	const long long slab = (to[0] - from[0] + numSlabs) / numSlabs;
+	numSlabs = (to[0] - from[0] + slab) / slab;
+	ThreadPool::RunOnce(static_cast<size_t>(numSlabs),static_cast<unsigned int>(numSlabs),[&](size_t index){
+		const long long x = from[0] + static_cast<long long>(index) * slab;
+		FillColumns(grid,x,std::min(x + slab,to[0] + 1),from[1],to[1],span,color,solid);
+	});
+	
+	//Keep the distance field (if any) up to date with the new voxels
+	if(_distanceField!=NULL) UpdateDistanceField(from,to);
+}
+/**
+ * /name ExportVoxels
+ * /brief Copies all voxels to "voxels" in [x][y][z] order, whatever the layout of the scene. The buffer must hold
+ * GridDimension(0) * GridDimension(1) * GridDimension(2) voxels.
  */
-bool Scene::ClipPoint(Point& point) const{
-	Point oldPoint = point;
-	if(point.x < 0.0_m) point.x = 0.0_m;
-	if(point.x > _sceneSize.length) point.x = _sceneSize.length;
-	if(point.y < 0.0_m) point.y = 0.0_m;
-	if(point.y > _sceneSize.width) point.y = _sceneSize.width;
-	if(point.z < 0.0_m) point.z = 0.0_m;
-	if(point.z > _sceneSize.height) point.z = _sceneSize.height;
-	return !(oldPoint==point);
+void Scene::ExportVoxels(pixel_t* voxels) const{
+	const long long dim[3] = {_sceneData->Dimension(0),_sceneData->Dimension(1),_sceneData->Dimension(2)};
+	for(long long x=0;x<dim[0];++x){
+		for(long long y=0;y<dim[1];++y){
+			for(long long z=0;z<dim[2];++z){
+				*voxels++ = (*_sceneData)(x,y,z);
+			}
+		}
+	}
+}
+		
+/**
+ * /name ClipRay
+ * /brief Clips the ray against the scene box (slab test). Returns false if the ray misses the scene, otherwise sets
+ * the distances along the ray at which it enters and leaves the scene.
+ */
+bool Scene::ClipRay(const Ray& ray,double& tEnter,double& tExit) const{
+	const double origin[3] = {ray.origin.x.get(),ray.origin.y.get(),ray.origin.z.get()};
+	const double dir[3] = {ray.direction.x.get(),ray.direction.y.get(),ray.direction.z.get()};
+	const double size[3] = {_sceneSize.length.get(),_sceneSize.width.get(),_sceneSize.height.get()};
+	return ClipSegment(origin,dir,ray.length.get(),size,tEnter,tExit);
 }
 
 /**
  * /name At
- * /brief Returns pixel at the Point "pix"
+ * /brief Returns pixel at the Point "pix". Points on the far faces of the scene map to the last voxel.
  */
 pixel_t* Scene::At(Point pix){
-	int idx,idy,idz;
-	idx = (pix.x / _gridDim.length).get();
-	idy = (pix.y / _gridDim.width).get();
-	idz = (pix.z / _gridDim.height).get();
-	return _sceneData[idx][idy]  + idz;
+	long long index[3];
+	VoxelIndex(pix,index);
+	return &(*_sceneData)(index[0],index[1],index[2]);
+}
+
+/**
+ * /name At (const)
+ * /brief Returns pixel at the Point "pix", for reading only. Does not allocate sparse bricks.
+ */
+const pixel_t* Scene::At(Point pix) const{
+	long long index[3];
+	VoxelIndex(pix,index);
+	const VoxelGrid& grid = *_sceneData;
+	return &grid(index[0],index[1],index[2]);
+}
+
+/**
+ * /name VoxelIndex
+ * /brief Computes the index of the voxel containing the (clipped) Point "pix". Points on the far faces of the 
+ * scene map to the last voxel.
+ */
+void Scene::VoxelIndex(Point pix,long long index[3]) const{
+	index[0] = std::min(static_cast<long long>((pix.x / _gridDim.length).get()),_sceneData->Dimension(0)-1);
+	index[1] = std::min(static_cast<long long>((pix.y / _gridDim.width).get()),_sceneData->Dimension(1)-1);
+	index[2] = std::min(static_cast<long long>((pix.z / _gridDim.height).get()),_sceneData->Dimension(2)-1);
+}
+
+/**
+ * /name DistanceTransform1D
+ * /brief Exact 1D squared Euclidean distance transform (Felzenszwalb & Huttenlocher) of the n samples in f, 
+ * written to d. v and z are scratch buffers of at least n and n+1 elements.
+ */
+static void DistanceTransform1D(const long long *f,long long *d,long long n,long long *v,double *z){
+	long long k = 0;
+	v[0] = 0;
+	z[0] = -std::numeric_limits<double>::infinity();
+	z[1] = std::numeric_limits<double>::infinity();
+	for(long long q=1;q<n;++q){
+		//Intersection of the parabola from q with the lowest parabola so far (z[0] stops the search)
+		double s = static_cast<double>((f[q] + q*q) - (f[v[k]] + v[k]*v[k])) / static_cast<double>(2*(q - v[k]));
+		while(s <= z[k]){
+			--k;
+			s = static_cast<double>((f[q] + q*q) - (f[v[k]] + v[k]*v[k])) / static_cast<double>(2*(q - v[k]));
+		}
+		++k;
+		v[k] = q;
+		z[k] = s;
+		z[k+1] = std::numeric_limits<double>::infinity();
+	}
+	
+	k = 0;
+	for(long long q=0;q<n;++q){
+		while(z[k+1] < q) ++k;
+		d[q] = (q - v[k])*(q - v[k]) + f[v[k]];
+	}
+}
+
+/**
+ * /name DistanceTransformPass
+ * /brief Runs the 1D distance transform along one axis of the field, over lines [first,last). Lines are numbered
+ * by their two remaining indices, the field is stored in [x][y][z] order.
+ */
+static void DistanceTransformPass(uint16_t *field,const long long count[3],int axis,long long first,long long last){
+	const long long stride[3] = {count[1]*count[2],count[2],1};
+	const int a1 = (axis==0) ? 1 : 0;
+	const int a2 = (axis==2) ? 1 : 2;
+	const long long n = count[axis];
+	
+	std::vector<long long> f(n),d(n),v(n);
+	std::vector<double> z(n+1);
+	for(long long line=first;line<last;++line){
+		uint16_t *base = field + (line / count[a2])*stride[a1] + (line % count[a2])*stride[a2];
+		for(long long i=0;i<n;++i) f[i] = base[i*stride[axis]];
+		DistanceTransform1D(&f[0],&d[0],n,&v[0],&z[0]);
+		for(long long i=0;i<n;++i) base[i*stride[axis]] = static_cast<uint16_t>(std::min<long long>(d[i],kMaxFieldValue));
+	}
+}
+
+/**
+ * /name BuildDistanceField
+ * /brief Builds a field holding, for every voxel, the (squared) distance to the nearest non-empty voxel. Rays use 
+ * it to leap through empty space. The field is kept up to date by AddPlane afterwards. Returns 0 on success.
+ * /notes The field is dense, so it is not built for SPARSE_LAYOUT scenes (which skip empty bricks instead).
+ * The separable transform runs one pass per axis, spreading the lines of every pass over all cores.
+ */
+int Scene::BuildDistanceField(){
+	if(_layout==SPARSE_LAYOUT) return ERROR;
+	
+	const long long count[3] = {_sceneData->Dimension(0),_sceneData->Dimension(1),_sceneData->Dimension(2)};
+	if(_distanceField==NULL){
+		_distanceField = static_cast<uint16_t*>(malloc(static_cast<size_t>(count[0]*count[1]*count[2])*sizeof(uint16_t)));
+		if(_distanceField==NULL) return ERROR;
+	}
+	
+	//Seed the field: zero for non-empty voxels, "far" for empty ones
+	const VoxelGrid& grid = *_sceneData;
+	for(long long x=0;x<count[0];++x){
+		for(long long y=0;y<count[1];++y){
+			uint16_t *line = _distanceField + FieldIndex(x,y,0);
+			for(long long z=0;z<count[2];++z){
+				const pixel_t& pix = grid(x,y,z);
+				line[z] = (pix.red!=0 || pix.blue!=0 || pix.green!=0) ? 0 : kMaxFieldValue;
+			}
+		}
+	}
+	
+	//One pass per axis, every pass split over the available cores
+	const long long numThreads = std::max(1U,std::thread::hardware_concurrency());
+	for(int axis=2;axis>=0;--axis){
+		const long long numLines = (count[0]*count[1]*count[2]) / count[axis];
+		const long long linesPerThread = (numLines + numThreads - 1) / numThreads;
+		const long long numBlocks = (numLines + linesPerThread - 1) / linesPerThread;
+		ThreadPool::RunOnce(static_cast<size_t>(numBlocks),0,[&](size_t block){
+			const long long first = static_cast<long long>(block) * linesPerThread;
+			DistanceTransformPass(_distanceField,count,axis,first,std::min(first + linesPerThread,numLines));
+		});
+	}
+	return SUCCESS;
+}
+
+/**
+ * /name UpdateDistanceField
+ * /brief Lowers the distance field around the newly filled voxel box [lo,hi]. Adding voxels can only bring the 
+ * nearest voxel closer, so the distance to the box is merged in, within kMaxFieldDistance of the box.
+ */
+void Scene::UpdateDistanceField(const long long lo[3],const long long hi[3]){
+	long long from[3],to[3];
+	for(int axis=0;axis<3;++axis){
+		from[axis] = std::max(0LL,std::min(lo[axis],hi[axis]) - kMaxFieldDistance);
+		to[axis] = std::min(_sceneData->Dimension(axis)-1,std::max(lo[axis],hi[axis]) + kMaxFieldDistance);
+	}
+	
+	for(long long x=from[0];x<=to[0];++x){
+		long long dx = std::max(0LL,std::max(lo[0]-x,x-hi[0]));
+		for(long long y=from[1];y<=to[1];++y){
+			long long dy = std::max(0LL,std::max(lo[1]-y,y-hi[1]));
+			uint16_t *line = _distanceField + FieldIndex(x,y,0);
+			for(long long z=from[2];z<=to[2];++z){
+				long long dz = std::max(0LL,std::max(lo[2]-z,z-hi[2]));
+				long long distance = std::min<long long>(dx*dx + dy*dy + dz*dz,kMaxFieldValue);
+				if(distance < line[z]) line[z] = static_cast<uint16_t>(distance);
+			}
+		}
+	}
+}
+
+
+/**
+ * /name AlignOffset
+ * /brief Rounds a scene file offset up to the next section boundary.
+ */
+static uint64_t AlignOffset(uint64_t offset){
+	return (offset + kSceneFileAlignment - 1) / kSceneFileAlignment * kSceneFileAlignment;
+}
+
+/**
+ * /name WriteSection
+ * /brief Pads the file with zeroes up to "offset", then writes "length" bytes of "data". Returns false on failure.
+ */
+static bool WriteSection(FILE *fp,uint64_t offset,const void *data,size_t length){
+	long position = ftell(fp);
+	if(position < 0 || static_cast<uint64_t>(position) > offset) return false;
+	for(uint64_t idx=static_cast<uint64_t>(position);idx<offset;++idx){
+		if(fputc(0,fp)==EOF) return false;
+	}
+	return length==0 || fwrite(data,1,length,fp)==length;
+}
+
+/**
+ * /name Save
+ * /brief Saves the scene (voxels, and the distance field if built) to a binary scene file, which Load() maps back
+ * in. Returns 0 on success.
+ * /notes The file is written under a temporary name and then renamed, so processes loading the scene never map
+ * a partial file.
+ */
+int Scene::Save(const std::string& path) const{
+	SceneFileHeader header;
+	memset(&header,0,sizeof(header));
+	memcpy(header.magic,kSceneFileMagic,sizeof(header.magic));
+	header.version = kSceneFileVersion;
+	header.byteOrder = kSceneFileByteOrder;
+	header.layout = static_cast<uint32_t>(_layout);
+	header.sceneSize[0] = _sceneSize.length.get();
+	header.sceneSize[1] = _sceneSize.width.get();
+	header.sceneSize[2] = _sceneSize.height.get();
+	header.voxelSize[0] = _gridDim.length.get();
+	header.voxelSize[1] = _gridDim.width.get();
+	header.voxelSize[2] = _gridDim.height.get();
+	for(int axis=0;axis<3;++axis) header.dimension[axis] = _sceneData->Dimension(axis);
+	header.numVoxels = _sceneData->NumVoxels();
+	
+	//Lay out the sections
+	const size_t voxelBytes = _sceneData->NumVoxels()*sizeof(pixel_t);
+	const size_t brickMapBytes = _sceneData->BrickMapSize()*sizeof(uint32_t);
+	const size_t fieldBytes = (_distanceField!=NULL) ? FieldIndex(header.dimension[0],0,0)*sizeof(uint16_t) : 0;
+	uint64_t offset = AlignOffset(sizeof(header));
+	header.voxelOffset = offset;
+	offset = AlignOffset(offset + voxelBytes);
+	if(brickMapBytes > 0){
+		header.brickMapOffset = offset;
+		offset = AlignOffset(offset + brickMapBytes);
+	}
+	if(fieldBytes > 0){
+		header.fieldOffset = offset;
+		offset = AlignOffset(offset + fieldBytes);
+	}
+	header.fileSize = offset;
+	
+	std::stringstream ss;
+	ss << path << "." << getpid() << ".tmp";
+	FILE *fp = fopen(ss.str().c_str(),"wb");
+	if(!fp) return ERROR;
+	bool ok = WriteSection(fp,0,&header,sizeof(header));
+	ok = ok && WriteSection(fp,header.voxelOffset,_sceneData->Voxels(),voxelBytes);
+	if(brickMapBytes > 0) ok = ok && WriteSection(fp,header.brickMapOffset,_sceneData->BrickMap(),brickMapBytes);
+	if(fieldBytes > 0) ok = ok && WriteSection(fp,header.fieldOffset,_distanceField,fieldBytes);
+	ok = ok && WriteSection(fp,header.fileSize,NULL,0);
+	if(fclose(fp)!=0) ok = false;
+	
+	if(!ok || rename(ss.str().c_str(),path.c_str())!=0){
+		remove(ss.str().c_str());
+		return ERROR;
+	}
+	return SUCCESS;
+}
+
+/**
+ * /name ValidSceneHeader
+ * /brief Checks a scene file header against the size of the file, so a damaged file is never read past its end.
+ */
+static bool ValidSceneHeader(const SceneFileHeader& header,size_t fileSize){
+	if(memcmp(header.magic,kSceneFileMagic,sizeof(header.magic))!=0) return false;
+	if(header.version!=kSceneFileVersion || header.byteOrder!=kSceneFileByteOrder) return false;
+	if(header.layout > SPARSE_LAYOUT || header.fileSize!=fileSize) return false;
+	
+	uint64_t numCells = 1;
+	for(int axis=0;axis<3;++axis){
+		if(!(header.voxelSize[axis] > 0.0) || header.dimension[axis] <= 0) return false;
+		if(static_cast<int64_t>(header.sceneSize[axis] / header.voxelSize[axis])!=header.dimension[axis]) return false;
+		numCells *= static_cast<uint64_t>(header.dimension[axis]);
+	}
+	
+	if(header.voxelOffset < sizeof(header) || header.numVoxels > (fileSize - std::min<uint64_t>(fileSize,header.voxelOffset)) / sizeof(pixel_t)) return false;
+	if(header.fieldOffset!=0){
+		if(header.fieldOffset % sizeof(uint16_t)!=0 || numCells > (fileSize - std::min<uint64_t>(fileSize,header.fieldOffset)) / sizeof(uint16_t)) return false;
+	}
+	return header.brickMapOffset % sizeof(uint32_t)==0 && header.brickMapOffset <= fileSize;
 }
 
 /**
- * /name ClipRightCuboid
- * /brief Performs clipping on the Right Cuboid, modifies the points defining the plane if required.
+ * /name Load
+ * /brief Replaces the scene by the one in a scene file written by Save(). Returns 0 on success, and leaves the 
+ * scene as it was on failure.
+ * /notes The file is mapped rather than read, so loading takes the same (short) time for any scene size, and 
+ * voxels are only paged in as rays reach them. The mapping is private: every process rendering the same scene 
+ * shares the same physical pages, and a page is only copied when this process modifies it (e.g. AddPlane).
  */
-void Scene::ClipRightCuboid(Point& centroid, Size& size){
-}
\ No newline at end of file
+int Scene::Load(const std::string& path){
+	int fd = open(path.c_str(),O_RDONLY);
+	if(fd < 0) return ERROR;
+	struct stat info;
+	if(fstat(fd,&info)!=0 || static_cast<size_t>(info.st_size) < sizeof(SceneFileHeader)){
+		close(fd);
+		return ERROR;
+	}
+	const size_t fileSize = static_cast<size_t>(info.st_size);
+	void *mapping = mmap(NULL,fileSize,PROT_READ | PROT_WRITE,MAP_PRIVATE,fd,0);
+	close(fd);
+	if(mapping==MAP_FAILED) return ERROR;
+	
+	uint8_t *file = static_cast<uint8_t*>(mapping);
+	const SceneFileHeader& header = *reinterpret_cast<const SceneFileHeader*>(file);
+	if(!ValidSceneHeader(header,fileSize)){
+		munmap(mapping,fileSize);
+		return ERROR;
+	}
+	
+	VoxelGrid *grid = NULL;
+	const VoxelLayout layout = static_cast<VoxelLayout>(header.layout);
+	uint32_t *brickMap = (header.brickMapOffset!=0) ? reinterpret_cast<uint32_t*>(file + header.brickMapOffset) : NULL;
+	try {
+		grid = new VoxelGrid(header.dimension[0],header.dimension[1],header.dimension[2],layout,reinterpret_cast<pixel_t*>(file + header.voxelOffset),header.numVoxels,brickMap);
+	} catch (std::bad_alloc &ba) {
+		munmap(mapping,fileSize);
+		return ERROR;
+	}
+	
+	//The grid must fit the file: dense grids in the voxel section, sparse brick maps in theirs, pointing at bricks
+	bool valid = (layout!=SPARSE_LAYOUT) ? grid->NumVoxels() <= header.numVoxels : brickMap!=NULL;
+	if(valid && layout==SPARSE_LAYOUT){
+		const uint64_t numBricks = header.numVoxels / (grid->BrickDimension()*grid->BrickDimension()*grid->BrickDimension());
+		valid = grid->BrickMapSize() <= (fileSize - header.brickMapOffset) / sizeof(uint32_t);
+		for(size_t idx=0;valid && idx<grid->BrickMapSize();++idx){
+			valid = brickMap[idx] <= numBricks;
+		}
+	}
+	if(!valid){
+		delete grid;
+		munmap(mapping,fileSize);
+		return ERROR;
+	}
+	
+	DeallocScene();
+	_sceneData = grid;
+	_layout = layout;
+	_sceneSize = Size(Distance(header.sceneSize[0]),Distance(header.sceneSize[1]),Distance(header.sceneSize[2]));
+	_gridDim = Size(Distance(header.voxelSize[0]),Distance(header.voxelSize[1]),Distance(header.voxelSize[2]));
+	_distanceField = (header.fieldOffset!=0) ? reinterpret_cast<uint16_t*>(file + header.fieldOffset) : NULL;
+	_fieldMapped = (_distanceField!=NULL);
+	_mapping = mapping;
+	_mappingSize = fileSize;
+	_revision++;
+	return SUCCESS;
+}
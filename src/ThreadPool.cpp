@@ -0,0 +1,149 @@
+
+/**
+ *      ___           ___           ___           ___
+ *     /\  \         /\  \         /\  \         /\__\
+ *    /::\  \       /::\  \       /::\  \       /:/  /
+ *   /:/\:\  \     /:/\ \  \     /:/\:\  \     /:/  /
+ *  /::\~\:\  \   _\:\~\ \  \   /::\~\:\  \   /:/  /
+ * /:/\:\ \:\__\ /\ \:\ \ \__\ /:/\:\ \:\__\ /:/__/
+ * \/__\:\/:/  / \:\ \:\ \/__/ \/_|::\/:/  / \:\  \
+ *      \::/  /   \:\ \:\__\      |:|::/  /   \:\  \
+ *      /:/  /     \:\/:/  /      |:|\/__/     \:\  \
+ *     /:/  /       \::/  /       |:|  |        \:\__\
+ *     \/__/         \/__/         \|__|         \/__/
+ * -----------------------------------------------------
+ * /name    ThreadPool
+ * /brief   Persistent work-stealing thread pool, used to spread rendering work over all cores.
+ * /author  Erik E. Beerepoot
+ */
+
+#include "ThreadPool.hpp"
+
+/**
+ * /name ThreadPool
+ * /brief Starts "numThreads" worker threads. When numThreads is 0, one worker per hardware thread is started.
+ */
+ThreadPool::ThreadPool(unsigned int numThreads) : _task(NULL), _remaining(0), _generation(0), _stopping(false) {
+	if(numThreads==0) numThreads = std::thread::hardware_concurrency();
+	if(numThreads==0) numThreads = 1;
+	
+	for(unsigned int id=0;id<numThreads;++id){
+		_queues.push_back(new WorkQueue());
+	}
+	for(unsigned int id=0;id<numThreads;++id){
+		_threads.push_back(std::thread(&ThreadPool::WorkerLoop,this,id));
+	}
+}
+
+/**
+ * /name ~ThreadPool
+ * /brief Stops and joins all worker threads.
+ */
+ThreadPool::~ThreadPool(){
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		_stopping = true;
+	}
+	_wake.notify_all();
+	
+	for(auto it=_threads.begin();it!=_threads.end();++it) it->join();
+	for(auto it=_queues.begin();it!=_queues.end();++it) delete *it;
+}
+
+/**
+ * /name Run
+ * /brief Runs task(0) ... task(numTasks-1) on the workers, and blocks until all of them have finished.
+ * /notes Tasks must not throw, and must not call Run on the same pool.
+ */
+void ThreadPool::Run(size_t numTasks,const std::function<void(size_t)>& task){
+	if(numTasks==0) return;
+	
+	std::unique_lock<std::mutex> guard(_lock);
+	_task = &task;
+	_remaining = numTasks;
+	
+	//Hand every worker a contiguous range of tasks
+	size_t numQueues = _queues.size();
+	for(size_t id=0;id<numQueues;++id){
+		std::lock_guard<std::mutex> queueGuard(_queues[id]->lock);
+		for(size_t index=id*numTasks/numQueues;index<(id+1)*numTasks/numQueues;++index){
+			_queues[id]->tasks.push_back(index);
+		}
+	}
+	++_generation;
+	_wake.notify_all();
+	
+	_done.wait(guard,[this]{ return _remaining==0; });
+	_task = NULL;
+}
+
+/**
+ * /name RunOnce
+ * /brief Runs task(0) ... task(numTasks-1) on up to "numThreads" threads started for this batch (0 for one per 
+ * hardware thread), the calling thread included, and blocks until all of them have finished.
+ * /notes For callers that don't own a pool, like the scene builders. Threads take the next task from a shared 
+ * counter, so tasks of uneven size balance out.
+ */
+void ThreadPool::RunOnce(size_t numTasks,unsigned int numThreads,const std::function<void(size_t)>& task){
+	if(numThreads==0) numThreads = std::thread::hardware_concurrency();
+	if(numThreads==0) numThreads = 1;
+	if(numThreads > numTasks) numThreads = static_cast<unsigned int>(numTasks);
+	
+	std::atomic<size_t> next(0);
+	auto worker = [&](){
+		for(size_t index=next++;index<numTasks;index=next++) task(index);
+	};
+	std::vector<std::thread> threads;
+	for(unsigned int id=1;id<numThreads;++id) threads.push_back(std::thread(worker));
+	worker();
+	for(auto it=threads.begin();it!=threads.end();++it) it->join();
+}
+
+/**
+ * /name PopTask
+ * /brief Takes the next task from the front of this worker's queue, or steals one from the back of another queue.
+ * Returns false when there is no work left.
+ */
+bool ThreadPool::PopTask(unsigned int id,size_t& task){
+	size_t numQueues = _queues.size();
+	for(size_t offset=0;offset<numQueues;++offset){
+		WorkQueue *queue = _queues[(id + offset) % numQueues];
+		std::lock_guard<std::mutex> guard(queue->lock);
+		if(queue->tasks.empty()) continue;
+		
+		if(offset==0){
+			task = queue->tasks.front();
+			queue->tasks.pop_front();
+		} else {
+			task = queue->tasks.back();
+			queue->tasks.pop_back();
+		}
+		return true;
+	}
+	return false;
+}
+
+/**
+ * /name WorkerLoop
+ * /brief Main loop of worker "id": sleeps until a batch is started, then runs tasks until none are left.
+ */
+void ThreadPool::WorkerLoop(unsigned int id){
+	unsigned long generation = 0;
+	for(;;){
+		{
+			std::unique_lock<std::mutex> guard(_lock);
+			_wake.wait(guard,[this,generation]{ return _stopping || _generation!=generation; });
+			if(_stopping) return;
+			generation = _generation;
+		}
+		
+		size_t task;
+		while(PopTask(id,task)){
+			(*_task)(task);
+			if(--_remaining==0){
+				std::lock_guard<std::mutex> guard(_lock);
+				_done.notify_all();
+			}
+		}
+	}
+}
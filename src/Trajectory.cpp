@@ -0,0 +1,200 @@
+
+/**
+ *      ___           ___           ___           ___
+ *     /\  \         /\  \         /\  \         /\__\
+ *    /::\  \       /::\  \       /::\  \       /:/  /
+ *   /:/\:\  \     /:/\ \  \     /:/\:\  \     /:/  /
+ *  /::\~\:\  \   _\:\~\ \  \   /::\~\:\  \   /:/  /
+ * /:/\:\ \:\__\ /\ \:\ \ \__\ /:/\:\ \:\__\ /:/__/
+ * \/__\:\/:/  / \:\ \:\ \/__/ \/_|::\/:/  / \:\  \
+ *      \::/  /   \:\ \:\__\      |:|::/  /   \:\  \
+ *      /:/  /     \:\/:/  /      |:|\/__/     \:\  \
+ *     /:/  /       \::/  /       |:|  |        \:\__\
+ *     \/__/         \/__/         \|__|         \/__/
+ * -----------------------------------------------------
+ * /name    Trajectory
+ * /brief   Timestamped camera trajectory, with linear (position) and SLERP (orientation) interpolation.
+ * /author  Erik E. Beerepoot
+ */
+
+#include "Trajectory.hpp"
+#include "GenericTypes.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+/**
+ * /name ToQuaternion
+ * /brief Converts roll, pitch and yaw (rotations about x, y and z, applied in that order) to a unit quaternion.
+ */
+Trajectory::Quaternion Trajectory::ToQuaternion(const Orientation& orientation){
+	const double cr = cos(orientation.roll.get()/2), sr = sin(orientation.roll.get()/2);
+	const double cp = cos(orientation.pitch.get()/2), sp = sin(orientation.pitch.get()/2);
+	const double cy = cos(orientation.yaw.get()/2), sy = sin(orientation.yaw.get()/2);
+	
+	Quaternion q;
+	q.w = cr*cp*cy + sr*sp*sy;
+	q.x = sr*cp*cy - cr*sp*sy;
+	q.y = cr*sp*cy + sr*cp*sy;
+	q.z = cr*cp*sy - sr*sp*cy;
+	return q;
+}
+
+/**
+ * /name ToOrientation
+ * /brief Converts a unit quaternion back to roll, pitch and yaw.
+ */
+Orientation Trajectory::ToOrientation(const Quaternion& q){
+	double roll = atan2(2*(q.w*q.x + q.y*q.z),1 - 2*(q.x*q.x + q.y*q.y));
+	double sinPitch = std::max(-1.0,std::min(1.0,2*(q.w*q.y - q.z*q.x)));
+	double pitch = asin(sinPitch);
+	double yaw = atan2(2*(q.w*q.z + q.x*q.y),1 - 2*(q.y*q.y + q.z*q.z));
+	return Orientation(Angle(roll),Angle(pitch),Angle(yaw));
+}
+
+/**
+ * /name Slerp
+ * /brief Interpolates between unit quaternions a (s=0) and b (s=1) along the shortest arc.
+ */
+Trajectory::Quaternion Trajectory::Slerp(Quaternion a,Quaternion b,double s){
+	double dot = a.w*b.w + a.x*b.x + a.y*b.y + a.z*b.z;
+	
+	//q and -q are the same rotation, take the one on the short arc
+	if(dot < 0.0){
+		b.w = -b.w; b.x = -b.x; b.y = -b.y; b.z = -b.z;
+		dot = -dot;
+	}
+	
+	double wa, wb;
+	if(dot > 0.9995){
+		//nearly parallel: linear interpolation is exact enough, and avoids dividing by sin(~0)
+		wa = 1.0 - s;
+		wb = s;
+	} else {
+		double theta = acos(dot);
+		wa = sin((1.0 - s)*theta) / sin(theta);
+		wb = sin(s*theta) / sin(theta);
+	}
+	
+	Quaternion q;
+	q.w = wa*a.w + wb*b.w;
+	q.x = wa*a.x + wb*b.x;
+	q.y = wa*a.y + wb*b.y;
+	q.z = wa*a.z + wb*b.z;
+	double norm = sqrt(q.w*q.w + q.x*q.x + q.y*q.y + q.z*q.z);
+	q.w /= norm; q.x /= norm; q.y /= norm; q.z /= norm;
+	return q;
+}
+
+/**
+ * /name Load
+ * /brief Reads the poses from a trajectory file (see Trajectory.hpp for the format). Returns 0 on success.
+ */
+int Trajectory::Load(const std::string& filePath){
+	std::ifstream file(filePath.c_str());
+	if(file.fail()) return ERROR;
+	
+	std::string line;
+	while(std::getline(file,line)){
+		line = line.substr(0,line.find('#'));
+		std::istringstream fields(line);
+		std::vector<double> values;
+		double value;
+		while(fields >> value) values.push_back(value);
+		if(values.empty()) continue;
+		
+		TimedPose timed;
+		timed.time = values[0];
+		if(values.size()==7){
+			for(int axis=0;axis<3;++axis) timed.position[axis] = values[1+axis];
+			timed.rotation = ToQuaternion(Orientation(Angle(values[4]),Angle(values[5]),Angle(values[6])));
+		} else if(values.size()==8){
+			for(int axis=0;axis<3;++axis) timed.position[axis] = values[1+axis];
+			Quaternion q = {values[7],values[4],values[5],values[6]};
+			double norm = sqrt(q.w*q.w + q.x*q.x + q.y*q.y + q.z*q.z);
+			if(norm==0.0) return ERROR;
+			q.w /= norm; q.x /= norm; q.y /= norm; q.z /= norm;
+			timed.rotation = q;
+		} else {
+			return ERROR;
+		}
+		_poses.push_back(timed);
+	}
+	
+	std::stable_sort(_poses.begin(),_poses.end(),[](const TimedPose& a,const TimedPose& b){ return a.time < b.time; });
+	return _poses.empty() ? ERROR : SUCCESS;
+}
+
+/**
+ * /name AddPose
+ * /brief Adds the pose at time "time".
+ */
+void Trajectory::AddPose(Time time,const Pose& pose){
+	TimedPose timed;
+	timed.time = time.get();
+	timed.position[0] = pose.centre.x.get();
+	timed.position[1] = pose.centre.y.get();
+	timed.position[2] = pose.centre.z.get();
+	timed.rotation = ToQuaternion(pose.orientation);
+	
+	auto after = std::upper_bound(_poses.begin(),_poses.end(),timed,[](const TimedPose& a,const TimedPose& b){ return a.time < b.time; });
+	_poses.insert(after,timed);
+}
+
+/**
+ * /name PoseAt
+ * /brief Returns the pose at time t, interpolated between the poses around it.
+ */
+Pose Trajectory::PoseAt(Time t) const{
+	if(_poses.empty()) return Pose(Point(0.0_m,0.0_m,0.0_m),Orientation(0.0_rad,0.0_rad,0.0_rad));
+	
+	//first pose after t
+	const double time = t.get();
+	auto after = std::upper_bound(_poses.begin(),_poses.end(),time,[](double t,const TimedPose& p){ return t < p.time; });
+	const TimedPose& b = (after==_poses.end()) ? _poses.back() : *after;
+	const TimedPose& a = (after==_poses.begin()) ? _poses.front() : *(after-1);
+	
+	double s = (b.time > a.time) ? (time - a.time) / (b.time - a.time) : 0.0;
+	s = std::max(0.0,std::min(1.0,s));
+	
+	double position[3];
+	for(int axis=0;axis<3;++axis) position[axis] = a.position[axis] + s*(b.position[axis] - a.position[axis]);
+	return Pose(Point(Distance(position[0]),Distance(position[1]),Distance(position[2])),ToOrientation(Slerp(a.rotation,b.rotation,s)));
+}
+
+/**
+ * /name VelocityAt
+ * /brief Returns the mean velocity between t and t+interval, e.g. to move a rolling shutter camera during a frame.
+ */
+Velocity Trajectory::VelocityAt(Time t,Time interval) const{
+	const double dt = interval.get();
+	if(dt <= 0.0) return Velocity(LinearVelocity(0.0),LinearVelocity(0.0),LinearVelocity(0.0),AngularVelocity(0.0),AngularVelocity(0.0),AngularVelocity(0.0));
+	
+	Pose p0 = PoseAt(t);
+	Pose p1 = PoseAt(t + interval);
+	
+	//angle differences are wrapped, so crossing +-pi does not spin the camera
+	const double angles[3] = {(p1.orientation.roll - p0.orientation.roll).get(),(p1.orientation.pitch - p0.orientation.pitch).get(),(p1.orientation.yaw - p0.orientation.yaw).get()};
+	double rates[3];
+	for(int axis=0;axis<3;++axis) rates[axis] = remainder(angles[axis],2*M_PI) / dt;
+	
+	return Velocity(LinearVelocity((p1.centre.x - p0.centre.x).get()/dt),LinearVelocity((p1.centre.y - p0.centre.y).get()/dt),LinearVelocity((p1.centre.z - p0.centre.z).get()/dt),
+					AngularVelocity(rates[0]),AngularVelocity(rates[1]),AngularVelocity(rates[2]));
+}
+
+/**
+ * /name StartTime
+ * /brief Returns the time of the first pose.
+ */
+Time Trajectory::StartTime() const{
+	return Time(_poses.empty() ? 0.0 : _poses.front().time);
+}
+
+/**
+ * /name EndTime
+ * /brief Returns the time of the last pose.
+ */
+Time Trajectory::EndTime() const{
+	return Time(_poses.empty() ? 0.0 : _poses.back().time);
+}
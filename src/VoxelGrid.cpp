@@ -0,0 +1,199 @@
+
+/**
+ *      ___           ___           ___           ___
+ *     /\  \         /\  \         /\  \         /\__\
+ *    /::\  \       /::\  \       /::\  \       /:/  /
+ *   /:/\:\  \     /:/\ \  \     /:/\:\  \     /:/  /
+ *  /::\~\:\  \   _\:\~\ \  \   /::\~\:\  \   /:/  /
+ * /:/\:\ \:\__\ /\ \:\ \ \__\ /:/\:\ \:\__\ /:/__/
+ * \/__\:\/:/  / \:\ \:\ \/__/ \/_|::\/:/  / \:\  \
+ *      \::/  /   \:\ \:\__\      |:|::/  /   \:\  \
+ *      /:/  /     \:\/:/  /      |:|\/__/     \:\  \
+ *     /:/  /       \::/  /       |:|  |        \:\__\
+ *     \/__/         \/__/         \|__|         \/__/
+ * -----------------------------------------------------
+ * /name    VoxelGrid
+ * /brief   Contiguous voxel storage for the Scene class, with a selectable memory layout.
+ * /author  Erik E. Beerepoot
+ */
+
+#include "VoxelGrid.hpp"
+
+#include <new>
+#include <limits>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+const long long kBrickSize = 4;
+
+/**
+ * /name VoxelGrid
+ * /brief Constructs a grid of sizeX x sizeY x sizeZ empty voxels, stored using "layout".
+ * /notes Throws an std::bad_alloc exception when out of memory. The buffer comes from calloc, so the zero-fill
+ * is done lazily by the OS instead of voxel by voxel.
+ */
+VoxelGrid::VoxelGrid(long long sizeX,long long sizeY,long long sizeZ,VoxelLayout layout) : _voxels(NULL), _numVoxels(0), _layout(layout), _brickMap(NULL), _ownsStorage(true) {
+	SetDimensions(sizeX,sizeY,sizeZ);
+	
+	if(_layout==SPARSE_LAYOUT){
+		//Only the brick map is allocated up front, bricks are allocated as they are written
+		_brickMap = static_cast<uint32_t*>(calloc(BrickMapSize(),sizeof(uint32_t)));
+		if(_brickMap==NULL) throw std::bad_alloc();
+		return;
+	}
+
+	_voxels = static_cast<pixel_t*>(calloc(_numVoxels,sizeof(pixel_t)));
+	if(_voxels==NULL) throw std::bad_alloc();
+}
+
+/**
+ * /name VoxelGrid
+ * /brief Constructs a grid on top of existing storage (e.g. a mapped scene file), which the grid does not free.
+ * "voxels" holds "numVoxels" voxels in "layout" order; for the sparse layout these are the bricks, and "brickMap"
+ * is the brick map.
+ * /notes The caller checks the storage is large enough against NumVoxels() and BrickMapSize(). Sparse bricks are 
+ * copied, as the brick pool grows when voxels are added; the brick map is used in place.
+ */
+VoxelGrid::VoxelGrid(long long sizeX,long long sizeY,long long sizeZ,VoxelLayout layout,pixel_t *voxels,size_t numVoxels,uint32_t *brickMap) : _voxels(NULL), _numVoxels(0), _layout(layout), _brickMap(NULL), _ownsStorage(false) {
+	SetDimensions(sizeX,sizeY,sizeZ);
+	
+	if(_layout==SPARSE_LAYOUT){
+		_brickMap = brickMap;
+		_brickPool.assign(voxels,voxels + numVoxels);
+		return;
+	}
+	_voxels = voxels;
+}
+
+/**
+ * /name SetDimensions
+ * /brief Sets the size of the grid, and works out the size of the voxel buffer for the layout.
+ */
+void VoxelGrid::SetDimensions(long long sizeX,long long sizeY,long long sizeZ){
+	_dimension[0] = sizeX;
+	_dimension[1] = sizeY;
+	_dimension[2] = sizeZ;
+	_emptyVoxel.red = 0;
+	_emptyVoxel.green = 0;
+	_emptyVoxel.blue = 0;
+	
+	long long brickSize = kBrickSize;
+	if(_layout==SPARSE_LAYOUT) brickSize = BrickDimension();
+	if(_layout==MORTON_LAYOUT) brickSize = 1LL << kMortonTileShift;
+	for(int axis=0;axis<3;++axis){
+		_bricks[axis] = (_dimension[axis] + brickSize - 1) / brickSize;
+	}
+	
+	switch(_layout){
+		case SPARSE_LAYOUT:
+			_numVoxels = 0;
+			break;
+		case MORTON_LAYOUT:
+			_numVoxels = static_cast<size_t>(_bricks[0]*_bricks[1]*_bricks[2]) << (3*kMortonTileShift);
+			break;
+		case BRICK_LAYOUT:
+			_numVoxels = static_cast<size_t>(_bricks[0]*_bricks[1]*_bricks[2]) * kBrickSize*kBrickSize*kBrickSize;
+			break;
+		default:
+			_numVoxels = static_cast<size_t>(sizeX*sizeY*sizeZ);
+			break;
+	}
+}
+
+/**
+ * /name ~VoxelGrid
+ * /brief Destructor for VoxelGrid class
+ */
+VoxelGrid::~VoxelGrid(){
+	if(_ownsStorage){
+		free(_voxels);
+		free(_brickMap);
+	}
+	_voxels = NULL;
+	_brickMap = NULL;
+}
+
+/**
+ * /name AllocateVoxel
+ * /brief Returns voxel (x,y,z) of a sparse grid for writing, allocating an empty brick for it if required.
+ * /notes Throws an std::bad_alloc exception when out of memory, or when the brick map is full.
+ */
+pixel_t& VoxelGrid::AllocateVoxel(long long x,long long y,long long z){
+	uint32_t& brick = _brickMap[BrickIndex(x,y,z)];
+	if(brick==0){
+		size_t numBricks = _brickPool.size() / kSparseBrickVoxels;
+		if(numBricks >= std::numeric_limits<uint32_t>::max()) throw std::bad_alloc();
+		
+		_brickPool.resize(_brickPool.size() + kSparseBrickVoxels,_emptyVoxel);
+		brick = static_cast<uint32_t>(numBricks + 1);
+	}
+	return _brickPool[static_cast<size_t>(brick-1)*kSparseBrickVoxels + Index(x,y,z)];
+}
+
+/**
+ * /name FillPixels
+ * /brief Sets "count" consecutive pixels to "color".
+ * /notes Grey values are a plain memset. Otherwise the colour is repeated in a 16 pixel (48 byte) block, which is
+ * copied as a whole; the fixed size copies compile to vector stores.
+ */
+static void FillPixels(pixel_t *pixels,size_t count,pixel_t color){
+	const size_t kBlockSize = 16;
+	if(color.red==color.green && color.green==color.blue){
+		memset(pixels,color.red,count*sizeof(pixel_t));
+		return;
+	}
+	
+	pixel_t block[kBlockSize];
+	std::fill_n(block,kBlockSize,color);
+	size_t idx = 0;
+	for(;idx + kBlockSize <= count;idx += kBlockSize){
+		memcpy(pixels + idx,block,sizeof(block));
+	}
+	std::fill_n(pixels + idx,count - idx,color);
+}
+
+/**
+ * /name FillSpan
+ * /brief Sets voxels (x,y,z0) up to and including (x,y,z1) to "color".
+ * /notes Linear grids store z contiguously, so the span is one block fill; the other layouts go voxel by voxel.
+ * Writing a sparse grid allocates bricks, so unlike the dense layouts, it must not be filled from several threads.
+ */
+void VoxelGrid::FillSpan(long long x,long long y,long long z0,long long z1,pixel_t color){
+	if(z1 < z0) return;
+	if(_layout==LINEAR_LAYOUT){
+		FillPixels(_voxels + Index(x,y,z0),static_cast<size_t>(z1 - z0 + 1),color);
+		return;
+	}
+	for(long long z=z0;z<=z1;++z){
+		(*this)(x,y,z) = color;
+	}
+}
+
+/**
+ * /name Voxels
+ * /brief Returns the voxel buffer: all voxels for the dense layouts, the allocated bricks for the sparse layout.
+ */
+const pixel_t* VoxelGrid::Voxels() const {
+	if(_layout==SPARSE_LAYOUT) return _brickPool.empty() ? NULL : &_brickPool[0];
+	return _voxels;
+}
+
+/**
+ * /name NumVoxels
+ * /brief Returns the number of voxels in the voxel buffer (see Voxels()).
+ */
+size_t VoxelGrid::NumVoxels() const {
+	return (_layout==SPARSE_LAYOUT) ? _brickPool.size() : _numVoxels;
+}
+
+/**
+ * /name MemoryUsage
+ * /brief Returns the number of bytes allocated for the voxels (and the brick map, for the sparse layout).
+ */
+size_t VoxelGrid::MemoryUsage() const {
+	if(_layout==SPARSE_LAYOUT){
+		return static_cast<size_t>(_bricks[0]*_bricks[1]*_bricks[2])*sizeof(uint32_t) + _brickPool.capacity()*sizeof(pixel_t);
+	}
+	return _numVoxels*sizeof(pixel_t);
+}